@@ -0,0 +1,43 @@
+#!/bin/bash
+
+# Замер масштабирования многопоточной записи команд.
+# Для каждой пары (число объектов, число потоков) генерирует сценарий,
+# запускает его в режиме --headless и сохраняет JSON-отчёт.
+#
+# Число потоков задаётся параметром сценария threads и ограничено числом
+# рабочих потоков (по умолчанию ядра - 1, но не больше 7; см. --workers).
+#
+# Использование: benchmarks/stress_scaling.sh [каталог_отчётов]
+
+cd "$(dirname "$0")/.."
+
+OUT_DIR="${1:-build/stress_reports}"
+BINARY=./build/Lab1_3DGraphics
+OBJECTS="256 1024 4096"
+THREADS="1 2 4 8"
+
+[ -x "$BINARY" ] || { echo "Сначала соберите проект (нет $BINARY)"; exit 1; }
+mkdir -p "$OUT_DIR"
+
+for objects in $OBJECTS; do
+    for threads in $THREADS; do
+        script="$OUT_DIR/stress_${objects}_${threads}.txt"
+        report="$OUT_DIR/stress_${objects}_${threads}.json"
+
+        cat > "$script" <<SCRIPT
+timestep 0.016667
+warmup 60
+duration 5
+camera 0 0 4 14 0 -10
+set 0 stress_objects $objects
+set 0 threads $threads
+SCRIPT
+
+        echo "Объектов: $objects, потоков: $threads"
+        "$BINARY" --headless 1 \
+            --benchmark "$script" --benchmark-output "$report" >/dev/null \
+            || { echo "Запуск завершился с ошибкой"; exit 1; }
+    done
+done
+
+echo "Отчёты сохранены в $OUT_DIR"
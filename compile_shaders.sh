@@ -9,12 +9,20 @@ if command -v glslc &> /dev/null; then
     glslc -fshader-stage=fragment shaders/frag.glsl -o shaders/frag.spv
     glslc -fshader-stage=vertex shaders/shadow.vert -o shaders/shadow_vert.spv
     glslc -fshader-stage=fragment shaders/shadow.frag -o shaders/shadow_frag.spv
+    glslc -fshader-stage=vertex shaders/shadow_atlas.vert -o shaders/shadow_atlas_vert.spv
+    glslc -fshader-stage=compute shaders/evsm.comp -o shaders/evsm_comp.spv
+    glslc -fshader-stage=vertex shaders/upscale.vert -o shaders/upscale_vert.spv
+    glslc -fshader-stage=fragment shaders/upscale.frag -o shaders/upscale_frag.spv
 elif command -v glslangValidator &> /dev/null; then
     echo "Using glslangValidator to compile shaders..."
     glslangValidator -V shaders/vert.glsl -o shaders/vert.spv
     glslangValidator -V shaders/frag.glsl -o shaders/frag.spv
     glslangValidator -V shaders/shadow.vert -o shaders/shadow_vert.spv
     glslangValidator -V shaders/shadow.frag -o shaders/shadow_frag.spv
+    glslangValidator -V shaders/shadow_atlas.vert -o shaders/shadow_atlas_vert.spv
+    glslangValidator -V shaders/evsm.comp -o shaders/evsm_comp.spv
+    glslangValidator -V shaders/upscale.vert -o shaders/upscale_vert.spv
+    glslangValidator -V shaders/upscale.frag -o shaders/upscale_frag.spv
 else
     echo "Error: Neither glslc nor glslangValidator found!"
     echo "Please install Vulkan SDK or glslangValidator"
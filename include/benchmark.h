@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Сценарий замера производительности: путь камеры и таймлайн параметров.
+//
+// Формат файла (по одной команде на строку, '#' — комментарий):
+//   timestep 0.016667            шаг времени кадра, секунды
+//   warmup 120                   число кадров прогрева (не попадают в статистику)
+//   duration 20                  длительность таймлайна, секунды
+//   camera <t> <x> <y> <z> <yaw> <pitch>
+//   set <t> <параметр> <значение>
+class Benchmark {
+public:
+    struct CameraKey {
+        double time;
+        glm::vec3 position;
+        float yaw;
+        float pitch;
+    };
+
+    struct SettingKey {
+        double time;
+        std::string name;
+        float value;
+    };
+
+    // Бросает std::runtime_error, если файл не читается или содержит ошибку
+    void load(const std::string& path);
+
+    double timeStep() const { return timeStep_; }
+    uint32_t warmupFrames() const { return warmupFrames_; }
+    uint32_t totalFrames() const;
+
+    // Время таймлайна для кадра; во время прогрева всегда 0
+    double timelineTime(uint64_t frame) const;
+    bool isFinished(uint64_t frame) const { return frame >= totalFrames(); }
+
+    // Положение камеры, линейно интерполированное между ключами
+    bool sampleCamera(double time, glm::vec3& position, float& yaw, float& pitch) const;
+
+    // Последнее значение каждого параметра с ключом не позже time
+    std::vector<std::pair<std::string, float>> settingsAt(double time) const;
+
+    // Замеры кадра с номером frame; кадры прогрева игнорируются.
+    // Время кадра известно сразу, CPU/GPU-замеры профайлера приходят с задержкой.
+    void recordFrameTime(uint64_t frame, double frameMs);
+    void recordProfile(uint64_t frame, double cpuMs, double gpuMs);
+
+    // Пишет mean/p50/p95/p99/max в JSON
+    void writeReport(const std::string& path) const;
+
+private:
+    std::string scriptPath_;
+    double timeStep_ = 1.0 / 60.0;
+    uint32_t warmupFrames_ = 120;
+    double duration_ = 10.0;
+
+    std::vector<CameraKey> cameraKeys_;
+    std::vector<SettingKey> settingKeys_;
+
+    std::vector<double> frameMs_;
+    std::vector<double> cpuMs_;
+    std::vector<double> gpuMs_;
+};
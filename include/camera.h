@@ -9,6 +9,7 @@ public:
     
     void setDistance(float distance); // Расстояние от цели (сферы)
     void setRotation(float yaw, float pitch);
+    void setPosition(const glm::vec3& position); // Свободная позиция, ориентация не меняется
     void rotate(float deltaYaw, float deltaPitch);
     void move(const glm::vec3& delta);
     void moveRelative(float forward, float right, float up);
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Регулятор качества: по замерам CPU и GPU выбирает уровень качества так,
+// чтобы кадр укладывался в бюджет. Уровни нумеруются от самого дешёвого (0)
+// к самому дорогому, что именно меняет уровень, решает вызывающий код.
+//
+// Гистерезис: уровень понижается, когда сглаженное время кадра держится выше
+// бюджета downHoldFrames кадров подряд, и повышается, когда оно держится ниже
+// upThreshold * бюджет дольше. Если повышение не удержалось (сразу пришлось
+// понизить обратно), следующая попытка подняться на тот же уровень ждёт вдвое
+// дольше.
+class QualityGovernor {
+public:
+    struct Change {
+        int from;
+        int to;
+        // Сглаженные значения, из-за которых сменился уровень
+        double cpuMs;
+        double gpuMs;
+    };
+
+    QualityGovernor(int tierCount, int initialTier);
+
+    void setBudget(double ms) { budgetMs_ = ms; }
+    double budget() const { return budgetMs_; }
+
+    int tier() const { return tier_; }
+
+    // Ручная установка уровня, накопленные счётчики сбрасываются
+    void setTier(int tier);
+
+    // Замер одного кадра; gpuMs == 0, если GPU-таймеры недоступны.
+    // Возвращает true и заполняет change, если уровень сменился
+    bool addSample(double cpuMs, double gpuMs, Change& change);
+
+    double smoothedCpuMs() const { return cpuMs_; }
+    double smoothedGpuMs() const { return gpuMs_; }
+
+private:
+    void switchTo(int tier);
+
+    int tierCount_;
+    int tier_;
+    double budgetMs_ = 1000.0 / 60.0;
+
+    double cpuMs_ = 0.0;
+    double gpuMs_ = 0.0;
+
+    // Замеры сразу после смены ещё относятся к старому уровню и пропускаются
+    uint32_t settleFrames_ = 0;
+    bool smoothed_ = false;
+
+    uint32_t overBudgetFrames_ = 0;
+    uint32_t underBudgetFrames_ = 0;
+
+    // Кадров с последнего повышения; по нему видно, удержалось ли оно
+    uint32_t framesSinceRaise_ = 0;
+    bool raised_ = false;
+
+    // Сколько кадров ждать перед повышением на уровень i
+    std::vector<uint32_t> upHoldFrames_;
+};
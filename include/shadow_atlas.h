@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Распределитель тайлов в квадратном атласе теней (квадродерево). Сторона атласа
+// и тайлов — степени двойки; узел либо свободен, либо занят целиком, либо разбит
+// на четыре дочерних вдвое меньших. Освобождённые соседи снова сливаются в родителя.
+class ShadowAtlas {
+public:
+    struct Tile {
+        uint32_t x = 0;
+        uint32_t y = 0;
+        uint32_t size = 0; // 0 — тайла нет
+    };
+
+    // count тайлов одной стороны, например грани точечного источника
+    struct Group {
+        uint32_t size;
+        uint32_t count;
+        Tile* tiles;
+    };
+
+    ShadowAtlas(uint32_t size, uint32_t minTileSize);
+
+    uint32_t size() const { return size_; }
+    uint32_t minTileSize() const { return minTileSize_; }
+
+    // Сторона округляется вверх до степени двойки и ограничивается [minTileSize, size].
+    // Возвращает false, если свободного места такого размера нет
+    bool allocate(uint32_t size, Tile& tile);
+    void release(const Tile& tile);
+
+    // Все тайлы группы или ни одного
+    bool allocate(const Group& group, uint32_t size);
+
+    // Раздаёт атлас заново группам в заданном порядке (от больших к меньшим атлас не дробится).
+    // Не поместившаяся группа уменьшается вдвое вплоть до minTileSize; без места — тайлы с size == 0
+    void repack(const Group* groups, uint32_t groupCount);
+
+    // Освобождает весь атлас
+    void clear();
+
+    // Занятая площадь в текселях
+    uint64_t usedArea() const { return usedArea_; }
+
+private:
+    struct Node {
+        uint32_t x;
+        uint32_t y;
+        uint32_t size;
+        int32_t firstChild; // -1 у листа, иначе индекс первого из четырёх дочерних
+        bool used;
+    };
+
+    int32_t find(int32_t node, uint32_t size, bool allowSplit);
+    void split(int32_t node);
+    bool releaseAt(int32_t node, const Tile& tile);
+
+    uint32_t size_;
+    uint32_t minTileSize_;
+    uint64_t usedArea_ = 0;
+
+    std::vector<Node> nodes_;
+    // Четвёрки узлов, освободившиеся после слияния, используются повторно
+    std::vector<int32_t> freeBlocks_;
+};
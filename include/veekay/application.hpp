@@ -4,10 +4,57 @@
 
 namespace veekay {
 
+namespace graphics {
+
+struct TransientBuffer;
+
+} // namespace graphics
+
+// NOTE: Upper bound for ApplicationInfo::frames_in_flight, handy for sizing per-frame arrays
+constexpr uint32_t max_frames_in_flight = 4;
+
+/* NOTE:
+	Everything owned by one frame-in-flight slot. The slot is reused only after
+	the graphics timeline reached its timeline_value, so anything indexed by
+	`index` (UBOs, descriptor sets, transient allocations) is safe to overwrite
+	from update() and render().
+*/
+struct FrameContext {
+	uint32_t index;  // NOTE: Slot in [0, app.frames_in_flight)
+	uint64_t number; // NOTE: Monotonic frame counter
+
+	VkCommandPool command_pool;
+	VkCommandBuffer command_buffer; // NOTE: Already reset, begin/end it in render()
+	VkSemaphore image_available_semaphore;
+
+	// NOTE: Graphics timeline value signaled by the slot's previous frame, 0 before its first use
+	uint64_t timeline_value;
+
+	// NOTE: Host-visible linear allocator, rewound at the start of every frame
+	graphics::TransientBuffer* transient;
+
+	// NOTE: Valid only in render(), the image is acquired after update()
+	uint32_t image_index;
+	VkFramebuffer framebuffer; // NOTE: For app.vk_render_pass, the offscreen scene target under dynamic resolution
+
+	// NOTE: Area of framebuffer to render the scene into, below window size under dynamic resolution
+	uint32_t render_width;
+	uint32_t render_height;
+};
+
+// NOTE: Unsupported modes fall back to the closest available one, FIFO always works
+enum class PresentMode {
+	fifo,         // NOTE: VSync, never tears
+	fifo_relaxed, // NOTE: VSync, tears when a frame is late
+	mailbox,      // NOTE: Newest frame wins, no tearing, GPU runs uncapped
+	immediate,    // NOTE: No sync with display, tears
+};
+
 typedef void (*InitFunc)(VkCommandBuffer);
 typedef void (*ShutdownFunc)();
-typedef void (*UpdateFunc)(double time);
-typedef void (*RenderFunc)(VkCommandBuffer, VkFramebuffer);
+typedef void (*UpdateFunc)(const FrameContext& frame, double time);
+typedef void (*RenderFunc)(const FrameContext& frame);
+typedef void (*LateUpdateFunc)(const FrameContext& frame);
 
 struct Application {
 	uint32_t window_width;
@@ -17,6 +64,19 @@ struct Application {
 	VkPhysicalDevice vk_physical_device;
 	VkRenderPass vk_render_pass;
 
+	// NOTE: For command pools the app keeps itself, e.g. secondaries reused across frames
+	uint32_t graphics_queue_family;
+
+	/* NOTE:
+		Timeline semaphore of the graphics queue. Every submission signals the
+		next value, so work on other queues can wait for any graphics work by
+		value, and the CPU can poll or wait for it without fences.
+	*/
+	VkSemaphore vk_graphics_timeline;
+
+	uint32_t frames_in_flight;
+	PresentMode present_mode; // NOTE: Mode actually in use after fallback
+
 	bool running;
 };
 
@@ -25,10 +85,97 @@ struct ApplicationInfo {
 	ShutdownFunc shutdown;
 	UpdateFunc update;
 	RenderFunc render;
+
+	// NOTE: 0 picks the default of 2, clamped to max_frames_in_flight
+	uint32_t frames_in_flight;
+
+	PresentMode present_mode;
+
+	// NOTE: Forces immediate (or mailbox) presentation and prints FPS once per second
+	bool uncapped;
+
+	/* NOTE:
+		Headless runs skip GLFW and the surface and render into offscreen images
+		for headless_frames frames with a fixed 1/60 s time step. If
+		headless_output is set, the last frame is read back to that PPM file.
+		Size 0 picks the default window size.
+	*/
+	bool headless;
+	uint32_t headless_frames;
+	uint32_t headless_width;
+	uint32_t headless_height;
+	const char* headless_output;
+
+	// NOTE: Extra threads for parallel::recordSubpass, 0 picks one per spare hardware thread
+	uint32_t worker_threads;
+
+	/* NOTE:
+		Runs update() and UI on the calling thread and record/submit/present on a
+		separate render thread, one frame apart. update() may then run at the
+		same time as render() of the previous frame: render() must read only
+		per-slot data written by update(), not state update() keeps changing.
+		Forces at least 2 frames in flight.
+	*/
+	bool pipelined;
+
+	/* NOTE:
+		Renders app.vk_render_pass into an offscreen target at a scale that
+		follows GPU frame time against target_frame_ms (0 means 60 FPS), then
+		upscales it into the window with sharpening. The UI stays at native
+		resolution. See veekay/resolution.hpp.
+	*/
+	bool dynamic_resolution;
+	double target_frame_ms;
+
+	/* NOTE:
+		Low latency mode waits for all submitted GPU work before polling input,
+		so update() never runs more than one frame ahead of the display. If
+		late_update is set, input is polled once more right after the swapchain
+		image is acquired and late_update() runs just before render(), e.g. to
+		re-aim the camera. It must only touch the frame's own data. Not called
+		in pipelined or headless runs, which cannot poll input there.
+	*/
+	bool low_latency;
+	LateUpdateFunc late_update;
+
+	/* NOTE:
+		On-demand mode draws a frame only when something asked for it: input,
+		a window refresh or requestRedraw(). Otherwise the loop sleeps in
+		glfwWaitEventsTimeout and the last presented image stays on screen.
+		Anything that animates must call requestRedraw() from update(). Ignored
+		in headless runs.
+	*/
+	bool on_demand;
+
+	// NOTE: Seconds per frame passed to update() instead of wall-clock time, 0 disables
+	double fixed_time_step;
+
+	// NOTE: If set, per-frame CPU and GPU timings are written there on exit (.json or CSV)
+	const char* profile_output;
 };
 
 extern Application app;
 
 int run(const ApplicationInfo& app_info);
 
+/* NOTE:
+	Ends a render pass begun with app.vk_render_pass. Use it instead of
+	vkCmdEndRenderPass: it moves to the UI subpass and draws ImGui there.
+*/
+void endRenderPass(VkCommandBuffer cmd);
+
+// NOTE: Takes effect at the start of the next frame, only the swapchain is rebuilt
+void setPresentMode(PresentMode mode);
+
+// NOTE: Under ApplicationInfo::on_demand, draws a few more frames so the UI settles. Any thread
+void requestRedraw();
+
+// NOTE: Last value of app.vk_graphics_timeline promised by a submission
+uint64_t timelineSubmitted();
+
+// NOTE: Value app.vk_graphics_timeline has reached, everything up to it has finished on the GPU
+uint64_t timelineCompleted();
+
+void waitTimeline(uint64_t value);
+
 } // namespace veekay
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+
+namespace veekay::compute {
+
+/* NOTE:
+	Queue discovery only. Frame passes that could use a separate compute queue
+	(the EVSM blur) need the same frame's shadow map, so they stay on the
+	graphics queue and nothing is submitted to this family yet.
+*/
+
+// NOTE: Whether the device has a compute family apart from graphics
+bool isAsync();
+
+uint32_t queueFamily();
+
+} // namespace veekay::compute
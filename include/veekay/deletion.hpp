@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace veekay::deletion {
+
+/* NOTE:
+	Runs destroy once the GPU has finished the frame being built right now and
+	everything submitted before it, so whatever update() or render() just
+	stopped using can be freed without a vkDeviceWaitIdle. Callbacks run on the
+	main thread at the start of a later frame, or at shutdown before
+	ApplicationInfo::shutdown. Any thread.
+*/
+void defer(std::function<void()> destroy);
+
+// NOTE: Same, but waits for a given value of app.vk_graphics_timeline
+void defer(uint64_t timeline_value, std::function<void()> destroy);
+
+template <typename T>
+void deferDelete(T* object) {
+	defer([object] { delete object; });
+}
+
+// NOTE: Callbacks still waiting for the GPU
+size_t pendingCount();
+
+} // namespace veekay::deletion
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <vector>
+
 #include <vulkan/vulkan_core.h>
 
 namespace veekay::graphics {
@@ -32,4 +34,80 @@ struct Texture {
 	~Texture();
 };
 
+struct TransientAllocation {
+	VkBuffer buffer;
+	VkDeviceSize offset;
+	void* data;
+};
+
+// NOTE: Linear per-frame allocator for data that lives for a single frame
+struct TransientBuffer {
+	Buffer* buffer;
+	VkDeviceSize capacity;
+	VkDeviceSize cursor;
+
+	TransientBuffer(VkDeviceSize capacity, VkBufferUsageFlags usage);
+	~TransientBuffer();
+
+	TransientAllocation allocate(VkDeviceSize size, VkDeviceSize alignment = 256);
+	void reset();
+};
+
+// NOTE: Location of a mesh inside GeometryBuffer, ready for vkCmdDrawIndexed
+struct Mesh {
+	uint32_t first_index;
+	uint32_t index_count;
+	int32_t vertex_offset;
+	uint32_t vertex_count;
+	bool alive;
+};
+
+/* NOTE:
+	All static meshes share one vertex buffer and one uint32 index buffer, so a
+	pass binds geometry once and addresses meshes by firstIndex/vertexOffset.
+	Indices stay relative to their mesh, which lets compaction move whole ranges
+	without rewriting them. Space is never reused in place: growing and
+	compacting copy live meshes into new buffers and hand the old ones to
+	veekay::deletion, so frames in flight keep reading what they were recorded
+	with. Commands recorded before upload(), free() or compact() may bind stale
+	buffers or offsets, callers re-record them after any of those.
+*/
+struct GeometryBuffer {
+	uint32_t vertex_stride;
+	uint32_t vertex_capacity;
+	uint32_t index_capacity;
+
+	// NOTE: Append cursors, everything past them is unused
+	uint32_t vertex_count;
+	uint32_t index_count;
+
+	// NOTE: Space held by freed meshes, reclaimed by compact()
+	uint32_t freed_vertices;
+	uint32_t freed_indices;
+
+	Buffer* vertex_buffer;
+	Buffer* index_buffer;
+
+	// NOTE: Indexed by mesh handle, handles are never reused
+	std::vector<Mesh> meshes;
+
+	GeometryBuffer(uint32_t vertex_stride,
+	               uint32_t vertex_capacity,
+	               uint32_t index_capacity);
+	~GeometryBuffer();
+
+	// NOTE: Appends a mesh and returns its handle
+	uint32_t upload(const void* vertices, uint32_t vertex_count,
+	                const uint32_t* indices, uint32_t index_count);
+	void free(uint32_t mesh);
+	void compact();
+
+	// NOTE: Copies live meshes to the front of new buffers, the old ones are deferred for deletion
+	void reallocate(uint32_t vertex_capacity, uint32_t index_capacity);
+
+	void bind(VkCommandBuffer cmd) const;
+	void draw(VkCommandBuffer cmd, uint32_t mesh,
+	          uint32_t instance_count = 1, uint32_t first_instance = 0) const;
+};
+
 } // namespace veekay::graphics
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include <veekay/application.hpp>
+
+namespace veekay::parallel {
+
+// NOTE: Records items [first, first + count) into a secondary command buffer, called concurrently
+typedef void (*RecordFunc)(VkCommandBuffer cmd, const FrameContext& frame,
+                           uint32_t first, uint32_t count);
+
+// NOTE: Threads that can record, the main thread included
+uint32_t maxThreadCount();
+
+// NOTE: How many of them recordSubpass() may use, clamped to [1, maxThreadCount()]
+void setThreadCount(uint32_t count);
+uint32_t threadCount();
+
+/* NOTE:
+	Splits [0, item_count) into contiguous chunks, one per thread, and records
+	each chunk into a secondary command buffer from that thread's pool for the
+	current frame slot. The secondaries are then executed in order on
+	frame.command_buffer. The render pass must be active and its current
+	subpass begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS.
+	Secondaries start with no bound state, so `record` must bind what it needs.
+*/
+void recordSubpass(const FrameContext& frame,
+                   VkRenderPass render_pass, uint32_t subpass, VkFramebuffer framebuffer,
+                   uint32_t item_count, RecordFunc record);
+
+} // namespace veekay::parallel
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+namespace veekay::profiler {
+
+// NOTE: Upper bound for beginPass/endPass pairs recorded in a single frame
+constexpr uint32_t max_passes = 16;
+
+enum class CpuStage {
+	update, // NOTE: ApplicationInfo::update
+	record, // NOTE: ApplicationInfo::render plus ImGui command recording
+	submit, // NOTE: vkQueueSubmit
+	present, // NOTE: vkQueuePresentKHR
+	count,
+};
+
+/* NOTE:
+	Timings of one finished frame. GPU results are read back when the frame's
+	slot is reused, so they lag frames_in_flight frames behind the CPU.
+*/
+struct FrameTimings {
+	uint64_t number;
+
+	double cpu_ms[static_cast<size_t>(CpuStage::count)];
+
+	// NOTE: From the first beginPass to the last endPass, 0 if no passes were timed
+	double gpu_ms;
+
+	// NOTE: From the last input sample to vkQueuePresentKHR returning (submit when headless)
+	double latency_ms;
+
+	// NOTE: Indexed by pass id, see passNames(), negative if the pass was not recorded
+	double pass_ms[max_passes];
+};
+
+// NOTE: Passes may nest, endPass closes the innermost open one
+void beginPass(VkCommandBuffer cmd, const char* name);
+void endPass(VkCommandBuffer cmd);
+
+// NOTE: Copies the most recent frame with GPU results, false until the first one arrives
+bool latest(FrameTimings& timings);
+
+// NOTE: Names of every pass seen so far, position is the pass id. Read it on the recording thread
+const std::vector<std::string>& passNames();
+
+const char* cpuStageName(CpuStage stage);
+
+void setOverlayVisible(bool visible);
+bool isOverlayVisible();
+
+// NOTE: Writes every frame of the session, format is chosen by extension (.json, otherwise CSV)
+bool exportTimings(const char* path);
+
+} // namespace veekay::profiler
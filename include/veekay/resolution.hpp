@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+
+namespace veekay::resolution {
+
+// NOTE: Bounds of the per-axis scale, the scene target itself is always full size
+constexpr float min_scale = 0.5f;
+constexpr float max_scale = 1.0f;
+
+enum class ControllerState {
+	manual,     // NOTE: Dynamic scaling is off, the scale is whatever setScale() set
+	no_timings, // NOTE: No GPU timestamps yet (or at all), the scale is held
+	stable,     // NOTE: GPU time is within the budget's dead band
+	lowering,
+	raising,
+};
+
+struct Status {
+	float scale;
+	uint32_t width; // NOTE: Scene extent the next frame renders at
+	uint32_t height;
+
+	double gpu_ms;    // NOTE: Smoothed GPU frame time the controller reacts to
+	double target_ms;
+
+	ControllerState state;
+};
+
+// NOTE: Whether ApplicationInfo::dynamic_resolution was set, everything else is a no-op otherwise
+bool isEnabled();
+
+Status status();
+
+const char* controllerStateName(ControllerState state);
+
+// NOTE: Turning dynamic scaling off keeps the current scale until setScale() changes it
+void setDynamic(bool dynamic);
+bool isDynamic();
+
+void setScale(float scale);
+
+// NOTE: GPU time per frame the controller aims for
+void setTargetFrameTime(double ms);
+
+// NOTE: 0 is plain bilinear upscaling, 1 is the strongest sharpening
+void setSharpness(float sharpness);
+float sharpness();
+
+} // namespace veekay::resolution
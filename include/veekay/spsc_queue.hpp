@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace veekay {
+
+/* NOTE:
+	Bounded lock-free queue for exactly one producer thread and one consumer
+	thread. tryPush/tryPop never block; push/pop sleep on the opposite index
+	with std::atomic::wait instead of spinning. Indices grow monotonically and
+	are reduced modulo capacity only to address items.
+*/
+template <typename T, size_t capacity>
+class SpscQueue {
+public:
+	// NOTE: Producer side
+	bool tryPush(const T& value) {
+		size_t tail_index = tail.load(std::memory_order_relaxed);
+
+		if (tail_index - head.load(std::memory_order_acquire) == capacity) {
+			return false;
+		}
+
+		items[tail_index % capacity] = value;
+		tail.store(tail_index + 1, std::memory_order_release);
+		tail.notify_one();
+
+		return true;
+	}
+
+	// NOTE: Producer side, waits while the queue is full
+	void push(const T& value) {
+		for (;;) {
+			size_t head_index = head.load(std::memory_order_acquire);
+
+			if (tryPush(value)) {
+				return;
+			}
+
+			head.wait(head_index, std::memory_order_acquire);
+		}
+	}
+
+	// NOTE: Consumer side
+	bool tryPop(T& value) {
+		size_t head_index = head.load(std::memory_order_relaxed);
+
+		if (tail.load(std::memory_order_acquire) == head_index) {
+			return false;
+		}
+
+		value = items[head_index % capacity];
+		head.store(head_index + 1, std::memory_order_release);
+		head.notify_one();
+
+		return true;
+	}
+
+	// NOTE: Consumer side, waits while the queue is empty
+	T pop() {
+		T value;
+
+		for (;;) {
+			size_t tail_index = tail.load(std::memory_order_acquire);
+
+			if (tryPop(value)) {
+				return value;
+			}
+
+			tail.wait(tail_index, std::memory_order_acquire);
+		}
+	}
+
+private:
+	// NOTE: Separate cache lines so the two threads do not fight over one
+	alignas(64) std::atomic<size_t> head{0}; // NOTE: Next item to pop, written by the consumer
+	alignas(64) std::atomic<size_t> tail{0}; // NOTE: Next slot to fill, written by the producer
+
+	T items[capacity];
+};
+
+} // namespace veekay
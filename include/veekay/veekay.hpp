@@ -4,3 +4,9 @@
 #include <veekay/application.hpp>
 #include <veekay/input.hpp>
 #include <veekay/graphics.hpp>
+#include <veekay/profiler.hpp>
+#include <veekay/parallel.hpp>
+#include <veekay/compute.hpp>
+#include <veekay/deletion.hpp>
+#include <veekay/resolution.hpp>
+#include <veekay/spsc_queue.hpp>
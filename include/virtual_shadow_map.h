@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Таблица страниц виртуальной карты теней. Виртуальная текстура — окно из
+// tableSize × tableSize страниц в плоскости света; страница с координатами (x, y)
+// всегда лежит в ячейке (x mod tableSize, y mod tableSize), поэтому при сдвиге окна
+// оставшиеся в нём страницы не переезжают. Физические страницы — квадраты пула
+// poolPages × poolPages; давно не запрошенные вытесняются первыми.
+class VirtualShadowMap {
+public:
+    struct Page {
+        int32_t x = 0;
+        int32_t y = 0;
+    };
+
+    // Страница, которую нужно нарисовать в физическую страницу physical
+    struct Render {
+        uint32_t physical = 0;
+        Page page;
+    };
+
+    VirtualShadowMap(uint32_t tableSize, uint32_t poolPages);
+
+    uint32_t tableSize() const { return tableSize_; }
+    uint32_t poolPages() const { return poolPages_; }
+    uint32_t residentPages() const { return residentPages_; }
+    Page origin() const { return origin_; }
+
+    // Освобождает все страницы: свет, масштаб или диапазон глубины изменились
+    void invalidateAll();
+    // Страницы прямоугольника [min, max] (включительно) будут нарисованы заново
+    void invalidate(Page min, Page max);
+
+    // Сдвигает окно, вышедшие из него страницы освобождаются
+    void setOrigin(Page origin);
+
+    // Биты запрошенных ячеек таблицы (бит i слова i / 32 — ячейка i), записанные кадром,
+    // окно которого начиналось в requestOrigin. Страницы вне текущего окна пропускаются
+    void request(const uint32_t* bits, Page requestOrigin);
+
+    // Раздаёт физические страницы запрошенным и возвращает не больше maxRenders страниц,
+    // которые нужно нарисовать в этом кадре. Остальные ждут следующих кадров
+    uint32_t update(uint64_t frame, uint32_t maxRenders, Render* renders);
+
+    // Для шейдера: по ячейке — индекс физической страницы + 1, 0 — страница не нарисована
+    const std::vector<uint32_t>& table() const { return table_; }
+
+private:
+    struct Physical {
+        Page page;
+        uint64_t lastUsed = 0; // кадр последнего запроса
+        bool mapped = false;
+        bool dirty = false; // содержимое устарело или ещё не нарисовано
+    };
+
+    uint32_t cell(Page page) const;
+    bool inWindow(Page page) const;
+    void unmap(uint32_t physical);
+    bool allocate(uint64_t frame, uint32_t& physical);
+
+    uint32_t tableSize_;
+    uint32_t poolPages_;
+    uint32_t residentPages_ = 0;
+    Page origin_;
+
+    std::vector<uint32_t> table_;
+    std::vector<int32_t> cells_; // физическая страница ячейки, -1 — нет
+    std::vector<Physical> physical_;
+    std::vector<uint32_t> free_;
+    std::vector<Page> requested_;
+};
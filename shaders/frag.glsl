@@ -4,16 +4,22 @@ layout(location = 0) in vec3 fragPos;
 layout(location = 1) in vec3 fragNormal;
 layout(location = 2) in vec3 fragColor;
 layout(location = 3) in vec2 fragUV;
-layout(location = 4) in vec4 fragPosLightSpace;
 
 layout(location = 0) out vec4 outColor;
 
+// The virtual shadow map's page requests are stores, which would otherwise move the depth test after
+// the shader: occluded fragments would request pages and every variant would lose early-Z.
+// Nothing here discards or writes depth, so the early test gives the same image.
+layout(early_fragment_tests) in;
+
+// Directional shadow filtering, one pipeline per mode: 0 hard, 1 gather PCF, 2 3x3 PCF, 3 PCSS, 4 EVSM.
+layout(constant_id = 0) const int SHADOW_FILTER = 2;
+
 layout(binding = 0) uniform UniformBufferObject {
     mat4 model;
     mat4 view;
     mat4 projection;
     mat4 normalMatrix;
-    mat4 lightSpaceMatrix;
     vec4 cameraPos;
     vec4 ambientColor;   // rgb + intensity in w
 } ubo;
@@ -31,12 +37,14 @@ layout(binding = 2) uniform DirectionalLight {
 struct PointLight {
     vec4 positionIntensity; // xyz position, w intensity
     vec4 colorRange;        // rgb color, w range (optional)
+    ivec4 shadow;           // x: first of six atlas entries (+X, -X, +Y, -Y, +Z, -Z), -1 without shadow
 };
 
 struct SpotLight {
     vec4 positionIntensity; // xyz position, w intensity
     vec4 directionInnerCos; // xyz direction, w inner cos
     vec4 colorOuterCos;     // rgb color, w outer cos
+    ivec4 shadow;           // x: atlas entry, -1 without shadow
 };
 
 layout(std430, binding = 3) readonly buffer PointLightBuffer {
@@ -48,36 +56,320 @@ layout(std430, binding = 4) readonly buffer SpotLightBuffer {
 };
 
 layout(binding = 5) uniform LightCounts {
-    ivec4 counts; // x: point, y: spot, z: shadows enabled (0/1)
+    ivec4 counts; // x: point, y: spot, z: shadows enabled (0/1), w: atlas PCF radius (0: single tap, 1: 3x3)
 } lightCounts;
 
 layout(binding = 6) uniform sampler2D texSampler;
-layout(binding = 7) uniform sampler2DShadow shadowMap;
+layout(binding = 7) uniform sampler2DArrayShadow shadowMap; // one layer per cascade
+
+layout(binding = 8) uniform ShadowCascades {
+    mat4 viewProj[4];
+    vec4 splits; // view-space distance where each cascade ends
+    vec4 params; // x: cascade count, y: blend band as a fraction of a cascade, z: tint cascades, w: PCSS light size
+    mat4 vsmViewProj; // xy -1..1 across the virtual shadow map's page window
+    ivec4 vsmPages; // x: page table size (0: off), yz: window origin in pages, w: pool pages per side
+    vec4 vsmParams; // x: depth bias of one texel
+} cascades;
+
+// The shadow map again without comparison, for the PCSS blocker search.
+layout(binding = 11) uniform sampler2DArray shadowDepth;
+// Blurred EVSM moments at half resolution, one layer per cascade (evsm.comp).
+layout(binding = 12) uniform sampler2DArray shadowMoments;
+
+const float EVSM_EXPONENT = 5.0; // same as evsm.comp
+const float EVSM_BLEED_REDUCTION = 0.2;
+// How far above a receiver (world units) the PCSS blocker search looks.
+const float PCSS_SEARCH_DISTANCE = 4.0;
+
+const vec2 POISSON_DISK[16] = vec2[](
+    vec2(-0.94201624, -0.39906216), vec2(0.94558609, -0.76890725),
+    vec2(-0.09418410, -0.92938870), vec2(0.34495938, 0.29387760),
+    vec2(-0.91588581, 0.45771432), vec2(-0.81544232, -0.87912464),
+    vec2(-0.38277543, 0.27676845), vec2(0.97484398, 0.75648379),
+    vec2(0.44323325, -0.97511554), vec2(0.53742981, -0.47373420),
+    vec2(-0.26496911, -0.41893023), vec2(0.79197514, 0.19090188),
+    vec2(-0.24188840, 0.99706507), vec2(-0.81409955, 0.91437590),
+    vec2(0.19984126, 0.78641367), vec2(0.14383161, -0.14100790)
+);
+
+// Spot and point light shadows, one tile per light (per cube face for point lights).
+layout(binding = 9) uniform sampler2DArrayShadow shadowAtlas; // a single layer
+
+struct ShadowAtlasEntry {
+    mat4 viewProj;
+    vec4 rect; // xy: tile origin, zw: tile size, in atlas UV
+};
+
+layout(std430, binding = 10) readonly buffer ShadowAtlasBuffer {
+    ShadowAtlasEntry atlasEntries[];
+};
+
+// Virtual shadow map: pages rendered on demand into a pool, found through a page table.
+layout(binding = 13) uniform sampler2DArrayShadow vsmPool; // a single layer
+// Per table cell: pool page + 1, 0 while the page is not rendered.
+layout(std430, binding = 14) readonly buffer VsmPageTable {
+    uint vsmPageTable[];
+};
+// One bit per table cell, the pages this frame sampled; read back on the CPU.
+layout(std430, binding = 15) coherent buffer VsmRequests {
+    uint vsmRequests[];
+};
+
+// Last cascade covering viewDepth, or -1 past the shadow distance.
+int selectCascade(float viewDepth) {
+    int count = int(cascades.params.x);
+    for (int i = 0; i < count; ++i) {
+        if (viewDepth <= cascades.splits[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// The filters below return the lit fraction of p (xy: shadow map UV, z: biased receiver depth).
+
+float filterPcf3x3(int cascade, vec3 p) {
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    for (int x = -1; x <= 1; ++x) {
+        for (int y = -1; y <= 1; ++y) {
+            lit += texture(shadowMap, vec4(p.xy + vec2(x, y) * texelSize, float(cascade), p.z));
+        }
+    }
+    return lit / 9.0;
+}
+
+// Same bilinear 3x3 footprint as filterPcf3x3 from four gathers of 2x2 comparisons instead of nine taps.
+float filterGather(int cascade, vec3 p) {
+    vec2 size = vec2(textureSize(shadowMap, 0).xy);
+    vec2 tc = p.xy * size - 0.5;
+    vec2 base = floor(tc);
+    vec2 f = tc - base;
+
+    // A gather at texel-space u returns texels floor(u - 0.5) and the next one: here base-1 .. base+2.
+    // Components: w (x0, y0), z (x1, y0), x (x0, y1), y (x1, y1).
+    vec4 g00 = textureGather(shadowMap, vec3((base + vec2(0.0, 0.0)) / size, float(cascade)), p.z);
+    vec4 g10 = textureGather(shadowMap, vec3((base + vec2(2.0, 0.0)) / size, float(cascade)), p.z);
+    vec4 g01 = textureGather(shadowMap, vec3((base + vec2(0.0, 2.0)) / size, float(cascade)), p.z);
+    vec4 g11 = textureGather(shadowMap, vec3((base + vec2(2.0, 2.0)) / size, float(cascade)), p.z);
+
+    vec4 wx = vec4(1.0 - f.x, 1.0, 1.0, f.x);
+    vec4 wy = vec4(1.0 - f.y, 1.0, 1.0, f.y);
+    float lit = wy.x * dot(vec4(g00.w, g00.z, g10.w, g10.z), wx) +
+                wy.y * dot(vec4(g00.x, g00.y, g10.x, g10.y), wx) +
+                wy.z * dot(vec4(g01.w, g01.z, g11.w, g11.z), wx) +
+                wy.w * dot(vec4(g01.x, g01.y, g11.x, g11.y), wx);
+    return lit / 9.0;
+}
 
-float computeShadow(vec4 posLightSpace, vec3 N, vec3 lightDir) {
+float interleavedGradientNoise(vec2 p) {
+    return fract(52.9829189 * fract(dot(p, vec2(0.06711056, 0.00583715))));
+}
+
+// Percentage-closer soft shadows: the average blocker depth sets the filter size, so contact
+// shadows stay sharp and distant ones soften. The disk is rotated per pixel, trading banding for noise.
+float filterPcss(int cascade, vec3 p) {
+    // Orthographic light: UV and depth change linearly with world distance.
+    mat4 m = cascades.viewProj[cascade];
+    float uvPerUnit = 0.5 * length(vec3(m[0][0], m[1][0], m[2][0]));
+    float depthPerUnit = length(vec3(m[0][2], m[1][2], m[2][2]));
+    float lightSize = cascades.params.w; // tangent of the light's angular radius
+    float texel = 1.0 / float(textureSize(shadowMap, 0).x);
+
+    float angle = 6.2831853 * interleavedGradientNoise(gl_FragCoord.xy);
+    mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+
+    float searchUv = max(lightSize * PCSS_SEARCH_DISTANCE * uvPerUnit, texel);
+    float blockerSum = 0.0;
+    int blockers = 0;
+    for (int i = 0; i < 16; ++i) {
+        float depth = texture(shadowDepth, vec3(p.xy + rotation * POISSON_DISK[i] * searchUv, float(cascade))).r;
+        if (depth < p.z) {
+            blockerSum += depth;
+            ++blockers;
+        }
+    }
+    if (blockers == 0) {
+        return 1.0;
+    }
+
+    float blockerDistance = (p.z - blockerSum / float(blockers)) / depthPerUnit;
+    float filterUv = clamp(blockerDistance * lightSize * uvPerUnit, texel, searchUv);
+    float lit = 0.0;
+    for (int i = 0; i < 16; ++i) {
+        lit += texture(shadowMap, vec4(p.xy + rotation * POISSON_DISK[i] * filterUv, float(cascade), p.z));
+    }
+    return lit / 16.0;
+}
+
+float chebyshevUpperBound(vec2 moments, float mean, float minVariance) {
+    float variance = max(moments.y - moments.x * moments.x, minVariance);
+    float d = mean - moments.x;
+    return mean <= moments.x ? 1.0 : variance / (variance + d * d);
+}
+
+// Exponential variance shadow maps: both warps bound the lit fraction from above, the smaller
+// bound bleeds less. The remaining light bleeding is cut off at the low end.
+float filterEvsm(int cascade, vec3 p) {
+    vec4 moments = texture(shadowMoments, vec3(p.xy, float(cascade)));
+    float d = 2.0 * p.z - 1.0;
+    float pos = exp(EVSM_EXPONENT * d);
+    float neg = -exp(-EVSM_EXPONENT * d);
+    // Minimum variance follows the warp's slope, otherwise lit flat receivers flicker.
+    vec2 depthScale = 0.0001 * EVSM_EXPONENT * vec2(pos, -neg);
+    float lit = min(chebyshevUpperBound(moments.xy, pos, depthScale.x * depthScale.x),
+                    chebyshevUpperBound(moments.zw, neg, depthScale.y * depthScale.y));
+    return clamp((lit - EVSM_BLEED_REDUCTION) / (1.0 - EVSM_BLEED_REDUCTION), 0.0, 1.0);
+}
+
+float sampleCascade(int cascade, vec3 worldPos, float bias) {
+    vec4 posLightSpace = cascades.viewProj[cascade] * vec4(worldPos, 1.0);
     vec3 projCoords = posLightSpace.xyz / posLightSpace.w;
-    projCoords = projCoords * 0.5 + 0.5;
+    // Depth is already 0..1 (orthoRH_ZO), only xy needs remapping.
+    projCoords.xy = projCoords.xy * 0.5 + 0.5;
     if (projCoords.z > 1.0) {
         return 0.0;
     }
     if (projCoords.x < 0.0 || projCoords.x > 1.0 || projCoords.y < 0.0 || projCoords.y > 1.0) {
         return 0.0;
     }
+    vec3 p = vec3(projCoords.xy, projCoords.z - bias);
+
+    // SHADOW_FILTER is constant per pipeline, the unused branches are compiled out.
+    float lit;
+    if (SHADOW_FILTER == 0) {
+        lit = texture(shadowMap, vec4(p.xy, float(cascade), p.z));
+    } else if (SHADOW_FILTER == 1) {
+        lit = filterGather(cascade, p);
+    } else if (SHADOW_FILTER == 3) {
+        lit = filterPcss(cascade, p);
+    } else if (SHADOW_FILTER == 4) {
+        lit = filterEvsm(cascade, p);
+    } else {
+        lit = filterPcf3x3(cascade, p);
+    }
+    return 1.0 - lit;
+}
+
+// Lit fraction from the virtual shadow map, or -1 when its page is not rendered yet (the cascades take over).
+// Every page sampled is requested, so it is there a few frames later.
+float sampleVirtual(vec3 worldPos, float ndotl) {
+    vec4 posLightSpace = cascades.vsmViewProj * vec4(worldPos, 1.0);
+    vec3 projCoords = posLightSpace.xyz / posLightSpace.w;
+    vec2 uv = projCoords.xy * 0.5 + 0.5;
+    if (projCoords.z > 1.0 || any(lessThan(uv, vec2(0.0))) || any(greaterThanEqual(uv, vec2(1.0)))) {
+        return -1.0;
+    }
+
+    // Cells wrap around the table, a page keeps its cell while the window moves.
+    int tableSize = cascades.vsmPages.x;
+    vec2 pageCoord = uv * float(tableSize);
+    ivec2 page = cascades.vsmPages.yz + ivec2(floor(pageCoord));
+    uint cell = uint((page.y & (tableSize - 1)) * tableSize + (page.x & (tableSize - 1)));
+
+    // Most fragments find their bit already set, the read keeps them off the atomic.
+    uint bit = 1u << (cell & 31u);
+    if ((vsmRequests[cell >> 5u] & bit) == 0u) {
+        atomicOr(vsmRequests[cell >> 5u], bit);
+    }
+
+    uint physical = vsmPageTable[cell];
+    if (physical == 0u) {
+        return -1.0;
+    }
+    physical -= 1u;
+    float poolPages = float(cascades.vsmPages.w);
+    vec2 origin = vec2(float(physical % uint(cascades.vsmPages.w)), float(physical / uint(cascades.vsmPages.w))) / poolPages;
+    vec2 p = origin + fract(pageCoord) / poolPages;
+
+    // Neighbouring pool pages hold unrelated parts of the map, keep the filter taps inside this page.
+    vec2 texelSize = 1.0 / vec2(textureSize(vsmPool, 0).xy);
+    vec2 lo = origin + texelSize * 0.5;
+    vec2 hi = origin + 1.0 / poolPages - texelSize * 0.5;
+    float depth = projCoords.z - cascades.vsmParams.x * (1.0 + 3.0 * (1.0 - ndotl));
+
+    if (SHADOW_FILTER == 0) {
+        return texture(vsmPool, vec4(clamp(p, lo, hi), 0.0, depth));
+    }
+    float lit = 0.0;
+    for (int x = -1; x <= 1; ++x) {
+        for (int y = -1; y <= 1; ++y) {
+            lit += texture(vsmPool, vec4(clamp(p + vec2(x, y) * texelSize, lo, hi), 0.0, depth));
+        }
+    }
+    return lit / 9.0;
+}
+
+float computeShadow(vec3 worldPos, float viewDepth, vec3 N, vec3 lightDir) {
+    int cascade = selectCascade(viewDepth);
+    if (cascade < 0) {
+        return 0.0;
+    }
     // Receiver bias: reduce self-shadowing on curved surfaces (sphere) while keeping contact shadows.
     float ndotl = clamp(dot(N, lightDir), 0.0, 1.0);
     float bias = max(0.0015, 0.01 * (1.0 - ndotl));
-    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0));
+
+    if (cascades.vsmPages.x != 0) {
+        float lit = sampleVirtual(worldPos, ndotl);
+        if (lit >= 0.0) {
+            return 1.0 - lit;
+        }
+    }
+
+    float shadow = sampleCascade(cascade, worldPos, bias);
+
+    // Fade into the next cascade over the end of this one so the resolution change has no seam.
+    if (cascade + 1 < int(cascades.params.x)) {
+        float start = cascade == 0 ? 0.0 : cascades.splits[cascade - 1];
+        float band = (cascades.splits[cascade] - start) * cascades.params.y;
+        float t = (viewDepth - (cascades.splits[cascade] - band)) / max(band, 0.0001);
+        if (t > 0.0) {
+            shadow = mix(shadow, sampleCascade(cascade + 1, worldPos, bias), t);
+        }
+    }
+    return shadow;
+}
+
+float sampleAtlas(int entry, vec3 worldPos) {
+    vec4 posLightSpace = atlasEntries[entry].viewProj * vec4(worldPos, 1.0);
+    if (posLightSpace.w <= 0.0) {
+        return 0.0;
+    }
+    vec3 projCoords = posLightSpace.xyz / posLightSpace.w;
+    if (projCoords.z > 1.0 || any(greaterThan(abs(projCoords.xy), vec2(1.0)))) {
+        return 0.0;
+    }
+    vec4 rect = atlasEntries[entry].rect;
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowAtlas, 0).xy);
+    vec2 uv = rect.xy + (projCoords.xy * 0.5 + 0.5) * rect.zw;
+    // Neighbouring texels belong to other lights, keep the filter taps inside this tile.
+    vec2 lo = rect.xy + texelSize * 0.5;
+    vec2 hi = rect.xy + rect.zw - texelSize * 0.5;
+    int radius = lightCounts.counts.w;
     float shadow = 0.0;
-    for (int x = -1; x <= 1; ++x) {
-        for (int y = -1; y <= 1; ++y) {
-            vec2 offset = vec2(x, y) * texelSize;
-            shadow += texture(shadowMap, vec3(projCoords.xy + offset, projCoords.z - bias));
+    for (int x = -radius; x <= radius; ++x) {
+        for (int y = -radius; y <= radius; ++y) {
+            vec2 tap = clamp(uv + vec2(x, y) * texelSize, lo, hi);
+            shadow += texture(shadowAtlas, vec4(tap, 0.0, projCoords.z - 0.0002));
         }
     }
-    shadow /= 9.0;
+    float taps = float(2 * radius + 1);
+    shadow /= taps * taps;
     return 1.0 - shadow;
 }
 
+// Cube face whose tile covers the direction from the light, same order as the atlas entries.
+int pointShadowFace(vec3 v) {
+    vec3 a = abs(v);
+    if (a.x >= a.y && a.x >= a.z) {
+        return v.x > 0.0 ? 0 : 1;
+    }
+    if (a.y >= a.z) {
+        return v.y > 0.0 ? 2 : 3;
+    }
+    return v.z > 0.0 ? 4 : 5;
+}
+
 vec3 blinnPhong(vec3 N, vec3 V, vec3 L, float intensity, vec3 lightColor) {
     float diff = max(dot(N, L), 0.0);
     vec3 H = normalize(L + V);
@@ -96,7 +388,8 @@ void main() {
 
     // Directional light
     vec3 Ld = normalize(-dirLight.directionIntensity.xyz);
-    float shadow = (lightCounts.counts.z != 0) ? computeShadow(fragPosLightSpace, N, Ld) : 0.0;
+    float viewDepth = -(ubo.view * vec4(fragPos, 1.0)).z;
+    float shadow = (lightCounts.counts.z != 0) ? computeShadow(fragPos, viewDepth, N, Ld) : 0.0;
     color += (1.0 - shadow) * blinnPhong(N, V, Ld, dirLight.directionIntensity.w, dirLight.color.rgb);
 
     // Point lights
@@ -111,6 +404,12 @@ void main() {
             float rangeAtten = clamp(1.0 - dist / pointLights[i].colorRange.w, 0.0, 1.0);
             attenuation *= rangeAtten;
         }
+        if (pointLights[i].shadow.x >= 0) {
+            // Normal offset instead of a depth bias, perspective depth is too uneven for a constant one.
+            vec3 offsetPos = fragPos + N * 0.01 * dist;
+            int face = pointShadowFace(offsetPos - pointLights[i].positionIntensity.xyz);
+            attenuation *= 1.0 - sampleAtlas(pointLights[i].shadow.x + face, offsetPos);
+        }
         color += blinnPhong(N, V, L, attenuation, pointLights[i].colorRange.rgb);
     }
 
@@ -130,10 +429,21 @@ void main() {
 
         float attenuation = spotLights[i].positionIntensity.w / dist2;
         attenuation *= angleAtten;
+        if (spotLights[i].shadow.x >= 0) {
+            attenuation *= 1.0 - sampleAtlas(spotLights[i].shadow.x, fragPos + N * 0.01 * dist);
+        }
 
         color += blinnPhong(N, V, L, attenuation, spotLights[i].colorOuterCos.rgb);
     }
 
+    if (cascades.params.z != 0.0) {
+        const vec3 tints[4] = vec3[](vec3(1.0, 0.6, 0.6), vec3(0.6, 1.0, 0.6), vec3(0.6, 0.6, 1.0), vec3(1.0, 1.0, 0.6));
+        int cascade = selectCascade(viewDepth);
+        if (cascade >= 0) {
+            color *= tints[cascade];
+        }
+    }
+
     outColor = vec4(color, 1.0);
 }
 
@@ -1,4 +1,5 @@
 #version 450
+#extension GL_EXT_multiview : require
 
 layout(location = 0) in vec3 inPosition;
 
@@ -7,12 +8,24 @@ layout(binding = 0) uniform UniformBufferObject {
     mat4 view;
     mat4 projection;
     mat4 normalMatrix;
-    mat4 lightSpaceMatrix;
     vec4 cameraPos;
     vec4 ambientColor;
+    uvec4 shadowMask; // x: cascades this object lands in
 } ubo;
 
+layout(binding = 8) uniform ShadowCascades {
+    mat4 viewProj[4];
+    vec4 splits;
+    vec4 params;
+} cascades;
+
+// One multiview view per cascade, each lands in its own layer of the shadow map.
+// Cascades the CPU culled the object from get it outside the clip volume, so nothing is rasterized.
 void main() {
-    gl_Position = ubo.lightSpaceMatrix * ubo.model * vec4(inPosition, 1.0);
+    if ((ubo.shadowMask.x & (1u << gl_ViewIndex)) == 0u) {
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        return;
+    }
+    gl_Position = cascades.viewProj[gl_ViewIndex] * ubo.model * vec4(inPosition, 1.0);
 }
 
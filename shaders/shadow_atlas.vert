@@ -0,0 +1,37 @@
+#version 450
+#extension GL_ARB_shader_viewport_layer_array : require
+
+layout(location = 0) in vec3 inPosition;
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 projection;
+    mat4 normalMatrix;
+    vec4 cameraPos;
+    vec4 ambientColor;
+} ubo;
+
+struct ShadowAtlasEntry {
+    mat4 viewProj;
+    vec4 rect; // xy: tile origin, zw: tile size, in atlas UV
+};
+
+layout(std430, binding = 10) readonly buffer ShadowAtlasBuffer {
+    ShadowAtlasEntry atlasEntries[];
+};
+
+layout(push_constant) uniform AtlasDraw {
+    uint firstEntry;
+    uint faceMask; // faces the caster lands in
+} draw;
+
+// One instance per tile of the light: a spot light has one, a point light one per cube face.
+void main() {
+    gl_ViewportIndex = gl_InstanceIndex;
+    if ((draw.faceMask & (1u << gl_InstanceIndex)) == 0u) {
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        return;
+    }
+    gl_Position = atlasEntries[draw.firstEntry + gl_InstanceIndex].viewProj * ubo.model * vec4(inPosition, 1.0);
+}
@@ -0,0 +1,38 @@
+#version 450
+
+layout(location = 0) in vec2 inUV;
+
+layout(location = 0) out vec4 outColor;
+
+layout(binding = 0) uniform sampler2D sceneColor;
+
+layout(push_constant) uniform PushConstants {
+    vec2 uvScale;    // rendered part of the scene target
+    vec2 texel;      // one texel of the scene target
+    float sharpness; // 0..1
+} pc;
+
+vec3 fetch(vec2 uv) {
+    // Stay half a texel inside the rendered area so bilinear filtering never
+    // picks up stale pixels from outside it
+    uv = clamp(uv, pc.texel * 0.5, pc.uvScale - pc.texel * 0.5);
+    return texture(sceneColor, uv).rgb;
+}
+
+void main() {
+    vec2 uv = inUV * pc.uvScale;
+
+    vec3 center = fetch(uv);
+    vec3 north = fetch(uv - vec2(0.0, pc.texel.y));
+    vec3 south = fetch(uv + vec2(0.0, pc.texel.y));
+    vec3 west = fetch(uv - vec2(pc.texel.x, 0.0));
+    vec3 east = fetch(uv + vec2(pc.texel.x, 0.0));
+
+    // Unsharp mask on the cross neighbourhood, clamped to its range so edges
+    // get crisper without halos
+    vec3 minColor = min(center, min(min(north, south), min(west, east)));
+    vec3 maxColor = max(center, max(max(north, south), max(west, east)));
+    vec3 sharpened = center + (4.0 * center - north - south - west - east) * (0.25 * pc.sharpness);
+
+    outColor = vec4(clamp(sharpened, minColor, maxColor), 1.0);
+}
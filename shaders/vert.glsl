@@ -9,14 +9,12 @@ layout(location = 0) out vec3 fragPos;
 layout(location = 1) out vec3 fragNormal;
 layout(location = 2) out vec3 fragColor;
 layout(location = 3) out vec2 fragUV;
-layout(location = 4) out vec4 fragPosLightSpace;
 
 layout(binding = 0) uniform UniformBufferObject {
     mat4 model;
     mat4 view;
     mat4 projection;
     mat4 normalMatrix;
-    mat4 lightSpaceMatrix;
     vec4 cameraPos;
     vec4 ambientColor;
 } ubo;
@@ -27,7 +25,6 @@ void main() {
     fragNormal = normalize((ubo.normalMatrix * vec4(inNormal, 0.0)).xyz);
     fragColor = inColor;
     fragUV = inTexCoord;
-    fragPosLightSpace = ubo.lightSpaceMatrix * worldPos;
     gl_Position = ubo.projection * ubo.view * worldPos;
 }
 
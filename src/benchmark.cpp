@@ -0,0 +1,226 @@
+#include "benchmark.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+struct Stats {
+    double mean = 0.0;
+    double p50 = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+};
+
+Stats computeStats(std::vector<double> values) {
+    Stats stats;
+    if (values.empty()) {
+        return stats;
+    }
+
+    std::sort(values.begin(), values.end());
+
+    double sum = 0.0;
+    for (double v : values) {
+        sum += v;
+    }
+
+    // Перцентиль по ближайшему рангу
+    auto percentile = [&values](double p) {
+        size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * values.size()));
+        return values[std::clamp<size_t>(rank, 1, values.size()) - 1];
+    };
+
+    stats.mean = sum / values.size();
+    stats.p50 = percentile(50.0);
+    stats.p95 = percentile(95.0);
+    stats.p99 = percentile(99.0);
+    stats.max = values.back();
+    return stats;
+}
+
+// Строка JSON в кавычках: в пути к сценарию бывают \ (Windows) и "
+void writeString(std::ofstream& out, const std::string& value) {
+    static const char hex[] = "0123456789abcdef";
+    out << '"';
+    for (char c : value) {
+        unsigned char u = static_cast<unsigned char>(c);
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (c == '\n') {
+            out << "\\n";
+        } else if (c == '\t') {
+            out << "\\t";
+        } else if (u < 0x20) {
+            out << "\\u00" << hex[u >> 4] << hex[u & 0xF];
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+void writeStats(std::ofstream& out, const char* name, const std::vector<double>& values, bool last) {
+    Stats s = computeStats(values);
+    out << "  ";
+    writeString(out, name);
+    out << ": {"
+        << "\"samples\": " << values.size()
+        << ", \"mean\": " << s.mean
+        << ", \"p50\": " << s.p50
+        << ", \"p95\": " << s.p95
+        << ", \"p99\": " << s.p99
+        << ", \"max\": " << s.max
+        << "}" << (last ? "" : ",") << "\n";
+}
+
+} // namespace
+
+void Benchmark::load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed to open benchmark script: " + path);
+    }
+
+    scriptPath_ = path;
+    cameraKeys_.clear();
+    settingKeys_.clear();
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        ++lineNumber;
+
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+
+        std::istringstream in(line);
+        std::string command;
+        if (!(in >> command)) {
+            continue;
+        }
+
+        bool ok = false;
+        if (command == "timestep") {
+            ok = static_cast<bool>(in >> timeStep_) && timeStep_ > 0.0;
+        } else if (command == "warmup") {
+            ok = static_cast<bool>(in >> warmupFrames_);
+        } else if (command == "duration") {
+            ok = static_cast<bool>(in >> duration_) && duration_ > 0.0;
+        } else if (command == "camera") {
+            CameraKey key{};
+            ok = static_cast<bool>(in >> key.time >> key.position.x >> key.position.y >> key.position.z
+                                      >> key.yaw >> key.pitch);
+            if (ok) cameraKeys_.push_back(key);
+        } else if (command == "set") {
+            SettingKey key{};
+            ok = static_cast<bool>(in >> key.time >> key.name >> key.value);
+            if (ok) settingKeys_.push_back(key);
+        }
+
+        if (!ok) {
+            throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": invalid line: " + line);
+        }
+    }
+
+    auto byTime = [](const auto& a, const auto& b) { return a.time < b.time; };
+    std::stable_sort(cameraKeys_.begin(), cameraKeys_.end(), byTime);
+    std::stable_sort(settingKeys_.begin(), settingKeys_.end(), byTime);
+}
+
+uint32_t Benchmark::totalFrames() const {
+    return warmupFrames_ + static_cast<uint32_t>(std::ceil(duration_ / timeStep_));
+}
+
+double Benchmark::timelineTime(uint64_t frame) const {
+    if (frame < warmupFrames_) {
+        return 0.0;
+    }
+    return static_cast<double>(frame - warmupFrames_) * timeStep_;
+}
+
+bool Benchmark::sampleCamera(double time, glm::vec3& position, float& yaw, float& pitch) const {
+    if (cameraKeys_.empty()) {
+        return false;
+    }
+
+    auto next = std::upper_bound(cameraKeys_.begin(), cameraKeys_.end(), time,
+                                 [](double t, const CameraKey& key) { return t < key.time; });
+
+    if (next == cameraKeys_.begin() || next == cameraKeys_.end()) {
+        const CameraKey& key = next == cameraKeys_.begin() ? cameraKeys_.front() : cameraKeys_.back();
+        position = key.position;
+        yaw = key.yaw;
+        pitch = key.pitch;
+        return true;
+    }
+
+    const CameraKey& a = *(next - 1);
+    const CameraKey& b = *next;
+    float t = static_cast<float>((time - a.time) / (b.time - a.time));
+
+    position = glm::mix(a.position, b.position, t);
+    yaw = glm::mix(a.yaw, b.yaw, t);
+    pitch = glm::mix(a.pitch, b.pitch, t);
+    return true;
+}
+
+std::vector<std::pair<std::string, float>> Benchmark::settingsAt(double time) const {
+    std::vector<std::pair<std::string, float>> result;
+
+    for (const SettingKey& key : settingKeys_) {
+        if (key.time > time) {
+            break;
+        }
+
+        auto it = std::find_if(result.begin(), result.end(),
+                               [&key](const auto& s) { return s.first == key.name; });
+        if (it != result.end()) {
+            it->second = key.value;
+        } else {
+            result.emplace_back(key.name, key.value);
+        }
+    }
+
+    return result;
+}
+
+void Benchmark::recordFrameTime(uint64_t frame, double frameMs) {
+    if (frame < warmupFrames_ || frame >= totalFrames()) {
+        return;
+    }
+    frameMs_.push_back(frameMs);
+}
+
+void Benchmark::recordProfile(uint64_t frame, double cpuMs, double gpuMs) {
+    if (frame < warmupFrames_ || frame >= totalFrames()) {
+        return;
+    }
+    cpuMs_.push_back(cpuMs);
+    // 0 означает, что GPU-таймеры недоступны
+    if (gpuMs > 0.0) gpuMs_.push_back(gpuMs);
+}
+
+void Benchmark::writeReport(const std::string& path) const {
+    std::ofstream out(path);
+    if (!out.is_open()) {
+        throw std::runtime_error("Failed to write benchmark report: " + path);
+    }
+
+    out << "{\n"
+        << "  \"script\": ";
+    writeString(out, scriptPath_);
+    out << ",\n"
+        << "  \"timestep\": " << timeStep_ << ",\n"
+        << "  \"warmup_frames\": " << warmupFrames_ << ",\n"
+        << "  \"measured_frames\": " << (totalFrames() - warmupFrames_) << ",\n";
+    writeStats(out, "frame_ms", frameMs_, false);
+    writeStats(out, "cpu_ms", cpuMs_, false);
+    writeStats(out, "gpu_ms", gpuMs_, true);
+    out << "}\n";
+}
@@ -32,6 +32,11 @@ void Camera::rotate(float deltaYaw, float deltaPitch) {
     position_ = -forward * distance_;
 }
 
+void Camera::setPosition(const glm::vec3& position) {
+    position_ = position;
+    distance_ = std::clamp(glm::length(position_), MIN_DISTANCE, MAX_DISTANCE);
+}
+
 void Camera::move(const glm::vec3& delta) {
     position_ += delta;
     // Обновляем distance_, чтобы совместить свободное перемещение и орбиту/слайдер
@@ -3,13 +3,23 @@
 #include "camera.h"
 #include "math_utils.h"
 #include "vertex.h"
+#include "benchmark.h"
+#include "quality_governor.h"
+#include "shadow_atlas.h"
+#include "virtual_shadow_map.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <algorithm>
 #include <vector>
 #include <array>
+#include <atomic>
+#include <bit>
 #include <chrono>
 #include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -61,9 +71,9 @@ struct UniformBufferObject {
     alignas(16) glm::mat4 view;
     alignas(16) glm::mat4 projection;
     alignas(16) glm::mat4 normalMatrix;
-    alignas(16) glm::mat4 lightSpaceMatrix;
     alignas(16) glm::vec4 cameraPos;       
     alignas(16) glm::vec4 ambientColor;    
+    alignas(16) glm::uvec4 shadowMask{0u}; // x: cascades the object casts into, read by shadow.vert
 };
 
 struct MaterialData {
@@ -79,22 +89,191 @@ struct DirectionalLightData {
 struct PointLightData {
     alignas(16) glm::vec4 positionIntensity;   
     alignas(16) glm::vec4 colorRange;          
+    alignas(16) glm::ivec4 shadow{-1, 0, 0, 0}; // x: first of six atlas entries (+X, -X, +Y, -Y, +Z, -Z), -1 without shadow
 };
 
 struct SpotLightData {
     alignas(16) glm::vec4 positionIntensity;   
     alignas(16) glm::vec4 directionInnerCos;   
     alignas(16) glm::vec4 colorOuterCos;       
+    alignas(16) glm::ivec4 shadow{-1, 0, 0, 0}; // x: atlas entry, -1 without shadow
 };
 
 struct LightCounts {
     alignas(16) glm::ivec4 counts;             
 };
 
+constexpr uint32_t kMaxCascades = 4;
+constexpr uint32_t kMinCascades = 2;
+
+// Directional light cascades, shared by the shadow pass (one multiview view per cascade) and shading.
+struct ShadowCascadeData {
+    alignas(16) glm::mat4 viewProj[kMaxCascades];
+    alignas(16) glm::vec4 splits; // view-space distance where each cascade ends
+    alignas(16) glm::vec4 params; // x: cascade count, y: blend band as a fraction of a cascade, z: tint cascades
+    // Virtual shadow map, sampled before the cascades when enabled.
+    alignas(16) glm::mat4 vsmViewProj; // xy -1..1 across the page window
+    alignas(16) glm::ivec4 vsmPages{0}; // x: page table size (0: off), yz: window origin in pages, w: pool pages per side
+    alignas(16) glm::vec4 vsmParams; // x: depth bias of one texel
+};
+
+// What the static casters' shadow depth depends on; an equal key means cached depth is still right.
+struct ShadowCacheKey {
+    uint32_t cascades = 0;
+    glm::mat4 viewProj[kMaxCascades]{};
+    bool planeCastsShadow = false;
+    glm::mat4 planeModel{0.0f};
+    uint32_t planeCascadeMask = 0;
+
+    bool operator==(const ShadowCacheKey&) const = default;
+};
+
+// What the virtual shadow map's pages depend on besides the sphere; any change drops every page.
+struct VirtualShadowKey {
+    glm::mat4 lightView{0.0f};
+    float pageWorld = 0.0f; // side of a page in world units
+    float depthNear = 0.0f; // depth range along the light, the same for every page
+    float depthFar = 0.0f;
+    bool planeCastsShadow = false;
+    glm::mat4 planeModel{0.0f};
+
+    bool operator==(const VirtualShadowKey&) const = default;
+};
+
+struct BoundingSphere {
+    glm::vec3 center{0.0f};
+    float radius = 0.0f;
+};
+
+// Clip volume of a view-projection (Vulkan depth 0..1) as six planes with inward normals.
+struct Frustum {
+    glm::vec4 planes[6];
+};
+
+enum class ShadowCasters {
+    all,
+    staticOnly,  // the plane
+    dynamicOnly, // the sphere, which rotates and pulses
+};
+
 constexpr uint32_t kMaxPointLights = 8;
 constexpr uint32_t kMaxSpotLights = 4;
+
+// Spot and point light shadows share one depth atlas. Entries are laid out by light slot:
+// spot light i uses entry i, point light j the six entries from kMaxSpotLights + 6 * j.
+constexpr uint32_t kShadowAtlasSize = 4096;
+constexpr uint32_t kMinAtlasTile = 128;
+constexpr uint32_t kMaxSpotShadowTile = 1024;
+constexpr uint32_t kMaxPointShadowTile = 512; // per cube face
+constexpr uint32_t kMaxAtlasEntries = kMaxSpotLights + 6 * kMaxPointLights;
+constexpr float kLocalShadowNear = 0.05f;
+constexpr float kLocalShadowFar = 20.0f; // also how far lights without a range reach
+// Lights at least this bright get the full tile their screen coverage asks for.
+constexpr float kLocalShadowReferenceIntensity = 15.0f;
+
+// Directional light virtual shadow map: kVsmTableSize² pages of kVsmPageSize² texels (16384² in all)
+// over a square of twice the shadow distance around the camera. Only pages visible fragments asked
+// for are rendered, into a pool of physical pages; the cascades cover those not rendered yet.
+constexpr uint32_t kVsmPageSize = 128;
+constexpr uint32_t kVsmTableSize = 128;
+constexpr uint32_t kVsmPoolSize = 4096;
+constexpr uint32_t kVsmPoolPages = kVsmPoolSize / kVsmPageSize; // per side
+constexpr uint32_t kVsmRequestWords = kVsmTableSize * kVsmTableSize / 32;
+// Page renders per frame, the remaining requests wait for the next frames.
+constexpr uint32_t kVsmMaxPageRenders = 48;
+// Pages are drawn with the atlas pipeline, their matrices follow the atlas entries in the same buffer.
+constexpr uint32_t kVsmFirstEntry = kMaxAtlasEntries;
+constexpr uint32_t kAtlasBufferEntries = kMaxAtlasEntries + kVsmMaxPageRenders;
+
+struct ShadowAtlasEntry {
+    alignas(16) glm::mat4 viewProj;
+    alignas(16) glm::vec4 rect; // xy: tile origin, zw: tile size, in atlas UV
+};
+
+// One instanced draw per shadowed light: instance i is routed to viewport i, the tile of entry firstEntry + i.
+struct AtlasDraw {
+    uint32_t firstEntry = 0;
+    uint32_t faces = 0; // 1 for a spot light, 6 for a point light
+    uint32_t casterFaces[2]{}; // sphere, plane: bit per face the caster lands in, 0 skips the draw
+    VkViewport viewports[6]{};
+    VkRect2D scissors[6]{};
+};
 constexpr const char* kDefaultTexturePath = "textures/owl.ppm";
-constexpr uint32_t kShadowMapSize = 2048;
+constexpr float kCameraNear = 0.1f;
+constexpr float kCameraFar = 100.0f;
+// Side of one cascade's layer, a power of two chosen at runtime ("Shadow map size").
+constexpr uint32_t kMinShadowMapSize = 512;
+constexpr uint32_t kMaxShadowMapSize = 8192;
+constexpr uint32_t kDefaultShadowMapSize = 2048;
+constexpr const char* kShadowFormatNames[] = {"D16_UNORM", "D32_SFLOAT"};
+constexpr VkFormat kShadowFormats[] = {VK_FORMAT_D16_UNORM, VK_FORMAT_D32_SFLOAT};
+constexpr uint32_t kShadowFormatBytes[] = {2, 4};
+constexpr int kShadowFormatCount = 2;
+
+// A shadow map size and format in one word, so update() and render() can swap them atomically.
+// The size keeps the low bits, the format index sits above it; 0 is no setting.
+constexpr uint32_t kShadowFormatShift = 24;
+static_assert(kMaxShadowMapSize < (1u << kShadowFormatShift) && kShadowFormatCount <= (1 << (32 - kShadowFormatShift)));
+
+constexpr uint32_t packShadowMapSetting(uint32_t size, int format) {
+    return size | static_cast<uint32_t>(format) << kShadowFormatShift;
+}
+
+constexpr uint32_t shadowMapSettingSize(uint32_t setting) {
+    return setting & ((1u << kShadowFormatShift) - 1);
+}
+
+constexpr int shadowMapSettingFormat(uint32_t setting) {
+    return static_cast<int>(setting >> kShadowFormatShift);
+}
+constexpr VkFormat kAtlasDepthFormat = VK_FORMAT_D32_SFLOAT;
+// Extends each cascade's depth range towards the light so casters outside the slice still land in it.
+constexpr float kShadowCasterMargin = 30.0f;
+constexpr uint32_t kMaxStressObjects = 4096;
+constexpr int kMinSphereSegments = 4;
+constexpr int kMaxSphereSegments = 128;
+
+// How the directional shadow map is filtered. Each mode is its own main pipeline, selected by the
+// SHADOW_FILTER specialization constant of frag.glsl, so the others cost nothing.
+enum class ShadowFilter : int {
+    hard,   // one bilinear comparison
+    gather, // 3x3 PCF footprint from four textureGather calls
+    pcf,    // 3x3 PCF, nine comparisons
+    pcss,   // blocker search + rotated Poisson PCF, penumbra widens with caster distance
+    evsm,   // exponential variance shadow map, needs the evsm.comp blur
+    count,
+};
+constexpr int kShadowFilterCount = static_cast<int>(ShadowFilter::count);
+constexpr const char* kShadowFilterNames[] = {"hard", "gather", "pcf", "pcss", "evsm"};
+// Main pass label per filter: the profiler keeps one row per name, so each mode's cost stays visible.
+constexpr const char* kMainPassNames[] = {"main (hard)", "main (gather)", "main (pcf)", "main (pcss)", "main (evsm)"};
+// EVSM moments are stored at half the shadow map resolution, 2x2 depth texels per moments texel;
+// the blur radius is in moments texels.
+constexpr int32_t kEvsmBlurRadius = 2;
+
+// Presets the quality governor moves between, cheapest first. Only settings that can change
+// between frames without a stall: the sphere goes through veekay::deletion, the rest are
+// per-frame data. The shadow map size is not part of a tier, changing it reallocates the maps.
+struct QualityTier {
+    const char* name;
+    bool shadows;
+    ShadowFilter shadowFilter;
+    bool localShadows; // spot and point lights through the atlas
+    int cascades;
+    int sphereSegments;
+    int maxPointLights; // caps, lights added in the UI above them stay off
+    int maxSpotLights;
+};
+
+constexpr QualityTier kQualityTiers[] = {
+    {"low", false, ShadowFilter::hard, false, 2, 8, 1, 0},
+    {"medium", true, ShadowFilter::gather, false, 2, 10, 4, 2},
+    {"high", true, ShadowFilter::pcf, true, 3, 24, 8, 4},
+    {"ultra", true, ShadowFilter::pcss, true, 4, 64, 8, 4},
+};
+constexpr int kDefaultQualityTier = 2;
+// Same order as veekay::PresentMode.
+constexpr const char* kPresentModeNames[] = {"fifo", "fifo_relaxed", "mailbox", "immediate"};
 
 struct TextureData {
     uint32_t width = 0;
@@ -184,55 +363,196 @@ static void makePlaneMesh(float halfSize, float y, float uvScale,
     outIndices = {0, 2, 1, 2, 3, 1};
 }
 
+// Everything the recorded draw stream depends on besides buffer contents and the render extent.
+struct DrawStreamKey {
+    bool wireframe = false;
+    bool planeCastsShadow = false;
+    uint32_t stressObjects = 0;
+    uint32_t cascades = 0; // shadow pipeline and view mask
+    bool shadowCaching = false; // the shadow secondary holds only dynamic casters
+    ShadowFilter shadowFilter = ShadowFilter::pcf; // main pipeline
+    uint32_t shadowMapSize = 0; // shadow viewport and depth format of the shadow secondary
+    int shadowFormat = 0;
+
+    bool operator==(const DrawStreamKey&) const = default;
+};
+
+// Host-visible data rewritten by update() every frame; one copy per frame in flight
+// so the CPU never overwrites buffers the GPU is still reading.
+struct FrameResources {
+    veekay::graphics::Buffer* uniformBuffer = nullptr;
+    veekay::graphics::Buffer* planeUniformBuffer = nullptr;
+    veekay::graphics::Buffer* materialBuffer = nullptr;
+    veekay::graphics::Buffer* directionalLightBuffer = nullptr;
+    veekay::graphics::Buffer* pointLightBuffer = nullptr;
+    veekay::graphics::Buffer* spotLightBuffer = nullptr;
+    veekay::graphics::Buffer* lightCountBuffer = nullptr;
+    veekay::graphics::Buffer* cascadeBuffer = nullptr;
+    veekay::graphics::Buffer* atlasBuffer = nullptr; // ShadowAtlasEntry per atlas entry, then per page render
+    // Virtual shadow map page table and the page requests this slot's main pass writes.
+    veekay::graphics::Buffer* vsmPageTableBuffer = nullptr;
+    veekay::graphics::Buffer* vsmRequestBuffer = nullptr;
+    // One UniformBufferObject per stress object, uboStride apart (dynamic offset).
+    veekay::graphics::Buffer* stressUniformBuffer = nullptr;
+    VkDescriptorSet descriptorSetSphere = VK_NULL_HANDLE;
+    VkDescriptorSet descriptorSetPlane = VK_NULL_HANDLE;
+    VkDescriptorSet descriptorSetStress = VK_NULL_HANDLE;
+    VkDescriptorSet evsmDescriptorSet = VK_NULL_HANDLE;
+    // Shadow map views in the sets above are those of this generation (see createShadowMaps()).
+    uint32_t shadowMapGeneration = 0;
+    // Settings render() needs, captured by update(). With --pipelined update() of the
+    // next frame changes app_state while render() of this one still runs.
+    bool wireframe = false;
+    bool shadows = false;
+    uint32_t cascades = 0;
+    bool shadowCaching = false;
+    ShadowFilter shadowFilter = ShadowFilter::pcf;
+    uint32_t shadowMapSize = kDefaultShadowMapSize;
+    int shadowFormat = 1;
+    ShadowCacheKey shadowKey;
+    uint32_t sphereCascadeMask = 0; // the plane's is in shadowKey
+    glm::mat4 sphereModel{0.0f};
+    bool virtualShadows = false;
+    VirtualShadowKey vsmKey;
+    VirtualShadowMap::Page vsmOrigin;
+    // Owned by render(): window of the frame whose requests are in vsmRequestBuffer, if any.
+    bool vsmFeedback = false;
+    VirtualShadowMap::Page vsmFeedbackOrigin;
+    std::array<AtlasDraw, kMaxPointLights + kMaxSpotLights> atlasDraws{};
+    uint32_t atlasDrawCount = 0;
+    bool planeCastsShadow = false;
+    uint32_t stressObjects = 0;
+    int sphereSegments = 0;
+    bool staticCommands = false;
+    uint64_t sceneVersion = 0;
+    // Shadow and scene draws recorded once into secondaries and replayed every frame
+    // until sceneVersion or the render extent changes (see recordStaticCommands()).
+    VkCommandPool staticCommandPool = VK_NULL_HANDLE;
+    VkCommandBuffer staticShadowCommands = VK_NULL_HANDLE;
+    VkCommandBuffer staticSceneCommands = VK_NULL_HANDLE;
+    uint64_t staticVersion = 0; // 0 until first recorded
+    uint64_t staticGeometryVersion = 0;
+    VkExtent2D staticExtent{};
+};
+
+// After init() GPU-side state (shadow maps and their caches, the atlas layout, the virtual shadow
+// map's page table and pool, the geometry buffer) is only touched from render(), which runs on
+// veekay's recording thread; update() talks to it through FrameResources and atomics.
 static struct {
     std::vector<Vertex> sphereVertices;
     std::vector<uint32_t> sphereIndices;
     std::vector<Vertex> planeVertices;
     std::vector<uint32_t> planeIndices;
-    VkBuffer vertexBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory vertexBufferMemory = VK_NULL_HANDLE;
-    VkBuffer indexBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory indexBufferMemory = VK_NULL_HANDLE;
-    uint32_t planeIndexCount = 0;
-    VkBuffer planeVertexBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory planeVertexBufferMemory = VK_NULL_HANDLE;
-    VkBuffer planeIndexBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory planeIndexBufferMemory = VK_NULL_HANDLE;
-    VkBuffer uniformBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory uniformBufferMemory = VK_NULL_HANDLE;
-    VkBuffer planeUniformBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory planeUniformBufferMemory = VK_NULL_HANDLE;
-    VkBuffer materialBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory materialBufferMemory = VK_NULL_HANDLE;
-    VkBuffer directionalLightBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory directionalLightBufferMemory = VK_NULL_HANDLE;
-    VkBuffer pointLightBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory pointLightBufferMemory = VK_NULL_HANDLE;
-    VkBuffer spotLightBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory spotLightBufferMemory = VK_NULL_HANDLE;
-    VkBuffer lightCountBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory lightCountBufferMemory = VK_NULL_HANDLE;
+    // Model-space bounds, the segment count does not change the sphere's.
+    BoundingSphere sphereBounds;
+    BoundingSphere planeBounds;
+    // All static meshes live in one vertex/index buffer pair, addressed by mesh handle.
+    veekay::graphics::GeometryBuffer* geometry = nullptr;
+    uint32_t sphereMesh = 0;
+    uint32_t planeMesh = 0;
+    std::array<FrameResources, veekay::max_frames_in_flight> frames{};
     VkShaderModule vertexShaderModule = VK_NULL_HANDLE;
     VkShaderModule fragmentShaderModule = VK_NULL_HANDLE;
     VkShaderModule shadowVertexShaderModule = VK_NULL_HANDLE;
     VkShaderModule shadowFragmentShaderModule = VK_NULL_HANDLE;
+    VkShaderModule atlasVertexShaderModule = VK_NULL_HANDLE;
     VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
     VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
-    VkPipeline graphicsPipeline = VK_NULL_HANDLE;
-    VkPipeline wireframePipeline = VK_NULL_HANDLE;
-    VkPipeline shadowPipeline = VK_NULL_HANDLE;
+    // One per ShadowFilter.
+    VkPipeline graphicsPipelines[kShadowFilterCount]{};
+    VkPipeline wireframePipelines[kShadowFilterCount]{};
+    // Per depth format and cascade count, both are baked into the pipeline.
+    VkPipeline shadowPipelines[kShadowFormatCount][kMaxCascades - kMinCascades + 1]{};
+    // Writes gl_ViewportIndex, so one draw covers all six faces of a point light.
+    VkPipeline atlasPipeline = VK_NULL_HANDLE;
     VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
-    VkDescriptorSet descriptorSetSphere = VK_NULL_HANDLE;
-    VkDescriptorSet descriptorSetPlane = VK_NULL_HANDLE;
     veekay::graphics::Texture* texture = nullptr;
     VkSampler textureSampler = VK_NULL_HANDLE;
     VkImage shadowImage = VK_NULL_HANDLE;
     VkDeviceMemory shadowImageMemory = VK_NULL_HANDLE;
     VkImageView shadowImageView = VK_NULL_HANDLE;
     VkSampler shadowSampler = VK_NULL_HANDLE;
+    VkSampler shadowDepthSampler = VK_NULL_HANDLE; // no comparison, for the PCSS blocker search and EVSM
+    VkSampler shadowMomentsSampler = VK_NULL_HANDLE;
     bool shadowInitialized = false;
+    // EVSM: moments of every cascade and the horizontally blurred intermediate, both kept in GENERAL.
+    VkImage evsmImage = VK_NULL_HANDLE;
+    VkDeviceMemory evsmImageMemory = VK_NULL_HANDLE;
+    VkImageView evsmImageView = VK_NULL_HANDLE;
+    VkImage evsmTempImage = VK_NULL_HANDLE;
+    VkDeviceMemory evsmTempImageMemory = VK_NULL_HANDLE;
+    VkImageView evsmTempImageView = VK_NULL_HANDLE;
+    VkShaderModule evsmShaderModule = VK_NULL_HANDLE;
+    VkDescriptorSetLayout evsmSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout evsmPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline evsmPipeline = VK_NULL_HANDLE; // null without evsm_comp.spv, EVSM then falls back to PCF
+    VkDescriptorPool evsmDescriptorPool = VK_NULL_HANDLE;
+    // Owned by render(): size and format the shadow maps above were created with.
+    uint32_t shadowMapImageSize = 0;
+    int shadowMapImageFormat = 0;
+    uint32_t shadowMapGeneration = 0;
+    // packShadowMapSetting() of the live maps, and of a request that could not be allocated (0: none).
+    std::atomic<uint32_t> shadowMapLive{0};
+    std::atomic<uint32_t> shadowMapRejected{0};
+    bool evsmValid = false; // owned by render(): moments match the current shadow map
+    // Depth of static casters only, copied into the shadow map before the dynamic ones are drawn.
+    VkImage shadowStaticImage = VK_NULL_HANDLE;
+    VkDeviceMemory shadowStaticImageMemory = VK_NULL_HANDLE;
+    VkImageView shadowStaticImageView = VK_NULL_HANDLE;
+    // Owned by render(): what the static layer and the shadow map were last rendered for.
+    VkImageLayout shadowStaticLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    bool shadowStaticValid = false;
+    ShadowCacheKey shadowStaticKey;
+    bool shadowMapValid = false;
+    ShadowCacheKey shadowMapKey;
+    glm::mat4 shadowMapSphere{0.0f};
+    uint32_t shadowMapSphereMask = 0;
+    uint32_t shadowMapGeometry = 0;
+    // Written by render(), shown by update().
+    std::atomic<uint32_t> shadowStaticRenders{0};
+    std::atomic<uint32_t> shadowSkips{0};
+    VkImage atlasImage = VK_NULL_HANDLE;
+    VkDeviceMemory atlasImageMemory = VK_NULL_HANDLE;
+    VkImageView atlasImageView = VK_NULL_HANDLE;
+    bool atlasInitialized = false; // owned by render()
+    // Owned by update(): tiles stay with their light until the size it asks for changes.
+    ShadowAtlas shadowAtlas{kShadowAtlasSize, kMinAtlasTile};
+    std::array<ShadowAtlas::Tile, kMaxAtlasEntries> atlasTiles{};
+    std::array<uint32_t, kMaxAtlasEntries> atlasRequested{}; // size asked for when the tile was assigned
+    uint32_t atlasShadowedLights = 0;
+    VkImage vsmImage = VK_NULL_HANDLE; // physical page pool
+    VkDeviceMemory vsmImageMemory = VK_NULL_HANDLE;
+    VkImageView vsmImageView = VK_NULL_HANDLE;
+    // Owned by render(): pages stay resident until evicted or invalidated.
+    bool vsmInitialized = false;
+    VirtualShadowMap virtualShadowMap{kVsmTableSize, kVsmPoolPages};
+    bool vsmValid = false; // false while disabled, the pages missed every change meanwhile
+    VirtualShadowKey vsmKey;
+    glm::mat4 vsmSphere{0.0f};
+    uint64_t vsmGeometry = 0;
+    // Written by render(), shown by update().
+    std::atomic<uint32_t> vsmResidentPages{0};
+    std::atomic<uint32_t> vsmPageRenders{0};
     bool planeCastsShadow = false; // avoid plane self-shadowing artifacts
     bool enableShadows = true;
+    int shadowFilter = static_cast<int>(ShadowFilter::pcf);
+    uint32_t shadowMapSize = kDefaultShadowMapSize;
+    int shadowFormat = 1; // index into kShadowFormats
+    uint32_t maxShadowMapSize = kMaxShadowMapSize; // lowered to the device's maxImageDimension2D
+    float pcssLightSize = 0.03f; // tangent of the light's angular radius
+    int cascadeCount = 3;
+    float shadowDistance = 40.0f;
+    float cascadeSplitLambda = 0.75f; // 0: uniform splits, 1: logarithmic
+    float cascadeBlend = 0.1f;
+    bool showCascades = false;
+    bool shadowCaching = true;
+    bool localShadows = true;
+    bool shadowCulling = true;
+    bool virtualShadows = false;
+    uint32_t shadowCasterViews = 0; // caster x cascade or atlas face pairs, last update()
+    uint32_t shadowCasterViewsDrawn = 0;
+    int maxPointLights = static_cast<int>(kMaxPointLights);
+    int maxSpotLights = static_cast<int>(kMaxSpotLights);
     bool enableFillLight = true;
     float fillLightIntensity = 8.0f;
     float fillLightRange = 8.0f;
@@ -244,7 +564,6 @@ static struct {
     float sphereRotationX = 0.0f;
     bool autoRotate = true;
     bool wireframeMode = false;
-    uint32_t indexCount = 0;
     float fov = 60.0f;
     float baseMoveSpeed = 3.0f;
     float mouseSensitivity = 0.15f;
@@ -270,8 +589,523 @@ static struct {
     };
     LightCounts lightCounts{};
     glm::vec4 ambient{0.05f, 0.05f, 0.05f, 0.5f};
+    // Scripted benchmark run (--benchmark); input is ignored while it is active.
+    bool benchmarkEnabled = false;
+    Benchmark benchmark;
+    std::string benchmarkOutput = "benchmark.json";
+    uint64_t lastProfiledFrame = std::numeric_limits<uint64_t>::max();
+    std::chrono::steady_clock::time_point lastUpdateTime{};
+    // Grid of small spheres, each a separate draw, to load command recording.
+    int stressObjects = 0;
+    VkDeviceSize uboStride = sizeof(UniformBufferObject);
+    // Replay pre-recorded secondaries instead of recording the scene every frame.
+    bool staticCommands = false;
+    // Bumped whenever the draw stream changes, pre-recorded secondaries older than it are stale.
+    uint64_t sceneVersion = 1;
+    DrawStreamKey drawStream{};
+    std::atomic<uint32_t> staticRecordings{0}; // written by render(), shown by update()
+    // Sphere tessellation picked in the UI; render() swaps the mesh when it differs from sphereMeshSegments.
+    int sphereSegments = 10;
+    // Owned by render() after init: the mesh it draws and a counter bumped whenever geometry moves.
+    int sphereMeshSegments = 0;
+    uint64_t geometryVersion = 1;
+    // --low-latency: re-aim the camera from input polled right before recording.
+    bool lowLatency = false;
+    bool lateCameraUpdate = true;
+    // --quality-governor: steps through kQualityTiers to keep frames within the budget.
+    bool qualityGovernor = false;
+    QualityGovernor governor{static_cast<int>(std::size(kQualityTiers)), kDefaultQualityTier};
+    uint64_t governorProfiledFrame = std::numeric_limits<uint64_t>::max();
 } app_state;
 
+// Names accepted by "set" in benchmark scripts, see applyBenchmarkSetting().
+constexpr const char* kBenchmarkSettings[] = {
+    "shadows", "plane_shadow", "wireframe", "fill_light", "auto_rotate", "fov", "point_lights", "spot_lights",
+    "stress_objects", "threads", "static_commands", "sphere_segments", "shadow_filter", "cascades",
+    "shadow_cache", "local_shadows", "shadow_culling", "shadow_map_size", "shadow_format",
+    "virtual_shadows"
+};
+
+static void setPointLightCount(int count) {
+    count = std::clamp(count, 0, static_cast<int>(kMaxPointLights));
+    PointLightData def{glm::vec4(0.0f, 1.0f, 0.0f, 15.0f), glm::vec4(1.0f, 1.0f, 1.0f, 5.0f)};
+    app_state.pointLights.resize(count, def);
+}
+
+static void setSpotLightCount(int count) {
+    count = std::clamp(count, 0, static_cast<int>(kMaxSpotLights));
+    SpotLightData def{
+        glm::vec4(0.0f, 2.0f, 2.0f, 20.0f),
+        glm::vec4(0.0f, -1.0f, 0.0f, glm::cos(glm::radians(12.5f))),
+        glm::vec4(1.0f, 1.0f, 1.0f, glm::cos(glm::radians(17.5f)))
+    };
+    app_state.spotLights.resize(count, def);
+}
+
+// A new pick gets its own allocation attempt, even if an earlier one ran out of memory.
+static void selectShadowMap(uint32_t size, int format) {
+    if (size != app_state.shadowMapSize || format != app_state.shadowFormat) {
+        app_state.shadowMapSize = size;
+        app_state.shadowFormat = format;
+        app_state.shadowMapRejected.store(0);
+    }
+}
+
+static void applyBenchmarkSetting(const std::string& name, float value) {
+    bool on = value != 0.0f;
+    if (name == "shadows") app_state.enableShadows = on;
+    else if (name == "plane_shadow") app_state.planeCastsShadow = on;
+    else if (name == "wireframe") app_state.wireframeMode = on;
+    else if (name == "fill_light") app_state.enableFillLight = on;
+    else if (name == "auto_rotate") app_state.autoRotate = on;
+    else if (name == "fov") app_state.fov = std::clamp(value, 30.0f, 90.0f);
+    else if (name == "point_lights") setPointLightCount(static_cast<int>(value));
+    else if (name == "spot_lights") setSpotLightCount(static_cast<int>(value));
+    else if (name == "stress_objects") app_state.stressObjects = std::clamp(static_cast<int>(value), 0, static_cast<int>(kMaxStressObjects));
+    else if (name == "threads") veekay::parallel::setThreadCount(static_cast<uint32_t>(std::max(value, 1.0f)));
+    else if (name == "static_commands") app_state.staticCommands = on;
+    else if (name == "shadow_filter") app_state.shadowFilter = std::clamp(static_cast<int>(value), 0, kShadowFilterCount - 1);
+    else if (name == "shadow_cache") app_state.shadowCaching = on;
+    else if (name == "local_shadows") app_state.localShadows = on;
+    else if (name == "shadow_culling") app_state.shadowCulling = on;
+    else if (name == "shadow_map_size") selectShadowMap(std::bit_floor(std::clamp(static_cast<uint32_t>(std::max(value, 0.0f)), kMinShadowMapSize, app_state.maxShadowMapSize)), app_state.shadowFormat);
+    else if (name == "shadow_format") selectShadowMap(app_state.shadowMapSize, value <= 16.0f ? 0 : 1);
+    else if (name == "virtual_shadows") app_state.virtualShadows = on;
+    else if (name == "cascades") app_state.cascadeCount = std::clamp(static_cast<int>(value), static_cast<int>(kMinCascades), static_cast<int>(kMaxCascades));
+    else if (name == "sphere_segments") app_state.sphereSegments = std::clamp(static_cast<int>(value), kMinSphereSegments, kMaxSphereSegments);
+}
+
+// Drives camera and settings from the script and collects timings for the report.
+static void updateBenchmark(uint64_t frameNumber) {
+    Benchmark& bench = app_state.benchmark;
+
+    auto now = std::chrono::steady_clock::now();
+    if (frameNumber > 0) {
+        // Interval since the previous update() is the duration of the previous frame.
+        bench.recordFrameTime(frameNumber - 1, std::chrono::duration<double, std::milli>(now - app_state.lastUpdateTime).count());
+    }
+    app_state.lastUpdateTime = now;
+
+    // GPU results arrive frames_in_flight frames late, take each resolved frame once.
+    veekay::profiler::FrameTimings timings;
+    if (veekay::profiler::latest(timings) && timings.number != app_state.lastProfiledFrame) {
+        double cpuMs = 0.0;
+        for (double ms : timings.cpu_ms) {
+            cpuMs += ms;
+        }
+        bench.recordProfile(timings.number, cpuMs, timings.gpu_ms);
+        app_state.lastProfiledFrame = timings.number;
+    }
+
+    double t = bench.timelineTime(frameNumber);
+
+    glm::vec3 position;
+    float yaw, pitch;
+    if (bench.sampleCamera(t, position, yaw, pitch)) {
+        app_state.camera.setRotation(yaw, pitch);
+        app_state.camera.setPosition(position);
+    }
+
+    for (const auto& [name, value] : bench.settingsAt(t)) {
+        applyBenchmarkSetting(name, value);
+    }
+
+    // Keep going a few frames past the end so the last GPU timings get resolved.
+    if (bench.isFinished(frameNumber - std::min<uint64_t>(frameNumber, veekay::app.frames_in_flight))) {
+        bench.writeReport(app_state.benchmarkOutput);
+        std::cout << "Benchmark report written to " << app_state.benchmarkOutput << std::endl;
+        veekay::app.running = false;
+    }
+}
+
+static BoundingSphere computeBounds(const std::vector<Vertex>& vertices) {
+    glm::vec3 lo(std::numeric_limits<float>::max());
+    glm::vec3 hi(std::numeric_limits<float>::lowest());
+    for (const Vertex& v : vertices) {
+        lo = glm::min(lo, v.position);
+        hi = glm::max(hi, v.position);
+    }
+
+    BoundingSphere bounds;
+    bounds.center = (lo + hi) * 0.5f;
+    for (const Vertex& v : vertices) {
+        bounds.radius = std::max(bounds.radius, glm::length(v.position - bounds.center));
+    }
+    return bounds;
+}
+
+static BoundingSphere transformBounds(const BoundingSphere& bounds, const glm::mat4& model) {
+    float scale = std::max({glm::length(glm::vec3(model[0])), glm::length(glm::vec3(model[1])),
+                            glm::length(glm::vec3(model[2]))});
+    return BoundingSphere{glm::vec3(model * glm::vec4(bounds.center, 1.0f)), bounds.radius * scale};
+}
+
+// Gribb-Hartmann: each plane is a sum or difference of the matrix rows.
+static Frustum extractFrustum(const glm::mat4& viewProj) {
+    glm::mat4 rows = glm::transpose(viewProj);
+    Frustum frustum;
+    frustum.planes[0] = rows[3] + rows[0];
+    frustum.planes[1] = rows[3] - rows[0];
+    frustum.planes[2] = rows[3] + rows[1];
+    frustum.planes[3] = rows[3] - rows[1];
+    frustum.planes[4] = rows[2]; // near, depth 0..1
+    frustum.planes[5] = rows[3] - rows[2];
+    for (glm::vec4& plane : frustum.planes) {
+        plane /= glm::length(glm::vec3(plane));
+    }
+    return frustum;
+}
+
+static bool intersects(const Frustum& frustum, const BoundingSphere& sphere) {
+    for (const glm::vec4& plane : frustum.planes) {
+        if (glm::dot(glm::vec3(plane), sphere.center) + plane.w < -sphere.radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether the shadow a caster throws along lightTravel can fall inside the frustum: the sphere swept
+// towards infinity misses only if it starts outside a plane and never moves towards it.
+static bool shadowReaches(const Frustum& frustum, const BoundingSphere& caster, const glm::vec3& lightTravel) {
+    for (const glm::vec4& plane : frustum.planes) {
+        glm::vec3 normal(plane);
+        if (glm::dot(normal, caster.center) + plane.w < -caster.radius && glm::dot(normal, lightTravel) <= 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Bit per view the caster lands in. The light volumes already reach past the receivers towards the
+// light (kShadowCasterMargin for cascades, the light itself for spot and point lights), so casters
+// off screen are kept as long as they are inside them.
+static uint32_t casterViewMask(const BoundingSphere& caster, const glm::mat4* viewProj, uint32_t views) {
+    uint32_t mask = 0;
+    for (uint32_t view = 0; view < views; ++view) {
+        if (!app_state.shadowCulling || intersects(extractFrustum(viewProj[view]), caster)) {
+            mask |= 1u << view;
+        }
+    }
+    app_state.shadowCasterViews += views;
+    app_state.shadowCasterViewsDrawn += static_cast<uint32_t>(std::popcount(mask));
+    return mask;
+}
+
+// Splits [near, shadowDistance] into cascades (lambda blends uniform and logarithmic splits) and
+// fits an orthographic light box around each slice of the camera frustum.
+static ShadowCascadeData computeShadowCascades(const glm::vec3& lightDir, float aspect, float nearPlane) {
+    ShadowCascadeData data{};
+
+    uint32_t count = static_cast<uint32_t>(app_state.cascadeCount);
+    float farPlane = std::max(app_state.shadowDistance, nearPlane * 2.0f);
+    float tanHalfFov = std::tan(glm::radians(app_state.fov) * 0.5f);
+
+    glm::vec3 camPos = app_state.camera.getPosition();
+    glm::vec3 camFwd = app_state.camera.getForward();
+    glm::vec3 camRight = app_state.camera.getRight();
+    glm::vec3 camUp = app_state.camera.getUp();
+
+    // Rotation only, so light space does not move with the camera and snapping stays meaningful.
+    glm::vec3 lightUp = std::abs(lightDir.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), -lightDir, lightUp);
+
+    float sliceNear = nearPlane;
+    for (uint32_t i = 0; i < count; ++i) {
+        float p = static_cast<float>(i + 1) / static_cast<float>(count);
+        float logSplit = nearPlane * std::pow(farPlane / nearPlane, p);
+        float uniformSplit = nearPlane + (farPlane - nearPlane) * p;
+        float sliceFar = glm::mix(uniformSplit, logSplit, app_state.cascadeSplitLambda);
+
+        glm::vec3 corners[8];
+        int corner = 0;
+        for (float d : {sliceNear, sliceFar}) {
+            float halfHeight = d * tanHalfFov;
+            float halfWidth = halfHeight * aspect;
+            for (float sx : {-1.0f, 1.0f}) {
+                for (float sy : {-1.0f, 1.0f}) {
+                    corners[corner++] = camPos + camFwd * d + camRight * (sx * halfWidth) + camUp * (sy * halfHeight);
+                }
+            }
+        }
+
+        // A bounding sphere keeps the box size fixed as the camera turns, so texels keep their size.
+        glm::vec3 center(0.0f);
+        for (const glm::vec3& c : corners) {
+            center += c;
+        }
+        center /= 8.0f;
+
+        float radius = 0.0f;
+        for (const glm::vec3& c : corners) {
+            radius = std::max(radius, glm::length(c - center));
+        }
+        radius = std::ceil(radius * 16.0f) / 16.0f;
+
+        // Move the box in whole texels only, otherwise edges shimmer as the camera moves.
+        float texel = 2.0f * radius / static_cast<float>(app_state.shadowMapSize);
+        glm::vec3 lightCenter = glm::vec3(lightView * glm::vec4(center, 1.0f));
+        lightCenter.x = std::floor(lightCenter.x / texel) * texel;
+        lightCenter.y = std::floor(lightCenter.y / texel) * texel;
+        // Depth range in whole units (far gets one more to still cover the slice), so small camera
+        // moves leave the matrices bit-identical and the cached shadow map reusable.
+        lightCenter.z = std::floor(lightCenter.z);
+
+        glm::mat4 lightProj = glm::orthoRH_ZO(lightCenter.x - radius, lightCenter.x + radius,
+                                              lightCenter.y - radius, lightCenter.y + radius,
+                                              -lightCenter.z - radius - kShadowCasterMargin, -lightCenter.z + radius + 1.0f);
+        lightProj[1][1] *= -1.0f; // flip Y for Vulkan
+
+        data.viewProj[i] = lightProj * lightView;
+        data.splits[i] = sliceFar;
+        sliceNear = sliceFar;
+    }
+
+    data.params = glm::vec4(static_cast<float>(count), app_state.cascadeBlend, app_state.showCascades ? 1.0f : 0.0f,
+                            app_state.pcssLightSize);
+    return data;
+}
+
+// Orthographic projection of a square of pages from first on; every page shares the map's depth range,
+// so a page renders exactly the depth the whole virtual map would have there.
+static glm::mat4 virtualPageViewProj(const VirtualShadowKey& key, VirtualShadowMap::Page first, uint32_t pages) {
+    float x = static_cast<float>(first.x) * key.pageWorld;
+    float y = static_cast<float>(first.y) * key.pageWorld;
+    float size = static_cast<float>(pages) * key.pageWorld;
+    return glm::orthoRH_ZO(x, x + size, y, y + size, key.depthNear, key.depthFar) * key.lightView;
+}
+
+// Pages the caster's shadow can land in: its bounds seen along the light.
+static void virtualShadowPages(const VirtualShadowKey& key, const BoundingSphere& caster,
+                               VirtualShadowMap::Page& min, VirtualShadowMap::Page& max) {
+    glm::vec3 center = glm::vec3(key.lightView * glm::vec4(caster.center, 1.0f));
+    min = {static_cast<int32_t>(std::floor((center.x - caster.radius) / key.pageWorld)),
+           static_cast<int32_t>(std::floor((center.y - caster.radius) / key.pageWorld))};
+    max = {static_cast<int32_t>(std::floor((center.x + caster.radius) / key.pageWorld)),
+           static_cast<int32_t>(std::floor((center.y + caster.radius) / key.pageWorld))};
+}
+
+// Centers the virtual shadow map's page window on the camera. The window moves in whole pages and
+// the depth range in steps of half the shadow distance, so resident pages stay valid as the camera moves.
+static glm::mat4 fitVirtualShadowMap(const glm::vec3& lightDir, VirtualShadowKey& key, VirtualShadowMap::Page& origin) {
+    float distance = std::max(app_state.shadowDistance, kCameraNear * 2.0f);
+
+    // Same light space as the cascades.
+    glm::vec3 lightUp = std::abs(lightDir.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    key.lightView = glm::lookAt(glm::vec3(0.0f), -lightDir, lightUp);
+    key.pageWorld = 2.0f * distance / static_cast<float>(kVsmTableSize);
+
+    glm::vec3 camera = glm::vec3(key.lightView * glm::vec4(app_state.camera.getPosition(), 1.0f));
+    int32_t half = static_cast<int32_t>(kVsmTableSize / 2);
+    origin.x = static_cast<int32_t>(std::floor(camera.x / key.pageWorld)) - half;
+    origin.y = static_cast<int32_t>(std::floor(camera.y / key.pageWorld)) - half;
+
+    // Receivers within the shadow distance of the camera, and casters up to kShadowCasterMargin before them.
+    float step = 0.5f * distance;
+    float center = std::floor(-camera.z / step) * step;
+    key.depthNear = center - distance - kShadowCasterMargin;
+    key.depthFar = center + step + distance;
+
+    return virtualPageViewProj(key, origin, kVsmTableSize);
+}
+
+// How much a light deserves a large atlas tile: the share of the screen its reach covers,
+// weighted by brightness. 0 when the reach misses the camera frustum, nothing visible receives its shadow.
+static float localShadowPriority(const glm::vec3& position, float reach, float intensity, const Frustum& view) {
+    glm::vec3 toLight = position - app_state.camera.getPosition();
+    if (!intersects(view, BoundingSphere{position, reach})) {
+        return 0.0f;
+    }
+    float dist = glm::length(toLight);
+    float tanHalfFov = std::tan(glm::radians(app_state.fov) * 0.5f);
+    float coverage = dist <= reach ? 1.0f : std::min(reach / (dist * tanHalfFov), 1.0f);
+    float importance = std::clamp(intensity / kLocalShadowReferenceIntensity, 0.25f, 1.0f);
+    return coverage * importance;
+}
+
+static uint32_t atlasTileSize(float priority, uint32_t maxTile) {
+    uint32_t size = std::bit_ceil(static_cast<uint32_t>(priority * static_cast<float>(maxTile)));
+    return std::clamp(size, kMinAtlasTile, maxTile);
+}
+
+// Gives every shadowed spot and point light its tiles in the atlas, then writes their matrices
+// and tile rects to the frame's atlas buffer and the draws render() issues. Lights keep their
+// tiles while the size they ask for stays the same. When the atlas is too fragmented for a
+// request, all tiles are handed out again, largest first, shrinking those that do not fit.
+static void assignShadowAtlas(FrameResources& res, std::vector<PointLightData>& points, size_t pointCount,
+                              std::vector<SpotLightData>& spots, size_t spotCount,
+                              const Frustum& view, const BoundingSphere* casters, uint32_t casterCount) {
+    struct Request {
+        uint32_t firstEntry;
+        uint32_t faces;
+        uint32_t size;
+        float priority;
+        glm::mat4 viewProj[6];
+        glm::ivec4* shadow;
+    };
+    std::array<Request, kMaxPointLights + kMaxSpotLights> requests;
+    uint32_t requestCount = 0;
+
+    for (PointLightData& light : points) light.shadow.x = -1;
+    for (SpotLightData& light : spots) light.shadow.x = -1;
+
+    if (app_state.enableShadows && app_state.localShadows && app_state.atlasPipeline != VK_NULL_HANDLE) {
+        for (size_t i = 0; i < spotCount; ++i) {
+            glm::vec3 position(spots[i].positionIntensity);
+            float priority = localShadowPriority(position, kLocalShadowFar, spots[i].positionIntensity.w, view);
+            if (priority <= 0.0f) continue;
+
+            glm::vec3 dir = glm::normalize(glm::vec3(spots[i].directionInnerCos));
+            glm::vec3 up = std::abs(dir.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+            // A little wider than the cone, so filter taps at its edge still land in the tile.
+            float fov = std::min(2.0f * std::acos(spots[i].colorOuterCos.w) + glm::radians(4.0f), glm::radians(170.0f));
+
+            Request& request = requests[requestCount++];
+            request.firstEntry = static_cast<uint32_t>(i);
+            request.faces = 1;
+            request.size = atlasTileSize(priority, kMaxSpotShadowTile);
+            request.priority = priority;
+            request.viewProj[0] = glm::perspectiveRH_ZO(fov, 1.0f, kLocalShadowNear, kLocalShadowFar) *
+                                  glm::lookAt(position, position + dir, up);
+            request.shadow = &spots[i].shadow;
+        }
+
+        // Same face order as pointShadowFace() in frag.glsl.
+        const glm::vec3 faceDirs[6] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+        const glm::vec3 faceUps[6] = {{0, -1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}, {0, -1, 0}, {0, -1, 0}};
+
+        for (size_t i = 0; i < pointCount; ++i) {
+            glm::vec3 position(points[i].positionIntensity);
+            float range = points[i].colorRange.w;
+            float reach = range > 0.0f ? std::min(range, kLocalShadowFar) : kLocalShadowFar;
+            float priority = localShadowPriority(position, reach, points[i].positionIntensity.w, view);
+            if (priority <= 0.0f) continue;
+
+            Request& request = requests[requestCount++];
+            request.firstEntry = kMaxSpotLights + 6 * static_cast<uint32_t>(i);
+            request.faces = 6;
+            request.size = atlasTileSize(priority, kMaxPointShadowTile);
+            request.priority = priority;
+            glm::mat4 proj = glm::perspectiveRH_ZO(glm::radians(90.0f), 1.0f, kLocalShadowNear, reach);
+            for (uint32_t face = 0; face < 6; ++face) {
+                request.viewProj[face] = proj * glm::lookAt(position, position + faceDirs[face], faceUps[face]);
+            }
+            request.shadow = &points[i].shadow;
+        }
+    }
+
+    std::array<uint32_t, kMaxAtlasEntries> wanted{};
+    for (uint32_t r = 0; r < requestCount; ++r) {
+        for (uint32_t face = 0; face < requests[r].faces; ++face) {
+            wanted[requests[r].firstEntry + face] = requests[r].size;
+        }
+    }
+
+    // Tiles of lights that went away or now ask for another size go back to the atlas.
+    for (uint32_t entry = 0; entry < kMaxAtlasEntries; ++entry) {
+        if (app_state.atlasTiles[entry].size != 0 && app_state.atlasRequested[entry] != wanted[entry]) {
+            app_state.shadowAtlas.release(app_state.atlasTiles[entry]);
+            app_state.atlasTiles[entry] = {};
+        }
+    }
+
+    // Largest first never fragments a quadtree, ties go to the more important light.
+    std::sort(requests.begin(), requests.begin() + requestCount, [](const Request& a, const Request& b) {
+        return a.size != b.size ? a.size > b.size : a.priority > b.priority;
+    });
+
+    auto place = [](const Request& request, uint32_t size) {
+        for (uint32_t face = 0; face < request.faces; ++face) {
+            ShadowAtlas::Tile& tile = app_state.atlasTiles[request.firstEntry + face];
+            if (tile.size == 0 && !app_state.shadowAtlas.allocate(size, tile)) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    bool placed = true;
+    for (uint32_t r = 0; r < requestCount && placed; ++r) {
+        placed = place(requests[r], requests[r].size);
+    }
+
+    if (!placed) {
+        // All faces of a point light share one size.
+        std::array<ShadowAtlas::Group, kMaxPointLights + kMaxSpotLights> groups;
+        for (uint32_t r = 0; r < requestCount; ++r) {
+            groups[r] = {requests[r].size, requests[r].faces, &app_state.atlasTiles[requests[r].firstEntry]};
+        }
+        app_state.atlasTiles.fill({});
+        app_state.shadowAtlas.repack(groups.data(), requestCount);
+    }
+    app_state.atlasRequested = wanted;
+
+    auto* entries = static_cast<ShadowAtlasEntry*>(res.atlasBuffer->mapped_region);
+    float texel = 1.0f / static_cast<float>(kShadowAtlasSize);
+    res.atlasDrawCount = 0;
+
+    for (uint32_t r = 0; r < requestCount; ++r) {
+        const Request& request = requests[r];
+        if (app_state.atlasTiles[request.firstEntry].size == 0) continue;
+
+        AtlasDraw& draw = res.atlasDraws[res.atlasDrawCount++];
+        draw.firstEntry = request.firstEntry;
+        draw.faces = request.faces;
+        for (uint32_t c = 0; c < 2; ++c) {
+            draw.casterFaces[c] = c < casterCount ? casterViewMask(casters[c], request.viewProj, request.faces) : 0;
+        }
+        for (uint32_t face = 0; face < request.faces; ++face) {
+            const ShadowAtlas::Tile& tile = app_state.atlasTiles[request.firstEntry + face];
+            entries[request.firstEntry + face].viewProj = request.viewProj[face];
+            entries[request.firstEntry + face].rect = glm::vec4(tile.x, tile.y, tile.size, tile.size) * texel;
+            draw.viewports[face] = VkViewport{static_cast<float>(tile.x), static_cast<float>(tile.y),
+                                              static_cast<float>(tile.size), static_cast<float>(tile.size), 0.0f, 1.0f};
+            draw.scissors[face] = VkRect2D{{static_cast<int32_t>(tile.x), static_cast<int32_t>(tile.y)}, {tile.size, tile.size}};
+        }
+        // The pipeline has six viewports and all must be set; a spot light's instance only uses the first.
+        for (uint32_t face = request.faces; face < 6; ++face) {
+            draw.viewports[face] = draw.viewports[0];
+            draw.scissors[face] = draw.scissors[0];
+        }
+        request.shadow->x = static_cast<int>(request.firstEntry);
+    }
+    app_state.atlasShadowedLights = res.atlasDrawCount;
+}
+
+static void applyQualityTier(int tier) {
+    const QualityTier& q = kQualityTiers[tier];
+    app_state.enableShadows = q.shadows;
+    app_state.shadowFilter = static_cast<int>(q.shadowFilter);
+    app_state.localShadows = q.localShadows;
+    app_state.cascadeCount = q.cascades;
+    app_state.sphereSegments = q.sphereSegments;
+    app_state.maxPointLights = q.maxPointLights;
+    app_state.maxSpotLights = q.maxSpotLights;
+}
+
+// Feeds each resolved frame to the governor once and applies the tier it picks.
+static void updateQualityGovernor() {
+    veekay::profiler::FrameTimings timings;
+    if (!veekay::profiler::latest(timings) || timings.number == app_state.governorProfiledFrame) {
+        return;
+    }
+    app_state.governorProfiledFrame = timings.number;
+
+    // Present blocks on vsync, counting it would make every capped frame look CPU bound.
+    using veekay::profiler::CpuStage;
+    double cpuMs = timings.cpu_ms[static_cast<size_t>(CpuStage::update)] +
+                   timings.cpu_ms[static_cast<size_t>(CpuStage::record)] +
+                   timings.cpu_ms[static_cast<size_t>(CpuStage::submit)];
+
+    QualityGovernor::Change change;
+    if (app_state.governor.addSample(cpuMs, timings.gpu_ms, change)) {
+        applyQualityTier(change.to);
+        std::cout << "Quality " << kQualityTiers[change.from].name << " -> " << kQualityTiers[change.to].name
+                  << " at frame " << timings.number << ": cpu " << change.cpuMs << " ms, gpu " << change.gpuMs
+                  << " ms, budget " << app_state.governor.budget() << " ms" << std::endl;
+    }
+}
+
 VkShaderModule loadShaderModule(const char* path) {
     std::filesystem::path resolved = resolveAssetPath(path);
     std::ifstream file(resolved, std::ios::binary | std::ios::ate);
@@ -300,55 +1134,8 @@ VkShaderModule loadShaderModule(const char* path) {
     return result;
 }
 
-void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, 
-                  VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
-    VkBufferCreateInfo bufferInfo{};
-    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferInfo.size = size;
-    bufferInfo.usage = usage;
-    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    
-    if (vkCreateBuffer(veekay::app.vk_device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create buffer!");
-    }
-    
-    VkMemoryRequirements memRequirements;
-    vkGetBufferMemoryRequirements(veekay::app.vk_device, buffer, &memRequirements);
-    
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(veekay::app.vk_physical_device, &memProperties);
-    
-    uint32_t memoryTypeIndex = UINT32_MAX;
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if ((memRequirements.memoryTypeBits & (1 << i)) && 
-            (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-            memoryTypeIndex = i;
-            break;
-        }
-    }
-    
-    if (memoryTypeIndex == UINT32_MAX) {
-        throw std::runtime_error("failed to find suitable memory type!");
-    }
-    
-    allocInfo.memoryTypeIndex = memoryTypeIndex;
-    
-    if (vkAllocateMemory(veekay::app.vk_device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate buffer memory!");
-    }
-    
-    vkBindBufferMemory(veekay::app.vk_device, buffer, bufferMemory, 0);
-}
-
-VkFormat getShadowDepthFormat() {
-    return VK_FORMAT_D32_SFLOAT;
-}
-
-void createDepthImage(uint32_t width, uint32_t height,
+void createImageArray(uint32_t width, uint32_t height, uint32_t layers,
+                      VkFormat format, VkImageAspectFlags aspect,
                       VkImageUsageFlags usage,
                       VkImage& image,
                       VkDeviceMemory& imageMemory,
@@ -356,10 +1143,10 @@ void createDepthImage(uint32_t width, uint32_t height,
     VkImageCreateInfo imageInfo{};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
     imageInfo.imageType = VK_IMAGE_TYPE_2D;
-    imageInfo.format = getShadowDepthFormat();
+    imageInfo.format = format;
     imageInfo.extent = {width, height, 1};
     imageInfo.mipLevels = 1;
-    imageInfo.arrayLayers = 1;
+    imageInfo.arrayLayers = layers;
     imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
     imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
     imageInfo.usage = usage;
@@ -403,25 +1190,35 @@ void createDepthImage(uint32_t width, uint32_t height,
     VkImageViewCreateInfo viewInfo{};
     viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
     viewInfo.image = image;
-    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
     viewInfo.format = imageInfo.format;
-    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    viewInfo.subresourceRange.aspectMask = aspect;
     viewInfo.subresourceRange.baseMipLevel = 0;
     viewInfo.subresourceRange.levelCount = 1;
     viewInfo.subresourceRange.baseArrayLayer = 0;
-    viewInfo.subresourceRange.layerCount = 1;
+    viewInfo.subresourceRange.layerCount = layers;
 
     if (vkCreateImageView(veekay::app.vk_device, &viewInfo, nullptr, &imageView) != VK_SUCCESS) {
         throw std::runtime_error("failed to create image view");
     }
 }
 
-void transitionDepthImage(VkCommandBuffer cmd, VkImage image,
-                          VkImageLayout oldLayout, VkImageLayout newLayout,
-                          VkPipelineStageFlags srcStage,
-                          VkPipelineStageFlags dstStage,
-                          VkAccessFlags srcAccess,
-                          VkAccessFlags dstAccess) {
+void createDepthImage(uint32_t width, uint32_t height, uint32_t layers,
+                      VkFormat format,
+                      VkImageUsageFlags usage,
+                      VkImage& image,
+                      VkDeviceMemory& imageMemory,
+                      VkImageView& imageView) {
+    createImageArray(width, height, layers, format, VK_IMAGE_ASPECT_DEPTH_BIT,
+                     usage, image, imageMemory, imageView);
+}
+
+void transitionImage(VkCommandBuffer cmd, VkImage image, VkImageAspectFlags aspect,
+                     VkImageLayout oldLayout, VkImageLayout newLayout,
+                     VkPipelineStageFlags srcStage,
+                     VkPipelineStageFlags dstStage,
+                     VkAccessFlags srcAccess,
+                     VkAccessFlags dstAccess) {
     VkImageMemoryBarrier barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
     barrier.oldLayout = oldLayout;
@@ -429,11 +1226,11 @@ void transitionDepthImage(VkCommandBuffer cmd, VkImage image,
     barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     barrier.image = image;
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    barrier.subresourceRange.aspectMask = aspect;
     barrier.subresourceRange.baseMipLevel = 0;
     barrier.subresourceRange.levelCount = 1;
     barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
+    barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
 
     barrier.srcAccessMask = srcAccess;
     barrier.dstAccessMask = dstAccess;
@@ -446,17 +1243,263 @@ void transitionDepthImage(VkCommandBuffer cmd, VkImage image,
                          1, &barrier);
 }
 
+void transitionDepthImage(VkCommandBuffer cmd, VkImage image,
+                          VkImageLayout oldLayout, VkImageLayout newLayout,
+                          VkPipelineStageFlags srcStage,
+                          VkPipelineStageFlags dstStage,
+                          VkAccessFlags srcAccess,
+                          VkAccessFlags dstAccess) {
+    transitionImage(cmd, image, VK_IMAGE_ASPECT_DEPTH_BIT, oldLayout, newLayout, srcStage, dstStage, srcAccess, dstAccess);
+}
+
+// Compute pipeline that turns the cascades into blurred EVSM moments (shaders/evsm.comp).
+static void createEvsmPipeline() {
+    std::array<VkDescriptorSetLayoutBinding, 3> bindings{};
+    bindings[0].binding = 0;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[0].descriptorCount = 1;
+    bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    bindings[1].binding = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    bindings[1].descriptorCount = 1;
+    bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    bindings[2].binding = 2;
+    bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    bindings[2].descriptorCount = 1;
+    bindings[2].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+    if (vkCreateDescriptorSetLayout(veekay::app.vk_device, &layoutInfo, nullptr, &app_state.evsmSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create EVSM descriptor set layout!");
+    }
+
+    // pass, blur radius
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = 2 * sizeof(int32_t);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &app_state.evsmSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    if (vkCreatePipelineLayout(veekay::app.vk_device, &pipelineLayoutInfo, nullptr, &app_state.evsmPipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create EVSM pipeline layout!");
+    }
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = app_state.evsmShaderModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = app_state.evsmPipelineLayout;
+    if (vkCreateComputePipelines(veekay::app.vk_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &app_state.evsmPipeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create EVSM pipeline!");
+    }
+
+    std::array<VkDescriptorPoolSize, 2> poolSizes{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[0].descriptorCount = 1;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[1].descriptorCount = 2;
+
+    // One set per frame in flight, the images are rewritten when the shadow maps are recreated.
+    const uint32_t setCount = veekay::app.frames_in_flight;
+    poolSizes[0].descriptorCount *= setCount;
+    poolSizes[1].descriptorCount *= setCount;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    poolInfo.maxSets = setCount;
+    if (vkCreateDescriptorPool(veekay::app.vk_device, &poolInfo, nullptr, &app_state.evsmDescriptorPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create EVSM descriptor pool!");
+    }
+
+    for (uint32_t i = 0; i < setCount; ++i) {
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = app_state.evsmDescriptorPool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &app_state.evsmSetLayout;
+        if (vkAllocateDescriptorSets(veekay::app.vk_device, &allocInfo, &app_state.frames[i].evsmDescriptorSet) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate EVSM descriptor set!");
+        }
+    }
+}
+
+struct ImageArray {
+    VkImage image = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+};
+
+static void destroyImageArray(const ImageArray& images) {
+    vkDestroyImageView(veekay::app.vk_device, images.view, nullptr);
+    vkDestroyImage(veekay::app.vk_device, images.image, nullptr);
+    vkFreeMemory(veekay::app.vk_device, images.memory, nullptr);
+}
+
+// The shadow map, its static layer and the EVSM moments and blur target, in that order.
+static std::array<ImageArray, 4> currentShadowMaps() {
+    return {{
+        {app_state.shadowImage, app_state.shadowImageMemory, app_state.shadowImageView},
+        {app_state.shadowStaticImage, app_state.shadowStaticImageMemory, app_state.shadowStaticImageView},
+        {app_state.evsmImage, app_state.evsmImageMemory, app_state.evsmImageView},
+        {app_state.evsmTempImage, app_state.evsmTempImageMemory, app_state.evsmTempImageView},
+    }};
+}
+
+// Bytes of device memory the maps of one size and format take (all kMaxCascades layers).
+static uint64_t shadowMapMemory(uint32_t size, int format) {
+    uint64_t depth = uint64_t(size) * size * kMaxCascades * kShadowFormatBytes[format];
+    uint64_t moments = uint64_t(size / 2) * (size / 2) * kMaxCascades * 8; // RGBA16F
+    return 2 * depth + 2 * moments;
+}
+
+// Creates the directional shadow map and everything sized after it. The previous images go to
+// veekay::deletion, frames in flight may still sample them; every frame slot rewrites its
+// descriptors once it sees the new generation. Returns false and keeps the old images when the new
+// ones cannot be allocated.
+static bool createShadowMaps(VkCommandBuffer cmd, uint32_t size, int format) {
+    std::array<ImageArray, 4> created{};
+    try {
+        createDepthImage(size, size, kMaxCascades, kShadowFormats[format],
+                         VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                         created[0].image, created[0].memory, created[0].view);
+        createDepthImage(size, size, kMaxCascades, kShadowFormats[format],
+                         VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                         created[1].image, created[1].memory, created[1].view);
+        createImageArray(size / 2, size / 2, kMaxCascades, VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT,
+                         VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                         created[2].image, created[2].memory, created[2].view);
+        createImageArray(size / 2, size / 2, kMaxCascades, VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT,
+                         VK_IMAGE_USAGE_STORAGE_BIT,
+                         created[3].image, created[3].memory, created[3].view);
+    } catch (const std::runtime_error& error) {
+        for (const ImageArray& images : created) {
+            destroyImageArray(images);
+        }
+        std::cerr << "Failed to create " << size << "x" << size << " " << kShadowFormatNames[format]
+                  << " shadow maps: " << error.what() << std::endl;
+        return false;
+    }
+
+    if (app_state.shadowImage != VK_NULL_HANDLE) {
+        veekay::deletion::defer([old = currentShadowMaps()] {
+            for (const ImageArray& images : old) {
+                destroyImageArray(images);
+            }
+        });
+    }
+
+    app_state.shadowImage = created[0].image;
+    app_state.shadowImageMemory = created[0].memory;
+    app_state.shadowImageView = created[0].view;
+    app_state.shadowStaticImage = created[1].image;
+    app_state.shadowStaticImageMemory = created[1].memory;
+    app_state.shadowStaticImageView = created[1].view;
+    app_state.evsmImage = created[2].image;
+    app_state.evsmImageMemory = created[2].memory;
+    app_state.evsmImageView = created[2].view;
+    app_state.evsmTempImage = created[3].image;
+    app_state.evsmTempImageMemory = created[3].memory;
+    app_state.evsmTempImageView = created[3].view;
+
+    // Both stay in GENERAL, the blur writes them and the main pass samples the moments.
+    for (VkImage image : {app_state.evsmImage, app_state.evsmTempImage}) {
+        transitionImage(cmd, image, VK_IMAGE_ASPECT_COLOR_BIT,
+                        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+                        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                        0, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+    }
+
+    // Nothing cached survives, the new images start undefined.
+    app_state.shadowInitialized = false;
+    app_state.shadowStaticLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    app_state.shadowStaticValid = false;
+    app_state.shadowMapValid = false;
+    app_state.evsmValid = false;
+
+    app_state.shadowMapImageSize = size;
+    app_state.shadowMapImageFormat = format;
+    ++app_state.shadowMapGeneration;
+    app_state.shadowMapLive.store(packShadowMapSetting(size, format));
+    return true;
+}
+
+// Points the slot's descriptor sets at the current shadow maps. The slot's previous frame has
+// finished, so its sets can be updated.
+static void writeShadowDescriptors(FrameResources& res) {
+    VkDescriptorImageInfo shadowInfo{};
+    shadowInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL;
+    shadowInfo.imageView = app_state.shadowImageView;
+    shadowInfo.sampler = app_state.shadowSampler;
+
+    VkDescriptorImageInfo shadowDepthInfo{};
+    shadowDepthInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL;
+    shadowDepthInfo.imageView = app_state.shadowImageView;
+    shadowDepthInfo.sampler = app_state.shadowDepthSampler;
+
+    VkDescriptorImageInfo momentsImageInfo{};
+    momentsImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    momentsImageInfo.imageView = app_state.evsmImageView;
+    momentsImageInfo.sampler = app_state.shadowMomentsSampler;
+
+    VkDescriptorImageInfo tempInfo{};
+    tempInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    tempInfo.imageView = app_state.evsmTempImageView;
+
+    VkDescriptorImageInfo momentsStorageInfo{};
+    momentsStorageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    momentsStorageInfo.imageView = app_state.evsmImageView;
+
+    std::vector<VkWriteDescriptorSet> writes;
+    auto write = [&](VkDescriptorSet set, uint32_t binding, VkDescriptorType type, const VkDescriptorImageInfo* info) {
+        VkWriteDescriptorSet w{};
+        w.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        w.dstSet = set;
+        w.dstBinding = binding;
+        w.descriptorType = type;
+        w.descriptorCount = 1;
+        w.pImageInfo = info;
+        writes.push_back(w);
+    };
+
+    for (VkDescriptorSet set : {res.descriptorSetSphere, res.descriptorSetPlane, res.descriptorSetStress}) {
+        write(set, 7, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &shadowInfo);
+        write(set, 11, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &shadowDepthInfo);
+        write(set, 12, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &momentsImageInfo);
+    }
+    if (res.evsmDescriptorSet != VK_NULL_HANDLE) {
+        write(res.evsmDescriptorSet, 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &shadowDepthInfo);
+        write(res.evsmDescriptorSet, 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, &tempInfo);
+        write(res.evsmDescriptorSet, 2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, &momentsStorageInfo);
+    }
+
+    vkUpdateDescriptorSets(veekay::app.vk_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+    res.shadowMapGeneration = app_state.shadowMapGeneration;
+}
+
 void init(VkCommandBuffer cmd) {
     std::cout << "Initializing application..." << std::endl;
     
     
-    const int segments = 10;
+    const int segments = app_state.sphereSegments;
     app_state.sphereVertices = SphereGenerator::generateSphere(1.0f, segments, glm::vec3(0.5f, 0.8f, 1.0f));
     app_state.sphereIndices = SphereGenerator::generateIndices(segments);
-    app_state.indexCount = static_cast<uint32_t>(app_state.sphereIndices.size());
+    app_state.sphereMeshSegments = segments;
 
     makePlaneMesh(12.0f, app_state.planePosition.y, 8.0f, app_state.planeVertices, app_state.planeIndices);
-    app_state.planeIndexCount = static_cast<uint32_t>(app_state.planeIndices.size());
+    app_state.sphereBounds = computeBounds(app_state.sphereVertices);
+    app_state.planeBounds = computeBounds(app_state.planeVertices);
     
     std::cout << "Generated " << app_state.sphereVertices.size() << " vertices and " 
               << app_state.sphereIndices.size() << " indices" << std::endl;
@@ -470,76 +1513,46 @@ void init(VkCommandBuffer cmd) {
     app_state.camera.setDistance(3.0f);
     app_state.camera.setRotation(0.0f, 0.0f);
     
-    VkDeviceSize vertexBufferSize = sizeof(app_state.sphereVertices[0]) * app_state.sphereVertices.size();
-    createBuffer(vertexBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 app_state.vertexBuffer, app_state.vertexBufferMemory);
-    
-    void* data;
-    vkMapMemory(veekay::app.vk_device, app_state.vertexBufferMemory, 0, vertexBufferSize, 0, &data);
-    memcpy(data, app_state.sphereVertices.data(), (size_t)vertexBufferSize);
-    vkUnmapMemory(veekay::app.vk_device, app_state.vertexBufferMemory);
-    
-    VkDeviceSize indexBufferSize = sizeof(app_state.sphereIndices[0]) * app_state.sphereIndices.size();
-    createBuffer(indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 app_state.indexBuffer, app_state.indexBufferMemory);
-    
-    vkMapMemory(veekay::app.vk_device, app_state.indexBufferMemory, 0, indexBufferSize, 0, &data);
-    memcpy(data, app_state.sphereIndices.data(), (size_t)indexBufferSize);
-    vkUnmapMemory(veekay::app.vk_device, app_state.indexBufferMemory);
-
-    VkDeviceSize planeVertexBufferSize = sizeof(app_state.planeVertices[0]) * app_state.planeVertices.size();
-    createBuffer(planeVertexBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 app_state.planeVertexBuffer, app_state.planeVertexBufferMemory);
-
-    vkMapMemory(veekay::app.vk_device, app_state.planeVertexBufferMemory, 0, planeVertexBufferSize, 0, &data);
-    memcpy(data, app_state.planeVertices.data(), (size_t)planeVertexBufferSize);
-    vkUnmapMemory(veekay::app.vk_device, app_state.planeVertexBufferMemory);
-
-    VkDeviceSize planeIndexBufferSize = sizeof(app_state.planeIndices[0]) * app_state.planeIndices.size();
-    createBuffer(planeIndexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 app_state.planeIndexBuffer, app_state.planeIndexBufferMemory);
-
-    vkMapMemory(veekay::app.vk_device, app_state.planeIndexBufferMemory, 0, planeIndexBufferSize, 0, &data);
-    memcpy(data, app_state.planeIndices.data(), (size_t)planeIndexBufferSize);
-    vkUnmapMemory(veekay::app.vk_device, app_state.planeIndexBufferMemory);
-    
-    VkDeviceSize uniformBufferSize = sizeof(UniformBufferObject);
-    createBuffer(uniformBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 app_state.uniformBuffer, app_state.uniformBufferMemory);
-
-    createBuffer(uniformBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 app_state.planeUniformBuffer, app_state.planeUniformBufferMemory);
-
-    VkDeviceSize materialBufferSize = sizeof(MaterialData);
-    createBuffer(materialBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 app_state.materialBuffer, app_state.materialBufferMemory);
-
-    VkDeviceSize dirLightBufferSize = sizeof(DirectionalLightData);
-    createBuffer(dirLightBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 app_state.directionalLightBuffer, app_state.directionalLightBufferMemory);
-
-    VkDeviceSize pointLightBufferSize = sizeof(PointLightData) * kMaxPointLights;
-    createBuffer(pointLightBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 app_state.pointLightBuffer, app_state.pointLightBufferMemory);
-
-    VkDeviceSize spotLightBufferSize = sizeof(SpotLightData) * kMaxSpotLights;
-    createBuffer(spotLightBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 app_state.spotLightBuffer, app_state.spotLightBufferMemory);
-
-    VkDeviceSize countBufferSize = sizeof(LightCounts);
-    createBuffer(countBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 app_state.lightCountBuffer, app_state.lightCountBufferMemory);
+    app_state.geometry = new veekay::graphics::GeometryBuffer(
+        sizeof(Vertex),
+        static_cast<uint32_t>(app_state.sphereVertices.size() + app_state.planeVertices.size()),
+        static_cast<uint32_t>(app_state.sphereIndices.size() + app_state.planeIndices.size()));
+
+    app_state.sphereMesh = app_state.geometry->upload(
+        app_state.sphereVertices.data(), static_cast<uint32_t>(app_state.sphereVertices.size()),
+        app_state.sphereIndices.data(), static_cast<uint32_t>(app_state.sphereIndices.size()));
+    app_state.planeMesh = app_state.geometry->upload(
+        app_state.planeVertices.data(), static_cast<uint32_t>(app_state.planeVertices.size()),
+        app_state.planeIndices.data(), static_cast<uint32_t>(app_state.planeIndices.size()));
+    
+    for (uint32_t i = 0; i < veekay::app.frames_in_flight; ++i) {
+        FrameResources& res = app_state.frames[i];
+        res.uniformBuffer = new veekay::graphics::Buffer(sizeof(UniformBufferObject), nullptr, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+        res.planeUniformBuffer = new veekay::graphics::Buffer(sizeof(UniformBufferObject), nullptr, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+        res.materialBuffer = new veekay::graphics::Buffer(sizeof(MaterialData), nullptr, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+        res.directionalLightBuffer = new veekay::graphics::Buffer(sizeof(DirectionalLightData), nullptr, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+        res.pointLightBuffer = new veekay::graphics::Buffer(sizeof(PointLightData) * kMaxPointLights, nullptr, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        res.spotLightBuffer = new veekay::graphics::Buffer(sizeof(SpotLightData) * kMaxSpotLights, nullptr, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        res.lightCountBuffer = new veekay::graphics::Buffer(sizeof(LightCounts), nullptr, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+        res.cascadeBuffer = new veekay::graphics::Buffer(sizeof(ShadowCascadeData), nullptr, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+        res.atlasBuffer = new veekay::graphics::Buffer(sizeof(ShadowAtlasEntry) * kAtlasBufferEntries, nullptr, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        res.vsmPageTableBuffer = new veekay::graphics::Buffer(sizeof(uint32_t) * kVsmTableSize * kVsmTableSize, nullptr, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        res.vsmRequestBuffer = new veekay::graphics::Buffer(sizeof(uint32_t) * kVsmRequestWords, nullptr, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        std::memset(res.vsmPageTableBuffer->mapped_region, 0, sizeof(uint32_t) * kVsmTableSize * kVsmTableSize);
+        std::memset(res.vsmRequestBuffer->mapped_region, 0, sizeof(uint32_t) * kVsmRequestWords);
+    }
+
+    {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(veekay::app.vk_physical_device, &properties);
+        VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+        app_state.uboStride = (sizeof(UniformBufferObject) + alignment - 1) / alignment * alignment;
+    }
+
+    for (uint32_t i = 0; i < veekay::app.frames_in_flight; ++i) {
+        app_state.frames[i].stressUniformBuffer = new veekay::graphics::Buffer(
+            app_state.uboStride * kMaxStressObjects, nullptr, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+    }
 
     
     TextureData texData;
@@ -589,11 +1602,26 @@ void init(VkCommandBuffer cmd) {
         throw std::runtime_error("failed to create texture sampler!");
     }
 
-    createDepthImage(kShadowMapSize, kShadowMapSize,
+    {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(veekay::app.vk_physical_device, &properties);
+        app_state.maxShadowMapSize = std::clamp(std::bit_floor(properties.limits.maxImageDimension2D),
+                                                kMinShadowMapSize, kMaxShadowMapSize);
+        app_state.shadowMapSize = std::min(app_state.shadowMapSize, app_state.maxShadowMapSize);
+    }
+    if (!createShadowMaps(cmd, app_state.shadowMapSize, app_state.shadowFormat)) {
+        throw std::runtime_error("failed to create shadow maps!");
+    }
+    createDepthImage(kShadowAtlasSize, kShadowAtlasSize, 1, kAtlasDepthFormat,
+                     VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                     app_state.atlasImage,
+                     app_state.atlasImageMemory,
+                     app_state.atlasImageView);
+    createDepthImage(kVsmPoolSize, kVsmPoolSize, 1, kAtlasDepthFormat,
                      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-                     app_state.shadowImage,
-                     app_state.shadowImageMemory,
-                     app_state.shadowImageView);
+                     app_state.vsmImage,
+                     app_state.vsmImageMemory,
+                     app_state.vsmImageView);
 
     VkSamplerCreateInfo shadowSamplerInfo{};
     shadowSamplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -612,11 +1640,36 @@ void init(VkCommandBuffer cmd) {
     if (vkCreateSampler(veekay::app.vk_device, &shadowSamplerInfo, nullptr, &app_state.shadowSampler) != VK_SUCCESS) {
         throw std::runtime_error("failed to create shadow sampler!");
     }
-    
-    app_state.vertexShaderModule = loadShaderModule("shaders/vert.spv");
+
+    // Raw depth is read texel by texel, the moments are filtered.
+    shadowSamplerInfo.magFilter = VK_FILTER_NEAREST;
+    shadowSamplerInfo.minFilter = VK_FILTER_NEAREST;
+    shadowSamplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    shadowSamplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    shadowSamplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    shadowSamplerInfo.compareEnable = VK_FALSE;
+    shadowSamplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    if (vkCreateSampler(veekay::app.vk_device, &shadowSamplerInfo, nullptr, &app_state.shadowDepthSampler) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create shadow depth sampler!");
+    }
+    shadowSamplerInfo.magFilter = VK_FILTER_LINEAR;
+    shadowSamplerInfo.minFilter = VK_FILTER_LINEAR;
+    if (vkCreateSampler(veekay::app.vk_device, &shadowSamplerInfo, nullptr, &app_state.shadowMomentsSampler) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create shadow moments sampler!");
+    }
+    
+    app_state.vertexShaderModule = loadShaderModule("shaders/vert.spv");
     app_state.fragmentShaderModule = loadShaderModule("shaders/frag.spv");
     app_state.shadowVertexShaderModule = loadShaderModule("shaders/shadow_vert.spv");
     app_state.shadowFragmentShaderModule = loadShaderModule("shaders/shadow_frag.spv");
+    app_state.atlasVertexShaderModule = loadShaderModule("shaders/shadow_atlas_vert.spv");
+    if (!app_state.atlasVertexShaderModule) {
+        std::cerr << "shaders/shadow_atlas_vert.spv not found, spot and point lights cast no shadows" << std::endl;
+    }
+    app_state.evsmShaderModule = loadShaderModule("shaders/evsm_comp.spv");
+    if (!app_state.evsmShaderModule) {
+        std::cerr << "shaders/evsm_comp.spv not found, EVSM shadows fall back to PCF" << std::endl;
+    }
     
     if (!app_state.vertexShaderModule || !app_state.fragmentShaderModule ||
         !app_state.shadowVertexShaderModule || !app_state.shadowFragmentShaderModule) {
@@ -625,10 +1678,11 @@ void init(VkCommandBuffer cmd) {
         return;
     }
     
-    std::array<VkDescriptorSetLayoutBinding, 8> layoutBindings{};
+    std::array<VkDescriptorSetLayoutBinding, 16> layoutBindings{};
     
+    // Dynamic so stress objects can address their UBO inside one buffer; other sets pass offset 0.
     layoutBindings[0].binding = 0;
-    layoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    layoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     layoutBindings[0].descriptorCount = 1;
     layoutBindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
     
@@ -667,6 +1721,47 @@ void init(VkCommandBuffer cmd) {
     layoutBindings[7].descriptorCount = 1;
     layoutBindings[7].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
+    layoutBindings[8].binding = 8;
+    layoutBindings[8].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    layoutBindings[8].descriptorCount = 1;
+    layoutBindings[8].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    layoutBindings[9].binding = 9;
+    layoutBindings[9].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    layoutBindings[9].descriptorCount = 1;
+    layoutBindings[9].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    layoutBindings[10].binding = 10;
+    layoutBindings[10].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    layoutBindings[10].descriptorCount = 1;
+    layoutBindings[10].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    layoutBindings[11].binding = 11;
+    layoutBindings[11].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    layoutBindings[11].descriptorCount = 1;
+    layoutBindings[11].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    layoutBindings[12].binding = 12;
+    layoutBindings[12].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    layoutBindings[12].descriptorCount = 1;
+    layoutBindings[12].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    // Virtual shadow map: page pool, page table and the page requests the fragments write.
+    layoutBindings[13].binding = 13;
+    layoutBindings[13].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    layoutBindings[13].descriptorCount = 1;
+    layoutBindings[13].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    layoutBindings[14].binding = 14;
+    layoutBindings[14].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    layoutBindings[14].descriptorCount = 1;
+    layoutBindings[14].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    layoutBindings[15].binding = 15;
+    layoutBindings[15].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    layoutBindings[15].descriptorCount = 1;
+    layoutBindings[15].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
     VkDescriptorSetLayoutCreateInfo layoutInfo{};
     layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
     layoutInfo.bindingCount = static_cast<uint32_t>(layoutBindings.size());
@@ -681,6 +1776,14 @@ void init(VkCommandBuffer cmd) {
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     pipelineLayoutInfo.setLayoutCount = 1;
     pipelineLayoutInfo.pSetLayouts = &app_state.descriptorSetLayout;
+
+    // First atlas entry of the light being drawn into the shadow atlas and the faces the caster lands in.
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = 2 * sizeof(uint32_t);
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
     
     if (vkCreatePipelineLayout(veekay::app.vk_device, &pipelineLayoutInfo, nullptr, &app_state.pipelineLayout) != VK_SUCCESS) {
         throw std::runtime_error("failed to create pipeline layout!");
@@ -816,15 +1919,30 @@ void init(VkCommandBuffer cmd) {
     pipelineInfo.renderPass = veekay::app.vk_render_pass;
     pipelineInfo.subpass = 0;
     
-    if (vkCreateGraphicsPipelines(veekay::app.vk_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &app_state.graphicsPipeline) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create graphics pipeline!");
-    }
-    
-    rasterizer.polygonMode = VK_POLYGON_MODE_LINE;
-    rasterizer.lineWidth = 1.5f;
-    
-    if (vkCreateGraphicsPipelines(veekay::app.vk_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &app_state.wireframePipeline) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create wireframe pipeline!");
+    // SHADOW_FILTER (constant_id 0) picks the filter, the driver compiles out the other branches.
+    int32_t shadowFilter = 0;
+    VkSpecializationMapEntry specializationEntry{0, 0, sizeof(int32_t)};
+    VkSpecializationInfo specializationInfo{};
+    specializationInfo.mapEntryCount = 1;
+    specializationInfo.pMapEntries = &specializationEntry;
+    specializationInfo.dataSize = sizeof(int32_t);
+    specializationInfo.pData = &shadowFilter;
+    shaderStages[1].pSpecializationInfo = &specializationInfo;
+
+    for (shadowFilter = 0; shadowFilter < kShadowFilterCount; ++shadowFilter) {
+        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterizer.lineWidth = 1.0f;
+        if (vkCreateGraphicsPipelines(veekay::app.vk_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr,
+                                      &app_state.graphicsPipelines[shadowFilter]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create graphics pipeline!");
+        }
+
+        rasterizer.polygonMode = VK_POLYGON_MODE_LINE;
+        rasterizer.lineWidth = 1.5f;
+        if (vkCreateGraphicsPipelines(veekay::app.vk_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr,
+                                      &app_state.wireframePipelines[shadowFilter]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create wireframe pipeline!");
+        }
     }
 
     VkPipelineShaderStageCreateInfo shadowStages[2]{};
@@ -860,24 +1978,11 @@ void init(VkCommandBuffer cmd) {
     shadowInputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
     shadowInputAssembly.primitiveRestartEnable = VK_FALSE;
 
-    VkViewport shadowViewport{};
-    shadowViewport.x = 0.0f;
-    shadowViewport.y = 0.0f;
-    shadowViewport.width = static_cast<float>(kShadowMapSize);
-    shadowViewport.height = static_cast<float>(kShadowMapSize);
-    shadowViewport.minDepth = 0.0f;
-    shadowViewport.maxDepth = 1.0f;
-
-    VkRect2D shadowScissor{};
-    shadowScissor.offset = {0, 0};
-    shadowScissor.extent = {kShadowMapSize, kShadowMapSize};
-
+    // Dynamic, the shadow map size changes at runtime.
     VkPipelineViewportStateCreateInfo shadowViewportState{};
     shadowViewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
     shadowViewportState.viewportCount = 1;
-    shadowViewportState.pViewports = &shadowViewport;
     shadowViewportState.scissorCount = 1;
-    shadowViewportState.pScissors = &shadowScissor;
 
     VkPipelineRasterizationStateCreateInfo shadowRaster{};
     shadowRaster.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -913,7 +2018,6 @@ void init(VkCommandBuffer cmd) {
     renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
     renderingInfo.colorAttachmentCount = 0;
     renderingInfo.pColorAttachmentFormats = nullptr;
-    renderingInfo.depthAttachmentFormat = getShadowDepthFormat();
     renderingInfo.stencilAttachmentFormat = VK_FORMAT_UNDEFINED;
 
     VkGraphicsPipelineCreateInfo shadowPipelineInfo{};
@@ -927,75 +2031,91 @@ void init(VkCommandBuffer cmd) {
     shadowPipelineInfo.pMultisampleState = &shadowMs;
     shadowPipelineInfo.pDepthStencilState = &shadowDepth;
     shadowPipelineInfo.pColorBlendState = &shadowBlend;
+    shadowPipelineInfo.pDynamicState = &dynamicState;
     shadowPipelineInfo.layout = app_state.pipelineLayout;
     shadowPipelineInfo.renderPass = VK_NULL_HANDLE;
     shadowPipelineInfo.subpass = 0;
     shadowPipelineInfo.pNext = &renderingInfo;
 
-    if (vkCreateGraphicsPipelines(veekay::app.vk_device, VK_NULL_HANDLE, 1, &shadowPipelineInfo, nullptr, &app_state.shadowPipeline) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create shadow pipeline!");
+    // Multiview renders every cascade in one pass, gl_ViewIndex picks the cascade matrix.
+    for (int format = 0; format < kShadowFormatCount; ++format) {
+        renderingInfo.depthAttachmentFormat = kShadowFormats[format];
+        for (uint32_t count = kMinCascades; count <= kMaxCascades; ++count) {
+            renderingInfo.viewMask = (1u << count) - 1;
+            if (vkCreateGraphicsPipelines(veekay::app.vk_device, VK_NULL_HANDLE, 1, &shadowPipelineInfo, nullptr,
+                                          &app_state.shadowPipelines[format][count - kMinCascades]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create shadow pipeline!");
+            }
+        }
+    }
+
+    if (app_state.atlasVertexShaderModule) {
+        shadowStages[0].module = app_state.atlasVertexShaderModule;
+        shadowViewportState.viewportCount = 6; // set per light
+        shadowViewportState.scissorCount = 6;
+        renderingInfo.depthAttachmentFormat = kAtlasDepthFormat;
+        renderingInfo.viewMask = 0;
+        if (vkCreateGraphicsPipelines(veekay::app.vk_device, VK_NULL_HANDLE, 1, &shadowPipelineInfo, nullptr,
+                                      &app_state.atlasPipeline) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create shadow atlas pipeline!");
+        }
+    }
+
+    if (app_state.evsmShaderModule) {
+        createEvsmPipeline();
     }
     
-    std::array<VkDescriptorPoolSize, 3> poolSizes{};
+    // Three sets (sphere, plane, stress objects) per frame in flight.
+    const uint32_t setCount = 3 * veekay::app.frames_in_flight;
+
+    std::array<VkDescriptorPoolSize, 4> poolSizes{};
     poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSizes[0].descriptorCount = 8; 
+    poolSizes[0].descriptorCount = 4 * setCount; 
     poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    poolSizes[1].descriptorCount = 4; 
+    poolSizes[1].descriptorCount = 5 * setCount; 
     poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[2].descriptorCount = 4;
+    poolSizes[2].descriptorCount = 6 * setCount;
+    poolSizes[3].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    poolSizes[3].descriptorCount = setCount;
     
     VkDescriptorPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
     poolInfo.pPoolSizes = poolSizes.data();
-    poolInfo.maxSets = 2;
+    poolInfo.maxSets = setCount;
     
     if (vkCreateDescriptorPool(veekay::app.vk_device, &poolInfo, nullptr, &app_state.descriptorPool) != VK_SUCCESS) {
         throw std::runtime_error("failed to create descriptor pool!");
     }
     
-    VkDescriptorSetAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    allocInfo.descriptorPool = app_state.descriptorPool;
-    std::array<VkDescriptorSetLayout, 2> setLayouts = {app_state.descriptorSetLayout, app_state.descriptorSetLayout};
-    allocInfo.descriptorSetCount = static_cast<uint32_t>(setLayouts.size());
-    allocInfo.pSetLayouts = setLayouts.data();
-    
-    std::array<VkDescriptorSet, 2> descriptorSets{};
-    if (vkAllocateDescriptorSets(veekay::app.vk_device, &allocInfo, descriptorSets.data()) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate descriptor sets!");
-    }
-    app_state.descriptorSetSphere = descriptorSets[0];
-    app_state.descriptorSetPlane = descriptorSets[1];
-    
-    auto writeDescriptorSet = [&](VkDescriptorSet dstSet, VkBuffer uboBuffer) {
+    auto writeDescriptorSet = [&](VkDescriptorSet dstSet, VkBuffer uboBuffer, const FrameResources& res) {
         VkDescriptorBufferInfo uboInfo{};
         uboInfo.buffer = uboBuffer;
         uboInfo.offset = 0;
         uboInfo.range = sizeof(UniformBufferObject);
 
         VkDescriptorBufferInfo materialInfo{};
-        materialInfo.buffer = app_state.materialBuffer;
+        materialInfo.buffer = res.materialBuffer->buffer;
         materialInfo.offset = 0;
         materialInfo.range = sizeof(MaterialData);
 
         VkDescriptorBufferInfo dirLightInfo{};
-        dirLightInfo.buffer = app_state.directionalLightBuffer;
+        dirLightInfo.buffer = res.directionalLightBuffer->buffer;
         dirLightInfo.offset = 0;
         dirLightInfo.range = sizeof(DirectionalLightData);
 
         VkDescriptorBufferInfo pointInfo{};
-        pointInfo.buffer = app_state.pointLightBuffer;
+        pointInfo.buffer = res.pointLightBuffer->buffer;
         pointInfo.offset = 0;
         pointInfo.range = sizeof(PointLightData) * kMaxPointLights;
 
         VkDescriptorBufferInfo spotInfo{};
-        spotInfo.buffer = app_state.spotLightBuffer;
+        spotInfo.buffer = res.spotLightBuffer->buffer;
         spotInfo.offset = 0;
         spotInfo.range = sizeof(SpotLightData) * kMaxSpotLights;
 
         VkDescriptorBufferInfo countsInfo{};
-        countsInfo.buffer = app_state.lightCountBuffer;
+        countsInfo.buffer = res.lightCountBuffer->buffer;
         countsInfo.offset = 0;
         countsInfo.range = sizeof(LightCounts);
 
@@ -1004,17 +2124,43 @@ void init(VkCommandBuffer cmd) {
         imageInfo.imageView = app_state.texture ? app_state.texture->view : VK_NULL_HANDLE;
         imageInfo.sampler = app_state.textureSampler;
 
-        VkDescriptorImageInfo shadowInfo{};
-        shadowInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL;
-        shadowInfo.imageView = app_state.shadowImageView;
-        shadowInfo.sampler = app_state.shadowSampler;
+        VkDescriptorBufferInfo cascadeInfo{};
+        cascadeInfo.buffer = res.cascadeBuffer->buffer;
+        cascadeInfo.offset = 0;
+        cascadeInfo.range = sizeof(ShadowCascadeData);
+
+        VkDescriptorImageInfo atlasImageInfo{};
+        atlasImageInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL;
+        atlasImageInfo.imageView = app_state.atlasImageView;
+        atlasImageInfo.sampler = app_state.shadowSampler;
+
+        VkDescriptorBufferInfo atlasInfo{};
+        atlasInfo.buffer = res.atlasBuffer->buffer;
+        atlasInfo.offset = 0;
+        atlasInfo.range = sizeof(ShadowAtlasEntry) * kAtlasBufferEntries;
 
-        std::array<VkWriteDescriptorSet, 8> descriptorWrites{};
+        VkDescriptorImageInfo vsmImageInfo{};
+        vsmImageInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL;
+        vsmImageInfo.imageView = app_state.vsmImageView;
+        vsmImageInfo.sampler = app_state.shadowSampler;
+
+        VkDescriptorBufferInfo pageTableInfo{};
+        pageTableInfo.buffer = res.vsmPageTableBuffer->buffer;
+        pageTableInfo.offset = 0;
+        pageTableInfo.range = sizeof(uint32_t) * kVsmTableSize * kVsmTableSize;
+
+        VkDescriptorBufferInfo requestInfo{};
+        requestInfo.buffer = res.vsmRequestBuffer->buffer;
+        requestInfo.offset = 0;
+        requestInfo.range = sizeof(uint32_t) * kVsmRequestWords;
+
+        // Shadow map bindings (7, 11, 12) come from writeShadowDescriptors().
+        std::array<VkWriteDescriptorSet, 13> descriptorWrites{};
 
         descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         descriptorWrites[0].dstSet = dstSet;
         descriptorWrites[0].dstBinding = 0;
-        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
         descriptorWrites[0].descriptorCount = 1;
         descriptorWrites[0].pBufferInfo = &uboInfo;
 
@@ -1062,31 +2208,120 @@ void init(VkCommandBuffer cmd) {
 
         descriptorWrites[7].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         descriptorWrites[7].dstSet = dstSet;
-        descriptorWrites[7].dstBinding = 7;
-        descriptorWrites[7].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrites[7].dstBinding = 8;
+        descriptorWrites[7].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
         descriptorWrites[7].descriptorCount = 1;
-        descriptorWrites[7].pImageInfo = &shadowInfo;
+        descriptorWrites[7].pBufferInfo = &cascadeInfo;
+
+        descriptorWrites[8].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[8].dstSet = dstSet;
+        descriptorWrites[8].dstBinding = 9;
+        descriptorWrites[8].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrites[8].descriptorCount = 1;
+        descriptorWrites[8].pImageInfo = &atlasImageInfo;
+
+        descriptorWrites[9].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[9].dstSet = dstSet;
+        descriptorWrites[9].dstBinding = 10;
+        descriptorWrites[9].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[9].descriptorCount = 1;
+        descriptorWrites[9].pBufferInfo = &atlasInfo;
+
+        descriptorWrites[10].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[10].dstSet = dstSet;
+        descriptorWrites[10].dstBinding = 13;
+        descriptorWrites[10].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrites[10].descriptorCount = 1;
+        descriptorWrites[10].pImageInfo = &vsmImageInfo;
+
+        descriptorWrites[11].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[11].dstSet = dstSet;
+        descriptorWrites[11].dstBinding = 14;
+        descriptorWrites[11].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[11].descriptorCount = 1;
+        descriptorWrites[11].pBufferInfo = &pageTableInfo;
+
+        descriptorWrites[12].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[12].dstSet = dstSet;
+        descriptorWrites[12].dstBinding = 15;
+        descriptorWrites[12].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[12].descriptorCount = 1;
+        descriptorWrites[12].pBufferInfo = &requestInfo;
 
         vkUpdateDescriptorSets(veekay::app.vk_device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
     };
 
-    writeDescriptorSet(app_state.descriptorSetSphere, app_state.uniformBuffer);
-    writeDescriptorSet(app_state.descriptorSetPlane, app_state.planeUniformBuffer);
+    for (uint32_t i = 0; i < veekay::app.frames_in_flight; ++i) {
+        FrameResources& res = app_state.frames[i];
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = app_state.descriptorPool;
+        std::array<VkDescriptorSetLayout, 3> setLayouts;
+        setLayouts.fill(app_state.descriptorSetLayout);
+        allocInfo.descriptorSetCount = static_cast<uint32_t>(setLayouts.size());
+        allocInfo.pSetLayouts = setLayouts.data();
+
+        std::array<VkDescriptorSet, 3> descriptorSets{};
+        if (vkAllocateDescriptorSets(veekay::app.vk_device, &allocInfo, descriptorSets.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate descriptor sets!");
+        }
+        res.descriptorSetSphere = descriptorSets[0];
+        res.descriptorSetPlane = descriptorSets[1];
+        res.descriptorSetStress = descriptorSets[2];
+
+        writeDescriptorSet(res.descriptorSetSphere, res.uniformBuffer->buffer, res);
+        writeDescriptorSet(res.descriptorSetPlane, res.planeUniformBuffer->buffer, res);
+        writeDescriptorSet(res.descriptorSetStress, res.stressUniformBuffer->buffer, res);
+        writeShadowDescriptors(res);
+
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = veekay::app.graphics_queue_family;
+        if (vkCreateCommandPool(veekay::app.vk_device, &poolInfo, nullptr, &res.staticCommandPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create static command pool!");
+        }
+
+        VkCommandBufferAllocateInfo commandInfo{};
+        commandInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        commandInfo.commandPool = res.staticCommandPool;
+        commandInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        commandInfo.commandBufferCount = 2;
+        VkCommandBuffer staticCommands[2];
+        if (vkAllocateCommandBuffers(veekay::app.vk_device, &commandInfo, staticCommands) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate static command buffers!");
+        }
+        res.staticShadowCommands = staticCommands[0];
+        res.staticSceneCommands = staticCommands[1];
+    }
     
     std::cout << "Initialization complete!" << std::endl;
 }
 
 void shutdown() {
     vkDestroyDescriptorPool(veekay::app.vk_device, app_state.descriptorPool, nullptr);
-    vkDestroyPipeline(veekay::app.vk_device, app_state.graphicsPipeline, nullptr);
-    vkDestroyPipeline(veekay::app.vk_device, app_state.wireframePipeline, nullptr);
-    vkDestroyPipeline(veekay::app.vk_device, app_state.shadowPipeline, nullptr);
+    for (int i = 0; i < kShadowFilterCount; ++i) {
+        vkDestroyPipeline(veekay::app.vk_device, app_state.graphicsPipelines[i], nullptr);
+        vkDestroyPipeline(veekay::app.vk_device, app_state.wireframePipelines[i], nullptr);
+    }
+    vkDestroyDescriptorPool(veekay::app.vk_device, app_state.evsmDescriptorPool, nullptr);
+    vkDestroyPipeline(veekay::app.vk_device, app_state.evsmPipeline, nullptr);
+    vkDestroyPipelineLayout(veekay::app.vk_device, app_state.evsmPipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(veekay::app.vk_device, app_state.evsmSetLayout, nullptr);
+    vkDestroyShaderModule(veekay::app.vk_device, app_state.evsmShaderModule, nullptr);
+    for (const auto& pipelines : app_state.shadowPipelines) {
+        for (VkPipeline pipeline : pipelines) {
+            vkDestroyPipeline(veekay::app.vk_device, pipeline, nullptr);
+        }
+    }
+    vkDestroyPipeline(veekay::app.vk_device, app_state.atlasPipeline, nullptr);
     vkDestroyPipelineLayout(veekay::app.vk_device, app_state.pipelineLayout, nullptr);
     vkDestroyDescriptorSetLayout(veekay::app.vk_device, app_state.descriptorSetLayout, nullptr);
     vkDestroyShaderModule(veekay::app.vk_device, app_state.fragmentShaderModule, nullptr);
     vkDestroyShaderModule(veekay::app.vk_device, app_state.vertexShaderModule, nullptr);
     vkDestroyShaderModule(veekay::app.vk_device, app_state.shadowFragmentShaderModule, nullptr);
     vkDestroyShaderModule(veekay::app.vk_device, app_state.shadowVertexShaderModule, nullptr);
+    vkDestroyShaderModule(veekay::app.vk_device, app_state.atlasVertexShaderModule, nullptr);
     if (app_state.texture) {
         delete app_state.texture;
         app_state.texture = nullptr;
@@ -1097,41 +2332,44 @@ void shutdown() {
     if (app_state.shadowSampler != VK_NULL_HANDLE) {
         vkDestroySampler(veekay::app.vk_device, app_state.shadowSampler, nullptr);
     }
-    if (app_state.shadowImageView != VK_NULL_HANDLE) {
-        vkDestroyImageView(veekay::app.vk_device, app_state.shadowImageView, nullptr);
+    vkDestroySampler(veekay::app.vk_device, app_state.shadowDepthSampler, nullptr);
+    vkDestroySampler(veekay::app.vk_device, app_state.shadowMomentsSampler, nullptr);
+    for (const ImageArray& images : currentShadowMaps()) {
+        destroyImageArray(images);
     }
-    if (app_state.shadowImage != VK_NULL_HANDLE) {
-        vkDestroyImage(veekay::app.vk_device, app_state.shadowImage, nullptr);
-    }
-    if (app_state.shadowImageMemory != VK_NULL_HANDLE) {
-        vkFreeMemory(veekay::app.vk_device, app_state.shadowImageMemory, nullptr);
-    }
-    vkDestroyBuffer(veekay::app.vk_device, app_state.lightCountBuffer, nullptr);
-    vkFreeMemory(veekay::app.vk_device, app_state.lightCountBufferMemory, nullptr);
-    vkDestroyBuffer(veekay::app.vk_device, app_state.spotLightBuffer, nullptr);
-    vkFreeMemory(veekay::app.vk_device, app_state.spotLightBufferMemory, nullptr);
-    vkDestroyBuffer(veekay::app.vk_device, app_state.pointLightBuffer, nullptr);
-    vkFreeMemory(veekay::app.vk_device, app_state.pointLightBufferMemory, nullptr);
-    vkDestroyBuffer(veekay::app.vk_device, app_state.directionalLightBuffer, nullptr);
-    vkFreeMemory(veekay::app.vk_device, app_state.directionalLightBufferMemory, nullptr);
-    vkDestroyBuffer(veekay::app.vk_device, app_state.materialBuffer, nullptr);
-    vkFreeMemory(veekay::app.vk_device, app_state.materialBufferMemory, nullptr);
-    vkDestroyBuffer(veekay::app.vk_device, app_state.uniformBuffer, nullptr);
-    vkFreeMemory(veekay::app.vk_device, app_state.uniformBufferMemory, nullptr);
-    vkDestroyBuffer(veekay::app.vk_device, app_state.planeUniformBuffer, nullptr);
-    vkFreeMemory(veekay::app.vk_device, app_state.planeUniformBufferMemory, nullptr);
-    vkDestroyBuffer(veekay::app.vk_device, app_state.indexBuffer, nullptr);
-    vkFreeMemory(veekay::app.vk_device, app_state.indexBufferMemory, nullptr);
-    vkDestroyBuffer(veekay::app.vk_device, app_state.vertexBuffer, nullptr);
-    vkFreeMemory(veekay::app.vk_device, app_state.vertexBufferMemory, nullptr);
-    vkDestroyBuffer(veekay::app.vk_device, app_state.planeIndexBuffer, nullptr);
-    vkFreeMemory(veekay::app.vk_device, app_state.planeIndexBufferMemory, nullptr);
-    vkDestroyBuffer(veekay::app.vk_device, app_state.planeVertexBuffer, nullptr);
-    vkFreeMemory(veekay::app.vk_device, app_state.planeVertexBufferMemory, nullptr);
+    if (app_state.atlasImageView != VK_NULL_HANDLE) {
+        vkDestroyImageView(veekay::app.vk_device, app_state.atlasImageView, nullptr);
+    }
+    if (app_state.atlasImage != VK_NULL_HANDLE) {
+        vkDestroyImage(veekay::app.vk_device, app_state.atlasImage, nullptr);
+    }
+    if (app_state.atlasImageMemory != VK_NULL_HANDLE) {
+        vkFreeMemory(veekay::app.vk_device, app_state.atlasImageMemory, nullptr);
+    }
+    destroyImageArray({app_state.vsmImage, app_state.vsmImageMemory, app_state.vsmImageView});
+    for (FrameResources& res : app_state.frames) {
+        vkDestroyCommandPool(veekay::app.vk_device, res.staticCommandPool, nullptr);
+        delete res.cascadeBuffer;
+        delete res.atlasBuffer;
+        delete res.vsmPageTableBuffer;
+        delete res.vsmRequestBuffer;
+        delete res.lightCountBuffer;
+        delete res.spotLightBuffer;
+        delete res.pointLightBuffer;
+        delete res.directionalLightBuffer;
+        delete res.materialBuffer;
+        delete res.uniformBuffer;
+        delete res.planeUniformBuffer;
+        delete res.stressUniformBuffer;
+        res = FrameResources{};
+    }
+    delete app_state.geometry;
+    app_state.geometry = nullptr;
 }
 
-void update(double time) {
-    
+void update(const veekay::FrameContext& frame, double time) {
+    FrameResources& res = app_state.frames[frame.index];
+
     float deltaTime = 0.0f;
     if (app_state.lastTime > 0.0) {
         deltaTime = static_cast<float>(time - app_state.lastTime);
@@ -1173,6 +2411,29 @@ void update(double time) {
     auto scroll = mouse::scrollDelta();
     app_state.fov = std::clamp(app_state.fov - scroll.y * 1.2f, 30.0f, 90.0f);
 
+    if (app_state.benchmarkEnabled) {
+        updateBenchmark(frame.number);
+    }
+
+    if (app_state.qualityGovernor) {
+        updateQualityGovernor();
+    }
+
+    // render() could not allocate the requested shadow maps, fall back to the ones it kept.
+    // The rejection stays until the user picks another setting, so the UI can show it.
+    uint32_t shadowMapRequest = packShadowMapSetting(app_state.shadowMapSize, app_state.shadowFormat);
+    if (shadowMapRequest == app_state.shadowMapRejected.load()) {
+        uint32_t live = app_state.shadowMapLive.load();
+        app_state.shadowMapSize = shadowMapSettingSize(live);
+        app_state.shadowFormat = shadowMapSettingFormat(live);
+    }
+
+    // With --on-demand frames stop once nothing moves; key repeat alone is too slow for smooth motion.
+    if (app_state.autoRotate || app_state.benchmarkEnabled || app_state.mouseCaptured ||
+        glm::length(moveDir) > 0.0001f) {
+        veekay::requestRedraw();
+    }
+
     ImGui::Begin("Controls");
     ImGui::Text("=== Camera (WASD/Space/Ctrl + RMB look) ===");
     ImGui::SliderFloat("Move speed", &app_state.baseMoveSpeed, 0.5f, 20.0f, "%.2f");
@@ -1200,8 +2461,178 @@ void update(double time) {
     ImGui::Checkbox("Wireframe Mode", &app_state.wireframeMode);
     ImGui::Text("(Show edges/faces)");
     ImGui::Checkbox("Enable shadows", &app_state.enableShadows);
+    ImGui::Combo("Shadow filter", &app_state.shadowFilter, kShadowFilterNames, IM_ARRAYSIZE(kShadowFilterNames));
+    if (app_state.shadowFilter == static_cast<int>(ShadowFilter::pcss)) {
+        ImGui::SliderFloat("Light size", &app_state.pcssLightSize, 0.005f, 0.2f, "%.3f");
+    }
+    if (app_state.shadowFilter == static_cast<int>(ShadowFilter::evsm) && app_state.evsmPipeline == VK_NULL_HANDLE) {
+        ImGui::Text("evsm_comp.spv missing, using pcf");
+    }
+    ImGui::SliderInt("Cascades", &app_state.cascadeCount, static_cast<int>(kMinCascades), static_cast<int>(kMaxCascades));
+    ImGui::SliderFloat("Shadow distance", &app_state.shadowDistance, 5.0f, kCameraFar, "%.1f");
+    ImGui::SliderFloat("Split lambda", &app_state.cascadeSplitLambda, 0.0f, 1.0f, "%.2f");
+    ImGui::SliderFloat("Cascade blend", &app_state.cascadeBlend, 0.0f, 0.5f, "%.2f");
+    ImGui::Checkbox("Show cascades", &app_state.showCascades);
+    ImGui::Checkbox("Cache shadow map", &app_state.shadowCaching);
+    if (app_state.shadowCaching) {
+        ImGui::Text("Static layer redrawn %u times, pass skipped %u times",
+                    app_state.shadowStaticRenders.load(), app_state.shadowSkips.load());
+    }
     ImGui::Checkbox("Plane casts shadow", &app_state.planeCastsShadow);
 
+    // Labels carry what each choice costs, so the tradeoff is visible before picking it.
+    {
+        char label[64];
+        auto sizeLabel = [&](uint32_t size) {
+            std::snprintf(label, sizeof(label), "%u (%.1f MB)", size,
+                          shadowMapMemory(size, app_state.shadowFormat) / (1024.0 * 1024.0));
+            return label;
+        };
+        if (ImGui::BeginCombo("Shadow map size", sizeLabel(app_state.shadowMapSize))) {
+            for (uint32_t size = kMinShadowMapSize; size <= app_state.maxShadowMapSize; size *= 2) {
+                if (ImGui::Selectable(sizeLabel(size), size == app_state.shadowMapSize)) {
+                    selectShadowMap(size, app_state.shadowFormat);
+                }
+            }
+            ImGui::EndCombo();
+        }
+
+        auto formatLabel = [&](int format) {
+            std::snprintf(label, sizeof(label), "%s (%.1f MB)", kShadowFormatNames[format],
+                          shadowMapMemory(app_state.shadowMapSize, format) / (1024.0 * 1024.0));
+            return label;
+        };
+        if (ImGui::BeginCombo("Shadow format", formatLabel(app_state.shadowFormat))) {
+            for (int format = 0; format < kShadowFormatCount; ++format) {
+                if (ImGui::Selectable(formatLabel(format), format == app_state.shadowFormat)) {
+                    selectShadowMap(app_state.shadowMapSize, format);
+                }
+            }
+            ImGui::EndCombo();
+        }
+
+        // Depth written per redraw of the active cascades; a cached map also copies the static layer in.
+        double written = double(app_state.shadowMapSize) * app_state.shadowMapSize * app_state.cascadeCount *
+                         kShadowFormatBytes[app_state.shadowFormat];
+        if (app_state.shadowCaching) {
+            written *= 2.0;
+        }
+        ImGui::Text("Shadow maps: %.1f MB, %.1f MB written per redraw",
+                    shadowMapMemory(app_state.shadowMapSize, app_state.shadowFormat) / (1024.0 * 1024.0),
+                    written / (1024.0 * 1024.0));
+        if (app_state.shadowMapRejected.load() != 0) {
+            uint32_t rejected = app_state.shadowMapRejected.load();
+            ImGui::Text("%ux%u %s did not fit in memory", shadowMapSettingSize(rejected), shadowMapSettingSize(rejected),
+                        kShadowFormatNames[shadowMapSettingFormat(rejected)]);
+        }
+    }
+
+    ImGui::Checkbox("Cull shadow casters", &app_state.shadowCulling);
+    ImGui::Text("Shadow casters: %u of %u views drawn", app_state.shadowCasterViewsDrawn, app_state.shadowCasterViews);
+    if (app_state.atlasPipeline != VK_NULL_HANDLE) {
+        ImGui::Checkbox("Spot/point light shadows", &app_state.localShadows);
+        ImGui::Text("Shadow atlas: %u lights, %.0f%% of %ux%u used", app_state.atlasShadowedLights,
+                    100.0 * static_cast<double>(app_state.shadowAtlas.usedArea()) / (double(kShadowAtlasSize) * kShadowAtlasSize),
+                    kShadowAtlasSize, kShadowAtlasSize);
+        ImGui::Checkbox("Virtual shadow map", &app_state.virtualShadows);
+        if (app_state.virtualShadows) {
+            ImGui::Text("Virtual shadow map: %u of %u pages resident, %u rendered last frame",
+                        app_state.vsmResidentPages.load(std::memory_order_relaxed), kVsmPoolPages * kVsmPoolPages,
+                        app_state.vsmPageRenders.load(std::memory_order_relaxed));
+        }
+    }
+
+    int presentMode = static_cast<int>(veekay::app.present_mode);
+    if (ImGui::Combo("Present mode", &presentMode, kPresentModeNames, IM_ARRAYSIZE(kPresentModeNames))) {
+        veekay::setPresentMode(static_cast<veekay::PresentMode>(presentMode));
+    }
+
+    if (app_state.lowLatency) {
+        ImGui::Checkbox("Late camera update", &app_state.lateCameraUpdate);
+    }
+
+    ImGui::Text("Compute queue: family %u (%s)", veekay::compute::queueFamily(),
+                veekay::compute::isAsync() ? "separate, unused" : "shared with graphics");
+
+    bool showProfiler = veekay::profiler::isOverlayVisible();
+    if (ImGui::Checkbox("Show profiler", &showProfiler)) {
+        veekay::profiler::setOverlayVisible(showProfiler);
+    }
+
+    if (veekay::resolution::isEnabled()) {
+        ImGui::Separator();
+        ImGui::Text("=== Dynamic resolution ===");
+
+        veekay::resolution::Status drs = veekay::resolution::status();
+
+        bool dynamic = veekay::resolution::isDynamic();
+        if (ImGui::Checkbox("Adapt to GPU time", &dynamic)) {
+            veekay::resolution::setDynamic(dynamic);
+        }
+
+        float targetMs = static_cast<float>(drs.target_ms);
+        if (ImGui::SliderFloat("Target GPU ms", &targetMs, 4.0f, 50.0f, "%.1f")) {
+            veekay::resolution::setTargetFrameTime(targetMs);
+        }
+
+        float scale = drs.scale;
+        ImGui::BeginDisabled(dynamic);
+        if (ImGui::SliderFloat("Scale", &scale, veekay::resolution::min_scale, veekay::resolution::max_scale, "%.2f")) {
+            veekay::resolution::setScale(scale);
+        }
+        ImGui::EndDisabled();
+
+        float sharpness = veekay::resolution::sharpness();
+        if (ImGui::SliderFloat("Sharpness", &sharpness, 0.0f, 1.0f, "%.2f")) {
+            veekay::resolution::setSharpness(sharpness);
+        }
+
+        ImGui::Text("Scene %ux%u of %ux%u (%.0f%%)", drs.width, drs.height,
+                    veekay::app.window_width, veekay::app.window_height, drs.scale * 100.0f);
+        ImGui::Text("GPU %.2f / %.2f ms, %s", drs.gpu_ms, drs.target_ms,
+                    veekay::resolution::controllerStateName(drs.state));
+    }
+
+    ImGui::Separator();
+    ImGui::Text("=== Quality ===");
+    if (ImGui::Checkbox("Quality governor", &app_state.qualityGovernor) && app_state.qualityGovernor) {
+        applyQualityTier(app_state.governor.tier());
+    }
+    float qualityBudget = static_cast<float>(app_state.governor.budget());
+    if (ImGui::SliderFloat("Frame budget (ms)", &qualityBudget, 4.0f, 50.0f, "%.1f")) {
+        app_state.governor.setBudget(qualityBudget);
+    }
+    int qualityTier = app_state.governor.tier();
+    const char* tierNames[std::size(kQualityTiers)];
+    for (size_t i = 0; i < std::size(kQualityTiers); ++i) {
+        tierNames[i] = kQualityTiers[i].name;
+    }
+    if (ImGui::Combo("Quality tier", &qualityTier, tierNames, static_cast<int>(std::size(kQualityTiers)))) {
+        app_state.governor.setTier(qualityTier);
+        applyQualityTier(qualityTier);
+    }
+    if (app_state.qualityGovernor) {
+        ImGui::Text("Smoothed CPU %.2f ms, GPU %.2f ms",
+                    app_state.governor.smoothedCpuMs(), app_state.governor.smoothedGpuMs());
+    }
+    ImGui::SliderInt("Max point lights", &app_state.maxPointLights, 0, static_cast<int>(kMaxPointLights));
+    ImGui::SliderInt("Max spot lights", &app_state.maxSpotLights, 0, static_cast<int>(kMaxSpotLights));
+
+    ImGui::Separator();
+    ImGui::Text("=== Stress test ===");
+    ImGui::SliderInt("Stress objects", &app_state.stressObjects, 0, static_cast<int>(kMaxStressObjects));
+    int threads = static_cast<int>(veekay::parallel::threadCount());
+    if (ImGui::SliderInt("Recording threads", &threads, 1, static_cast<int>(veekay::parallel::maxThreadCount()))) {
+        veekay::parallel::setThreadCount(static_cast<uint32_t>(threads));
+    }
+    ImGui::SliderInt("Sphere segments", &app_state.sphereSegments, kMinSphereSegments, kMaxSphereSegments);
+    ImGui::Text("Pending deletions: %zu", veekay::deletion::pendingCount());
+    ImGui::Checkbox("Reuse recorded commands", &app_state.staticCommands);
+    if (app_state.staticCommands) {
+        ImGui::Text("Scene version %llu, recorded %u times",
+                    static_cast<unsigned long long>(app_state.sceneVersion), app_state.staticRecordings.load());
+    }
+
     ImGui::Separator();
     ImGui::Text("=== Fill Light (camera) ===");
     ImGui::Checkbox("Enable fill light", &app_state.enableFillLight);
@@ -1229,9 +2660,7 @@ void update(double time) {
     ImGui::Text("=== Point Lights ===");
     int desiredPoint = static_cast<int>(app_state.pointLights.size());
     if (ImGui::SliderInt("Point count", &desiredPoint, 0, static_cast<int>(kMaxPointLights))) {
-        desiredPoint = std::clamp(desiredPoint, 0, static_cast<int>(kMaxPointLights));
-        PointLightData def{glm::vec4(0.0f, 1.0f, 0.0f, 15.0f), glm::vec4(1.0f, 1.0f, 1.0f, 5.0f)};
-        app_state.pointLights.resize(desiredPoint, def);
+        setPointLightCount(desiredPoint);
     }
     for (size_t i = 0; i < app_state.pointLights.size(); ++i) {
         ImGui::PushID(static_cast<int>(i));
@@ -1247,13 +2676,7 @@ void update(double time) {
     ImGui::Text("=== Spot Lights ===");
     int desiredSpot = static_cast<int>(app_state.spotLights.size());
     if (ImGui::SliderInt("Spot count", &desiredSpot, 0, static_cast<int>(kMaxSpotLights))) {
-        desiredSpot = std::clamp(desiredSpot, 0, static_cast<int>(kMaxSpotLights));
-        SpotLightData def{
-            glm::vec4(0.0f, 2.0f, 2.0f, 20.0f),
-            glm::vec4(0.0f, -1.0f, 0.0f, glm::cos(glm::radians(12.5f))),
-            glm::vec4(1.0f, 1.0f, 1.0f, glm::cos(glm::radians(17.5f)))
-        };
-        app_state.spotLights.resize(desiredSpot, def);
+        setSpotLightCount(desiredSpot);
     }
     for (size_t i = 0; i < app_state.spotLights.size(); ++i) {
         ImGui::PushID(static_cast<int>(100 + i));
@@ -1299,17 +2722,47 @@ void update(double time) {
 
     float aspect = static_cast<float>(veekay::app.window_width) / static_cast<float>(veekay::app.window_height);
     if (aspect <= 0.0f) aspect = 1.0f;
-    glm::mat4 projectionMatrix = glm::perspectiveRH_ZO(glm::radians(app_state.fov), aspect, 0.1f, 100.0f);
+    glm::mat4 projectionMatrix = glm::perspectiveRH_ZO(glm::radians(app_state.fov), aspect, kCameraNear, kCameraFar);
     projectionMatrix[1][1] *= -1.0f; // flip Y for Vulkan
 
     glm::vec3 lightDir = glm::normalize(-glm::vec3(app_state.dirLight.directionIntensity));
-    glm::vec3 lightPos = lightDir * 20.0f;
-    glm::mat4 lightView = glm::lookAt(lightPos, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-    glm::mat4 lightProj = glm::orthoRH_ZO(-18.0f, 18.0f, -18.0f, 18.0f, 0.1f, 40.0f);
-    lightProj[1][1] *= -1.0f; // flip Y for Vulkan
-    glm::mat4 lightSpaceMatrix = lightProj * lightView;
+    ShadowCascadeData cascades = computeShadowCascades(lightDir, aspect, kCameraNear);
+    res.virtualShadows = app_state.enableShadows && app_state.virtualShadows && app_state.atlasPipeline != VK_NULL_HANDLE;
+    if (res.virtualShadows) {
+        res.vsmKey.planeCastsShadow = app_state.planeCastsShadow;
+        res.vsmKey.planeModel = planeModel;
+        cascades.vsmViewProj = fitVirtualShadowMap(lightDir, res.vsmKey, res.vsmOrigin);
+        cascades.vsmPages = glm::ivec4(kVsmTableSize, res.vsmOrigin.x, res.vsmOrigin.y, kVsmPoolPages);
+        float texel = res.vsmKey.pageWorld / static_cast<float>(kVsmPageSize);
+        cascades.vsmParams = glm::vec4(1.5f * texel / (res.vsmKey.depthFar - res.vsmKey.depthNear), 0.0f, 0.0f, 0.0f);
+    }
+    memcpy(res.cascadeBuffer->mapped_region, &cascades, sizeof(cascades));
+
+    // Casters are culled per cascade and per atlas face. Only casters whose shadow can reach the visible
+    // part of the cascades count, receivers outside the camera frustum do not keep them.
+    glm::mat4 cameraViewProj = projectionMatrix * viewMatrix;
+    glm::mat4 shadowedViewProj = glm::perspectiveRH_ZO(glm::radians(app_state.fov), aspect, kCameraNear,
+                                                       std::max(app_state.shadowDistance, kCameraNear * 2.0f)) * viewMatrix;
+    Frustum shadowedView = extractFrustum(shadowedViewProj);
+    BoundingSphere casters[2] = {transformBounds(app_state.sphereBounds, sphereModel),
+                                 transformBounds(app_state.planeBounds, planeModel)};
+    uint32_t casterCount = app_state.planeCastsShadow ? 2 : 1;
+
+    app_state.shadowCasterViews = 0;
+    app_state.shadowCasterViewsDrawn = 0;
+    uint32_t cascadeMasks[2] = {0, 0};
+    if (app_state.enableShadows) {
+        uint32_t cascadeCount = static_cast<uint32_t>(app_state.cascadeCount);
+        for (uint32_t c = 0; c < casterCount; ++c) {
+            if (app_state.shadowCulling && !shadowReaches(shadowedView, casters[c], -lightDir)) {
+                app_state.shadowCasterViews += cascadeCount;
+                continue;
+            }
+            cascadeMasks[c] = casterViewMask(casters[c], cascades.viewProj, cascadeCount);
+        }
+    }
 
-    auto writeUbo = [&](const glm::mat4& model, VkDeviceMemory memory) {
+    auto writeUbo = [&](const glm::mat4& model, uint32_t shadowMask, void* dst) {
         glm::mat3 normal3 = glm::transpose(glm::inverse(glm::mat3(model)));
         glm::mat4 normalMatrix = glm::mat4(1.0f);
         normalMatrix[0] = glm::vec4(normal3[0], 0.0f);
@@ -1321,39 +2774,51 @@ void update(double time) {
         ubo.view = viewMatrix;
         ubo.projection = projectionMatrix;
         ubo.normalMatrix = normalMatrix;
-        ubo.lightSpaceMatrix = lightSpaceMatrix;
         ubo.cameraPos = glm::vec4(app_state.camera.getPosition(), 1.0f);
         ubo.ambientColor = app_state.ambient;
+        ubo.shadowMask = glm::uvec4(shadowMask, 0u, 0u, 0u);
 
-        void* data;
-        vkMapMemory(veekay::app.vk_device, memory, 0, sizeof(ubo), 0, &data);
-        memcpy(data, &ubo, sizeof(ubo));
-        vkUnmapMemory(veekay::app.vk_device, memory);
+        memcpy(dst, &ubo, sizeof(ubo));
     };
 
-    writeUbo(sphereModel, app_state.uniformBufferMemory);
-    writeUbo(planeModel, app_state.planeUniformBufferMemory);
+    writeUbo(sphereModel, cascadeMasks[0], res.uniformBuffer->mapped_region);
+    writeUbo(planeModel, cascadeMasks[1], res.planeUniformBuffer->mapped_region);
+
+    if (app_state.stressObjects > 0) {
+        // Cube-shaped grid that fits an 8x8x8 box above the plane.
+        int side = static_cast<int>(std::ceil(std::cbrt(static_cast<float>(app_state.stressObjects))));
+        float spacing = 8.0f / side;
+        char* dst = static_cast<char*>(res.stressUniformBuffer->mapped_region);
+
+        for (int i = 0; i < app_state.stressObjects; ++i) {
+            glm::vec3 cell(i % side, (i / side) % side, i / (side * side));
+            glm::vec3 position = (cell - glm::vec3((side - 1) * 0.5f)) * spacing + glm::vec3(0.0f, 3.0f, 0.0f);
+
+            glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+            model = glm::scale(model, glm::vec3(spacing * 0.25f));
+
+            writeUbo(model, 0, dst + i * app_state.uboStride);
+        }
+    }
 
-    void* data = nullptr;
-    vkMapMemory(veekay::app.vk_device, app_state.materialBufferMemory, 0, sizeof(app_state.material), 0, &data);
-    memcpy(data, &app_state.material, sizeof(app_state.material));
-    vkUnmapMemory(veekay::app.vk_device, app_state.materialBufferMemory);
+    memcpy(res.materialBuffer->mapped_region, &app_state.material, sizeof(app_state.material));
 
     
     glm::vec3 dir = glm::normalize(glm::vec3(app_state.dirLight.directionIntensity));
     app_state.dirLight.directionIntensity.x = dir.x;
     app_state.dirLight.directionIntensity.y = dir.y;
     app_state.dirLight.directionIntensity.z = dir.z;
-    vkMapMemory(veekay::app.vk_device, app_state.directionalLightBufferMemory, 0, sizeof(app_state.dirLight), 0, &data);
-    memcpy(data, &app_state.dirLight, sizeof(app_state.dirLight));
-    vkUnmapMemory(veekay::app.vk_device, app_state.directionalLightBufferMemory);
+    memcpy(res.directionalLightBuffer->mapped_region, &app_state.dirLight, sizeof(app_state.dirLight));
 
     
     std::vector<PointLightData> pointStorage(kMaxPointLights);
-    size_t pCount = std::min(app_state.pointLights.size(), static_cast<size_t>(kMaxPointLights));
+    size_t pCount = std::min({app_state.pointLights.size(), static_cast<size_t>(kMaxPointLights),
+                              static_cast<size_t>(app_state.maxPointLights)});
     for (size_t i = 0; i < pCount; ++i) {
         pointStorage[i] = app_state.pointLights[i];
     }
+    // The fill light sits at the camera, a shadow from it would never be visible.
+    size_t shadowedPointCount = pCount;
 
     // Optional soft point light that follows the camera ("fill light").
     // Helps keep the front side visible even when shadows reduce directional diffuse.
@@ -1372,14 +2837,11 @@ void update(double time) {
         };
         ++pCount;
     }
-    vkMapMemory(veekay::app.vk_device, app_state.pointLightBufferMemory, 0,
-                sizeof(PointLightData) * kMaxPointLights, 0, &data);
-    memcpy(data, pointStorage.data(), sizeof(PointLightData) * kMaxPointLights);
-    vkUnmapMemory(veekay::app.vk_device, app_state.pointLightBufferMemory);
 
     
     std::vector<SpotLightData> spotStorage(kMaxSpotLights);
-    size_t sCount = std::min(app_state.spotLights.size(), static_cast<size_t>(kMaxSpotLights));
+    size_t sCount = std::min({app_state.spotLights.size(), static_cast<size_t>(kMaxSpotLights),
+                              static_cast<size_t>(app_state.maxSpotLights)});
     for (size_t i = 0; i < sCount; ++i) {
         
         glm::vec3 n = glm::normalize(glm::vec3(app_state.spotLights[i].directionInnerCos));
@@ -1388,123 +2850,641 @@ void update(double time) {
         app_state.spotLights[i].directionInnerCos.z = n.z;
         spotStorage[i] = app_state.spotLights[i];
     }
-    vkMapMemory(veekay::app.vk_device, app_state.spotLightBufferMemory, 0,
-                sizeof(SpotLightData) * kMaxSpotLights, 0, &data);
-    memcpy(data, spotStorage.data(), sizeof(SpotLightData) * kMaxSpotLights);
-    vkUnmapMemory(veekay::app.vk_device, app_state.spotLightBufferMemory);
+
+    assignShadowAtlas(res, pointStorage, shadowedPointCount, spotStorage, sCount,
+                      extractFrustum(cameraViewProj), casters, casterCount);
+    memcpy(res.pointLightBuffer->mapped_region, pointStorage.data(), sizeof(PointLightData) * kMaxPointLights);
+    memcpy(res.spotLightBuffer->mapped_region, spotStorage.data(), sizeof(SpotLightData) * kMaxSpotLights);
 
     
     app_state.lightCounts.counts = glm::ivec4(
         static_cast<int>(pCount),
         static_cast<int>(sCount),
         app_state.enableShadows ? 1 : 0,
-        0);
-    vkMapMemory(veekay::app.vk_device, app_state.lightCountBufferMemory, 0, sizeof(app_state.lightCounts), 0, &data);
-    memcpy(data, &app_state.lightCounts, sizeof(app_state.lightCounts));
-    vkUnmapMemory(veekay::app.vk_device, app_state.lightCountBufferMemory);
+        app_state.shadowFilter != static_cast<int>(ShadowFilter::hard) ? 1 : 0);
+    memcpy(res.lightCountBuffer->mapped_region, &app_state.lightCounts, sizeof(app_state.lightCounts));
+
+    res.wireframe = app_state.wireframeMode;
+    res.shadows = app_state.enableShadows;
+    res.cascades = static_cast<uint32_t>(app_state.cascadeCount);
+    res.shadowCaching = app_state.shadowCaching;
+    res.shadowFilter = static_cast<ShadowFilter>(app_state.shadowFilter);
+    if (res.shadowFilter == ShadowFilter::evsm && app_state.evsmPipeline == VK_NULL_HANDLE) {
+        res.shadowFilter = ShadowFilter::pcf;
+    }
+    res.shadowMapSize = app_state.shadowMapSize;
+    res.shadowFormat = app_state.shadowFormat;
+    res.shadowKey.cascades = res.cascades;
+    std::copy(std::begin(cascades.viewProj), std::end(cascades.viewProj), std::begin(res.shadowKey.viewProj));
+    res.shadowKey.planeCastsShadow = app_state.planeCastsShadow;
+    res.shadowKey.planeModel = planeModel;
+    res.shadowKey.planeCascadeMask = cascadeMasks[1];
+    res.sphereModel = sphereModel;
+    res.sphereCascadeMask = cascadeMasks[0];
+    res.planeCastsShadow = app_state.planeCastsShadow;
+    res.stressObjects = static_cast<uint32_t>(app_state.stressObjects);
+    res.sphereSegments = app_state.sphereSegments;
+    res.staticCommands = app_state.staticCommands;
+
+    DrawStreamKey drawStream{res.wireframe, res.planeCastsShadow, res.stressObjects, res.cascades, res.shadowCaching,
+                             res.shadowFilter, res.shadowMapSize, res.shadowFormat};
+    if (drawStream != app_state.drawStream) {
+        app_state.drawStream = drawStream;
+        ++app_state.sceneVersion;
+    }
+    res.sceneVersion = app_state.sceneVersion;
+}
+
+// Runs after the swapchain image is acquired with freshly polled input. Applies the mouse
+// look that arrived since update() and patches only view and cameraPos of this frame's UBOs.
+void lateUpdate(const veekay::FrameContext& frame) {
+    if (app_state.benchmarkEnabled || !app_state.lateCameraUpdate) {
+        return;
+    }
+
+    FrameResources& res = app_state.frames[frame.index];
+
+    if (app_state.mouseCaptured) {
+        auto md = veekay::input::mouse::cursorDelta();
+        app_state.camera.rotate(md.x * app_state.mouseSensitivity, -md.y * app_state.mouseSensitivity);
+    }
+
+    glm::mat4 viewMatrix = app_state.camera.getViewMatrix();
+    glm::vec4 cameraPos = glm::vec4(app_state.camera.getPosition(), 1.0f);
+
+    auto patchUbo = [&](void* ubo) {
+        char* dst = static_cast<char*>(ubo);
+        memcpy(dst + offsetof(UniformBufferObject, view), &viewMatrix, sizeof(viewMatrix));
+        memcpy(dst + offsetof(UniformBufferObject, cameraPos), &cameraPos, sizeof(cameraPos));
+    };
+
+    patchUbo(res.uniformBuffer->mapped_region);
+    patchUbo(res.planeUniformBuffer->mapped_region);
+
+    char* stress = static_cast<char*>(res.stressUniformBuffer->mapped_region);
+    for (uint32_t i = 0; i < res.stressObjects; ++i) {
+        patchUbo(stress + i * app_state.uboStride);
+    }
 }
 
-void render(VkCommandBuffer commandBuffer, VkFramebuffer framebuffer) {
-    vkResetCommandBuffer(commandBuffer, 0);
+// Items 0 and 1 are the sphere and the plane, the rest are stress objects.
+// Runs on recording worker threads: reads only the frame's resources and immutable state.
+static void recordSceneDraws(VkCommandBuffer cmd, const veekay::FrameContext& frame, uint32_t first, uint32_t count) {
+    const FrameResources& res = app_state.frames[frame.index];
+
+    VkViewport viewport{};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = static_cast<float>(frame.render_width);
+    viewport.height = static_cast<float>(frame.render_height);
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
     
+    VkRect2D scissor{};
+    scissor.offset = {0, 0};
+    scissor.extent = {frame.render_width, frame.render_height};
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+    
+    int filter = static_cast<int>(res.shadowFilter);
+    VkPipeline currentPipeline = res.wireframe ? app_state.wireframePipelines[filter] : app_state.graphicsPipelines[filter];
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, currentPipeline);
+    app_state.geometry->bind(cmd);
+
+    for (uint32_t i = first; i < first + count; ++i) {
+        if (i < 2) {
+            VkDescriptorSet set = i == 0 ? res.descriptorSetSphere : res.descriptorSetPlane;
+            const uint32_t noOffset = 0;
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, app_state.pipelineLayout, 0, 1, &set, 1, &noOffset);
+            app_state.geometry->draw(cmd, i == 0 ? app_state.sphereMesh : app_state.planeMesh);
+        } else {
+            uint32_t offset = static_cast<uint32_t>((i - 2) * app_state.uboStride);
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, app_state.pipelineLayout, 0, 1, &res.descriptorSetStress, 1, &offset);
+            app_state.geometry->draw(cmd, app_state.sphereMesh);
+        }
+    }
+}
+
+// Culled casters are skipped only when the commands are for this frame; replayed secondaries draw
+// them all and shadow.vert drops the cascades each caster's shadowMask excludes.
+static void recordShadowDraws(VkCommandBuffer cmd, const FrameResources& res, ShadowCasters casters, bool skipCulled) {
+    VkViewport shadowViewport{};
+    shadowViewport.x = 0.0f;
+    shadowViewport.y = 0.0f;
+    shadowViewport.width = static_cast<float>(app_state.shadowMapImageSize);
+    shadowViewport.height = static_cast<float>(app_state.shadowMapImageSize);
+    shadowViewport.minDepth = 0.0f;
+    shadowViewport.maxDepth = 1.0f;
+    vkCmdSetViewport(cmd, 0, 1, &shadowViewport);
+
+    VkRect2D shadowScissor{};
+    shadowScissor.offset = {0, 0};
+    shadowScissor.extent = {app_state.shadowMapImageSize, app_state.shadowMapImageSize};
+    vkCmdSetScissor(cmd, 0, 1, &shadowScissor);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      app_state.shadowPipelines[app_state.shadowMapImageFormat][res.cascades - kMinCascades]);
+    app_state.geometry->bind(cmd);
+
+    const uint32_t noOffset = 0;
+    if (casters != ShadowCasters::staticOnly && (!skipCulled || res.sphereCascadeMask != 0)) {
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, app_state.pipelineLayout, 0, 1, &res.descriptorSetSphere, 1, &noOffset);
+        app_state.geometry->draw(cmd, app_state.sphereMesh);
+    }
+
+    // Rendering the plane into the shadow map often causes self-shadowing artifacts
+    // (a hard diagonal seam because the plane is only 2 triangles). The plane is mainly
+    // a receiver, not an occluder, so keep it out of the shadow map by default.
+    if (res.planeCastsShadow && casters != ShadowCasters::dynamicOnly && (!skipCulled || res.shadowKey.planeCascadeMask != 0)) {
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, app_state.pipelineLayout, 0, 1, &res.descriptorSetPlane, 1, &noOffset);
+        app_state.geometry->draw(cmd, app_state.planeMesh);
+    }
+}
+
+// Re-records the slot's secondaries if the draw stream or the render extent changed since last time.
+// Per-frame data comes from the slot's buffers, so the same commands stay valid while only contents change.
+// The slot's previous frame has finished, so its pool can be reset.
+static void recordStaticCommands(const veekay::FrameContext& frame) {
+    FrameResources& res = app_state.frames[frame.index];
+
+    if (res.staticVersion == res.sceneVersion && res.staticGeometryVersion == app_state.geometryVersion &&
+        res.staticExtent.width == frame.render_width && res.staticExtent.height == frame.render_height) {
+        return;
+    }
+
+    vkResetCommandPool(veekay::app.vk_device, res.staticCommandPool, 0);
+
+    VkFormat shadowFormat = kShadowFormats[app_state.shadowMapImageFormat];
+
+    VkCommandBufferInheritanceRenderingInfo shadowRendering{};
+    shadowRendering.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+    shadowRendering.viewMask = (1u << res.cascades) - 1;
+    shadowRendering.depthAttachmentFormat = shadowFormat;
+    shadowRendering.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    VkCommandBufferInheritanceInfo shadowInheritance{};
+    shadowInheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    shadowInheritance.pNext = &shadowRendering;
+
     VkCommandBufferBeginInfo beginInfo{};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    beginInfo.pInheritanceInfo = &shadowInheritance;
+
+    vkBeginCommandBuffer(res.staticShadowCommands, &beginInfo);
+    recordShadowDraws(res.staticShadowCommands, res, res.shadowCaching ? ShadowCasters::dynamicOnly : ShadowCasters::all, false);
+    vkEndCommandBuffer(res.staticShadowCommands);
+
+    // The framebuffer differs per swapchain image, so it is left unspecified.
+    VkCommandBufferInheritanceInfo sceneInheritance{};
+    sceneInheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    sceneInheritance.renderPass = veekay::app.vk_render_pass;
+    sceneInheritance.subpass = 0;
+
+    beginInfo.pInheritanceInfo = &sceneInheritance;
+
+    vkBeginCommandBuffer(res.staticSceneCommands, &beginInfo);
+    recordSceneDraws(res.staticSceneCommands, frame, 0, 2 + res.stressObjects);
+    vkEndCommandBuffer(res.staticSceneCommands);
+
+    res.staticVersion = res.sceneVersion;
+    res.staticGeometryVersion = app_state.geometryVersion;
+    res.staticExtent = {frame.render_width, frame.render_height};
+    app_state.staticRecordings.fetch_add(1, std::memory_order_relaxed);
+}
 
-    VkImageLayout shadowOldLayout = app_state.shadowInitialized ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
-    VkPipelineStageFlags shadowSrcStage = app_state.shadowInitialized ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-    VkAccessFlags shadowSrcAccess = app_state.shadowInitialized ? VK_ACCESS_SHADER_READ_BIT : 0;
-    transitionDepthImage(
-        commandBuffer,
-        app_state.shadowImage,
-        shadowOldLayout,
-        VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
-        shadowSrcStage,
-        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
-        shadowSrcAccess,
-        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
-
-    VkClearValue shadowClear{};
-    shadowClear.depthStencil = {1.0f, 0};
+// Swaps the sphere for one with a different tessellation without waiting for the GPU. Frames in
+// flight keep drawing the old range, and buffers replaced by a reallocation go to veekay::deletion.
+static void updateSphereMesh(int segments) {
+    if (segments == app_state.sphereMeshSegments) {
+        return;
+    }
+
+    std::vector<Vertex> vertices = SphereGenerator::generateSphere(1.0f, segments, glm::vec3(0.5f, 0.8f, 1.0f));
+    std::vector<uint32_t> indices = SphereGenerator::generateIndices(segments);
+
+    app_state.geometry->free(app_state.sphereMesh);
+    app_state.sphereMesh = app_state.geometry->upload(
+        vertices.data(), static_cast<uint32_t>(vertices.size()),
+        indices.data(), static_cast<uint32_t>(indices.size()));
+
+    app_state.sphereMeshSegments = segments;
+    ++app_state.geometryVersion;
+}
 
+static void beginShadowRendering(VkCommandBuffer cmd, VkImageView view, VkAttachmentLoadOp loadOp,
+                                 uint32_t size, uint32_t viewMask, bool secondaries) {
     VkRenderingAttachmentInfo depthAttachment{};
     depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
-    depthAttachment.imageView = app_state.shadowImageView;
+    depthAttachment.imageView = view;
     depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
-    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.loadOp = loadOp;
     depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    depthAttachment.clearValue = shadowClear;
+    depthAttachment.clearValue.depthStencil = {1.0f, 0};
 
     VkRenderingInfo renderingInfo{};
     renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
-    renderingInfo.renderArea = {{0, 0}, {kShadowMapSize, kShadowMapSize}};
+    renderingInfo.renderArea = {{0, 0}, {size, size}};
     renderingInfo.layerCount = 1;
-    renderingInfo.viewMask = 0;
+    renderingInfo.viewMask = viewMask;
     renderingInfo.colorAttachmentCount = 0;
     renderingInfo.pColorAttachments = nullptr;
     renderingInfo.pDepthAttachment = &depthAttachment;
     renderingInfo.pStencilAttachment = nullptr;
+    renderingInfo.flags = secondaries ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0;
 
-    vkCmdBeginRendering(commandBuffer, &renderingInfo);
+    vkCmdBeginRendering(cmd, &renderingInfo);
+}
 
-    VkViewport shadowViewport{};
-    shadowViewport.x = 0.0f;
-    shadowViewport.y = 0.0f;
-    shadowViewport.width = static_cast<float>(kShadowMapSize);
-    shadowViewport.height = static_cast<float>(kShadowMapSize);
-    shadowViewport.minDepth = 0.0f;
-    shadowViewport.maxDepth = 1.0f;
-    vkCmdSetViewport(commandBuffer, 0, 1, &shadowViewport);
+// Brings the shadow map up to date. With caching, static casters live in their own image that is
+// redrawn only when they or the cascades move; each update copies it into the map and draws just
+// the sphere on top. When nothing changed since the map was last rendered, nothing is recorded.
+// Returns whether the map was rewritten.
+static bool renderShadows(VkCommandBuffer cmd, const FrameResources& res) {
+    bool initialized = app_state.shadowInitialized;
+
+    // The fragment shader does not sample the map with shadows off, it only needs a valid layout.
+    if (!res.shadows && initialized) {
+        app_state.shadowMapValid = false;
+        return false;
+    }
 
-    VkRect2D shadowScissor{};
-    shadowScissor.offset = {0, 0};
-    shadowScissor.extent = {kShadowMapSize, kShadowMapSize};
-    vkCmdSetScissor(commandBuffer, 0, 1, &shadowScissor);
+    bool cached = res.shadows && res.shadowCaching;
+    if (cached && app_state.shadowMapValid && app_state.shadowMapKey == res.shadowKey &&
+        app_state.shadowMapSphere == res.sphereModel && app_state.shadowMapSphereMask == res.sphereCascadeMask &&
+        app_state.shadowMapGeometry == app_state.geometryVersion) {
+        app_state.shadowSkips.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
 
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, app_state.shadowPipeline);
+    VkImageLayout oldLayout = initialized ? VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+    // The EVSM blur reads the map in compute.
+    VkPipelineStageFlags srcStage = initialized ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                                                : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    VkAccessFlags srcAccess = initialized ? VK_ACCESS_SHADER_READ_BIT : 0;
+    VkAttachmentLoadOp loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+
+    if (cached && res.planeCastsShadow) {
+        if (!app_state.shadowStaticValid || app_state.shadowStaticKey != res.shadowKey) {
+            bool fresh = app_state.shadowStaticLayout == VK_IMAGE_LAYOUT_UNDEFINED;
+            transitionDepthImage(cmd, app_state.shadowStaticImage,
+                                 app_state.shadowStaticLayout, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+                                 fresh ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+                                 0, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+
+            beginShadowRendering(cmd, app_state.shadowStaticImageView, VK_ATTACHMENT_LOAD_OP_CLEAR,
+                                 app_state.shadowMapImageSize, (1u << res.cascades) - 1, false);
+            recordShadowDraws(cmd, res, ShadowCasters::staticOnly, true);
+            vkCmdEndRendering(cmd);
+
+            transitionDepthImage(cmd, app_state.shadowStaticImage,
+                                 VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                 VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+
+            app_state.shadowStaticLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            app_state.shadowStaticKey = res.shadowKey;
+            app_state.shadowStaticValid = true;
+            app_state.shadowStaticRenders.fetch_add(1, std::memory_order_relaxed);
+        }
 
-    VkBuffer shadowVb[] = {app_state.vertexBuffer};
-    VkDeviceSize shadowOffsets[] = {0};
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, shadowVb, shadowOffsets);
-    vkCmdBindIndexBuffer(commandBuffer, app_state.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, app_state.pipelineLayout, 0, 1, &app_state.descriptorSetSphere, 0, nullptr);
-    if (app_state.indexCount > 0) {
-        vkCmdDrawIndexed(commandBuffer, app_state.indexCount, 1, 0, 0, 0);
+        transitionDepthImage(cmd, app_state.shadowImage,
+                             oldLayout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                             srcStage, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             srcAccess, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+        VkImageCopy region{};
+        region.srcSubresource = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 0, res.cascades};
+        region.dstSubresource = {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 0, res.cascades};
+        region.extent = {app_state.shadowMapImageSize, app_state.shadowMapImageSize, 1};
+        vkCmdCopyImage(cmd, app_state.shadowStaticImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       app_state.shadowImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+        oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        srcAccess = VK_ACCESS_TRANSFER_WRITE_BIT;
+        loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
     }
 
-    // Rendering the plane into the shadow map often causes self-shadowing artifacts
-    // (a hard diagonal seam because the plane is only 2 triangles). The plane is mainly
-    // a receiver, not an occluder, so keep it out of the shadow map by default.
-    if (app_state.planeCastsShadow) {
-        VkBuffer shadowPlaneVb[] = {app_state.planeVertexBuffer};
-        vkCmdBindVertexBuffers(commandBuffer, 0, 1, shadowPlaneVb, shadowOffsets);
-        vkCmdBindIndexBuffer(commandBuffer, app_state.planeIndexBuffer, 0, VK_INDEX_TYPE_UINT32);
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, app_state.pipelineLayout, 0, 1, &app_state.descriptorSetPlane, 0, nullptr);
-        if (app_state.planeIndexCount > 0) {
-            vkCmdDrawIndexed(commandBuffer, app_state.planeIndexCount, 1, 0, 0, 0);
-        }
+    transitionDepthImage(cmd, app_state.shadowImage,
+                         oldLayout, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+                         srcStage, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+                         srcAccess, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+
+    // With shadows off (first frame only) the map is just cleared.
+    bool replay = res.shadows && res.staticCommands;
+    beginShadowRendering(cmd, app_state.shadowImageView, loadOp, app_state.shadowMapImageSize, (1u << res.cascades) - 1, replay);
+
+    if (replay) {
+        vkCmdExecuteCommands(cmd, 1, &res.staticShadowCommands);
+    } else if (res.shadows) {
+        recordShadowDraws(cmd, res, cached ? ShadowCasters::dynamicOnly : ShadowCasters::all, true);
     }
 
-    vkCmdEndRendering(commandBuffer);
+    vkCmdEndRendering(cmd);
 
-    transitionDepthImage(
-        commandBuffer,
-        app_state.shadowImage,
-        VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
-        VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL,
-        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
-        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
-        VK_ACCESS_SHADER_READ_BIT);
+    transitionDepthImage(cmd, app_state.shadowImage,
+                         VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL,
+                         VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
     app_state.shadowInitialized = true;
+
+    app_state.shadowMapValid = res.shadows;
+    app_state.shadowMapKey = res.shadowKey;
+    app_state.shadowMapSphere = res.sphereModel;
+    app_state.shadowMapSphereMask = res.sphereCascadeMask;
+    app_state.shadowMapGeometry = app_state.geometryVersion;
+    return true;
+}
+
+// Converts the cascades into blurred EVSM moments. The blur is separable: pass 0 averages 2x2
+// depth texels into one moments texel and blurs horizontally, pass 1 blurs vertically. It stays on
+// the graphics queue because it needs this frame's shadow map.
+static void filterShadowMoments(VkCommandBuffer cmd, const FrameResources& res) {
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+
+    // The previous frame may still sample the moments or blur into them; nothing to make visible.
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, app_state.evsmPipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, app_state.evsmPipelineLayout, 0, 1,
+                            &res.evsmDescriptorSet, 0, nullptr);
+
+    const uint32_t groups = (app_state.shadowMapImageSize / 2 + 7) / 8;
+    int32_t push[2] = {0, kEvsmBlurRadius};
+    vkCmdPushConstants(cmd, app_state.evsmPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), push);
+    vkCmdDispatch(cmd, groups, groups, res.cascades);
+
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    push[0] = 1;
+    vkCmdPushConstants(cmd, app_state.evsmPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), push);
+    vkCmdDispatch(cmd, groups, groups, res.cascades);
+
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+// Redraws the spot and point light tiles of the atlas. Every light is one draw per caster: the
+// instance index picks the face, and with it the viewport, so a point light's six faces are
+// rendered in a single pass.
+static void renderShadowAtlas(VkCommandBuffer cmd, const FrameResources& res) {
+    bool initialized = app_state.atlasInitialized;
+
+    // Without shadowed lights the atlas is not sampled, it only needs a valid layout once.
+    if (res.atlasDrawCount == 0 && initialized) {
+        return;
+    }
+
+    transitionDepthImage(cmd, app_state.atlasImage,
+                         initialized ? VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED,
+                         VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+                         initialized ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+                         initialized ? VK_ACCESS_SHADER_READ_BIT : 0,
+                         VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+
+    beginShadowRendering(cmd, app_state.atlasImageView, VK_ATTACHMENT_LOAD_OP_CLEAR, kShadowAtlasSize, 0, false);
+
+    if (res.atlasDrawCount > 0) {
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, app_state.atlasPipeline);
+        app_state.geometry->bind(cmd);
+
+        const uint32_t noOffset = 0;
+        for (uint32_t i = 0; i < res.atlasDrawCount; ++i) {
+            const AtlasDraw& draw = res.atlasDraws[i];
+            vkCmdSetViewport(cmd, 0, 6, draw.viewports);
+            vkCmdSetScissor(cmd, 0, 6, draw.scissors);
+
+            // Faces outside a caster's mask are moved off screen by shadow_atlas.vert.
+            for (uint32_t c = 0; c < 2; ++c) {
+                if (draw.casterFaces[c] == 0) continue;
+                uint32_t constants[2] = {draw.firstEntry, draw.casterFaces[c]};
+                vkCmdPushConstants(cmd, app_state.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(constants), constants);
+                VkDescriptorSet set = c == 0 ? res.descriptorSetSphere : res.descriptorSetPlane;
+                vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, app_state.pipelineLayout, 0, 1, &set, 1, &noOffset);
+                app_state.geometry->draw(cmd, c == 0 ? app_state.sphereMesh : app_state.planeMesh, draw.faces);
+            }
+        }
+    }
+
+    vkCmdEndRendering(cmd);
+
+    transitionDepthImage(cmd, app_state.atlasImage,
+                         VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL,
+                         VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+    app_state.atlasInitialized = true;
+}
+
+// Brings the virtual shadow map's pages up to date: reads the page requests this slot's last main pass
+// wrote, drops pages the light, the window or the casters invalidated, and renders up to
+// kVsmMaxPageRenders requested pages into the pool with the atlas pipeline, six pages per draw.
+// The slot's previous frame has finished, so its request and page table buffers can be touched.
+static void renderVirtualShadowMap(VkCommandBuffer cmd, FrameResources& res, uint64_t frameNumber) {
+    bool initialized = app_state.vsmInitialized;
+    VirtualShadowMap& vsm = app_state.virtualShadowMap;
+
+    if (!res.virtualShadows) {
+        app_state.vsmValid = false;
+        res.vsmFeedback = false;
+        // The pool is not sampled, it only needs a valid layout once.
+        if (initialized) {
+            return;
+        }
+    }
+
+    std::array<VirtualShadowMap::Render, kVsmMaxPageRenders> renders;
+    uint32_t renderCount = 0;
+    const VirtualShadowKey& key = res.vsmKey;
+
+    if (res.virtualShadows) {
+        if (!app_state.vsmValid || app_state.vsmKey != key) {
+            vsm.invalidateAll();
+            app_state.vsmKey = key;
+            app_state.vsmValid = true;
+        }
+        vsm.setOrigin(res.vsmOrigin);
+
+        // The sphere moves every frame, only the pages under its shadow before and now are redrawn.
+        if (app_state.vsmSphere != res.sphereModel || app_state.vsmGeometry != app_state.geometryVersion) {
+            for (const glm::mat4& model : {app_state.vsmSphere, res.sphereModel}) {
+                VirtualShadowMap::Page min, max;
+                virtualShadowPages(key, transformBounds(app_state.sphereBounds, model), min, max);
+                vsm.invalidate(min, max);
+            }
+            app_state.vsmSphere = res.sphereModel;
+            app_state.vsmGeometry = app_state.geometryVersion;
+        }
+
+        auto* requests = static_cast<uint32_t*>(res.vsmRequestBuffer->mapped_region);
+        if (res.vsmFeedback) {
+            vsm.request(requests, res.vsmFeedbackOrigin);
+        }
+        std::memset(requests, 0, sizeof(uint32_t) * kVsmRequestWords);
+        res.vsmFeedback = true;
+        res.vsmFeedbackOrigin = res.vsmOrigin;
+
+        renderCount = vsm.update(frameNumber, kVsmMaxPageRenders, renders.data());
+        std::memcpy(res.vsmPageTableBuffer->mapped_region, vsm.table().data(), sizeof(uint32_t) * vsm.table().size());
+
+        app_state.vsmResidentPages.store(vsm.residentPages(), std::memory_order_relaxed);
+        app_state.vsmPageRenders.store(renderCount, std::memory_order_relaxed);
+    }
+
+    if (renderCount == 0 && initialized) {
+        return;
+    }
+
+    // Pages not rendered this frame keep their depth, so the pool is loaded rather than cleared.
+    transitionDepthImage(cmd, app_state.vsmImage,
+                         initialized ? VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED,
+                         VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+                         initialized ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+                         initialized ? VK_ACCESS_SHADER_READ_BIT : 0,
+                         VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+
+    beginShadowRendering(cmd, app_state.vsmImageView,
+                         initialized ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR, kVsmPoolSize, 0, false);
+
+    if (renderCount > 0) {
+        auto* entries = static_cast<ShadowAtlasEntry*>(res.atlasBuffer->mapped_region);
+        std::array<VkViewport, kVsmMaxPageRenders> viewports;
+        std::array<VkRect2D, kVsmMaxPageRenders> scissors;
+        std::array<VkClearRect, kVsmMaxPageRenders> clearRects;
+        float pageUv = 1.0f / static_cast<float>(kVsmPoolPages);
+
+        for (uint32_t i = 0; i < renderCount; ++i) {
+            uint32_t x = renders[i].physical % kVsmPoolPages;
+            uint32_t y = renders[i].physical / kVsmPoolPages;
+            entries[kVsmFirstEntry + i].viewProj = virtualPageViewProj(key, renders[i].page, 1);
+            entries[kVsmFirstEntry + i].rect = glm::vec4(x * pageUv, y * pageUv, pageUv, pageUv);
+            viewports[i] = VkViewport{static_cast<float>(x * kVsmPageSize), static_cast<float>(y * kVsmPageSize),
+                                      static_cast<float>(kVsmPageSize), static_cast<float>(kVsmPageSize), 0.0f, 1.0f};
+            scissors[i] = VkRect2D{{static_cast<int32_t>(x * kVsmPageSize), static_cast<int32_t>(y * kVsmPageSize)},
+                                   {kVsmPageSize, kVsmPageSize}};
+            clearRects[i] = VkClearRect{scissors[i], 0, 1};
+        }
+
+        VkClearAttachment clear{};
+        clear.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+        clear.clearValue.depthStencil = {1.0f, 0};
+        vkCmdClearAttachments(cmd, 1, &clear, renderCount, clearRects.data());
+
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, app_state.atlasPipeline);
+        app_state.geometry->bind(cmd);
+
+        BoundingSphere casters[2] = {transformBounds(app_state.sphereBounds, res.sphereModel),
+                                     transformBounds(app_state.planeBounds, key.planeModel)};
+        VirtualShadowMap::Page casterMin[2], casterMax[2];
+        for (uint32_t c = 0; c < 2; ++c) {
+            virtualShadowPages(key, casters[c], casterMin[c], casterMax[c]);
+        }
+        uint32_t casterCount = key.planeCastsShadow ? 2 : 1;
+
+        const uint32_t noOffset = 0;
+        for (uint32_t first = 0; first < renderCount; first += 6) {
+            uint32_t pages = std::min(renderCount - first, 6u);
+            // The pipeline has six viewports and all must be set, a short group repeats its first page.
+            VkViewport groupViewports[6];
+            VkRect2D groupScissors[6];
+            for (uint32_t i = 0; i < 6; ++i) {
+                groupViewports[i] = viewports[first + (i < pages ? i : 0)];
+                groupScissors[i] = scissors[first + (i < pages ? i : 0)];
+            }
+            vkCmdSetViewport(cmd, 0, 6, groupViewports);
+            vkCmdSetScissor(cmd, 0, 6, groupScissors);
+
+            // Pages outside a caster's footprint are moved off screen by shadow_atlas.vert.
+            for (uint32_t c = 0; c < casterCount; ++c) {
+                uint32_t pageMask = 0;
+                for (uint32_t i = 0; i < pages; ++i) {
+                    const VirtualShadowMap::Page& page = renders[first + i].page;
+                    if (page.x >= casterMin[c].x && page.x <= casterMax[c].x &&
+                        page.y >= casterMin[c].y && page.y <= casterMax[c].y) {
+                        pageMask |= 1u << i;
+                    }
+                }
+                if (pageMask == 0) continue;
+
+                uint32_t constants[2] = {kVsmFirstEntry + first, pageMask};
+                vkCmdPushConstants(cmd, app_state.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(constants), constants);
+                VkDescriptorSet set = c == 0 ? res.descriptorSetSphere : res.descriptorSetPlane;
+                vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, app_state.pipelineLayout, 0, 1, &set, 1, &noOffset);
+                app_state.geometry->draw(cmd, c == 0 ? app_state.sphereMesh : app_state.planeMesh, pages);
+            }
+        }
+    }
+
+    vkCmdEndRendering(cmd);
+
+    transitionDepthImage(cmd, app_state.vsmImage,
+                         VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL,
+                         VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+    app_state.vsmInitialized = true;
+}
+
+void render(const veekay::FrameContext& frame) {
+    VkCommandBuffer commandBuffer = frame.command_buffer;
+    const FrameResources& res = app_state.frames[frame.index];
+
+    updateSphereMesh(res.sphereSegments);
+    
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    // A request that failed once is not retried every frame, update() falls back to the live maps.
+    uint32_t shadowMapRequest = packShadowMapSetting(res.shadowMapSize, res.shadowFormat);
+    if ((res.shadowMapSize != app_state.shadowMapImageSize || res.shadowFormat != app_state.shadowMapImageFormat) &&
+        shadowMapRequest != app_state.shadowMapRejected.load()) {
+        if (!createShadowMaps(commandBuffer, res.shadowMapSize, res.shadowFormat)) {
+            app_state.shadowMapRejected.store(shadowMapRequest);
+        }
+    }
+    if (res.shadowMapGeneration != app_state.shadowMapGeneration) {
+        writeShadowDescriptors(app_state.frames[frame.index]);
+    }
+
+    if (res.staticCommands) {
+        recordStaticCommands(frame);
+    }
+
+    veekay::profiler::beginPass(commandBuffer, "shadow");
+
+    bool shadowMapChanged = renderShadows(commandBuffer, res);
+    renderShadowAtlas(commandBuffer, res);
+    renderVirtualShadowMap(commandBuffer, app_state.frames[frame.index], frame.number);
+
+    veekay::profiler::endPass(commandBuffer);
+
+    // Moments only go stale when the map is rewritten, a skipped shadow pass skips the blur too.
+    app_state.evsmValid = app_state.evsmValid && !shadowMapChanged;
+    if (res.shadows && res.shadowFilter == ShadowFilter::evsm && !app_state.evsmValid) {
+        veekay::profiler::beginPass(commandBuffer, "evsm blur");
+        filterShadowMoments(commandBuffer, res);
+        veekay::profiler::endPass(commandBuffer);
+        app_state.evsmValid = true;
+    }
+
+    veekay::profiler::beginPass(commandBuffer, kMainPassNames[static_cast<int>(res.shadowFilter)]);
     
     VkRenderPassBeginInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     renderPassInfo.renderPass = veekay::app.vk_render_pass;
-    renderPassInfo.framebuffer = framebuffer;
+    renderPassInfo.framebuffer = frame.framebuffer;
     renderPassInfo.renderArea.offset = {0, 0};
-    renderPassInfo.renderArea.extent = {veekay::app.window_width, veekay::app.window_height};
+    // Smaller than the window under dynamic resolution, veekay upscales it in endRenderPass.
+    renderPassInfo.renderArea.extent = {frame.render_width, frame.render_height};
     
     VkClearValue clearValues[2];
     clearValues[0].color = {{0.1f, 0.1f, 0.1f, 1.0f}};
@@ -1512,53 +3492,131 @@ void render(VkCommandBuffer commandBuffer, VkFramebuffer framebuffer) {
     renderPassInfo.clearValueCount = 2;
     renderPassInfo.pClearValues = clearValues;
     
-    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-    
-    VkViewport viewport{};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = static_cast<float>(veekay::app.window_width);
-    viewport.height = static_cast<float>(veekay::app.window_height);
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
-    
-    VkRect2D scissor{};
-    scissor.offset = {0, 0};
-    scissor.extent = {veekay::app.window_width, veekay::app.window_height};
-    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
-    
-    VkPipeline currentPipeline = app_state.wireframeMode ? app_state.wireframePipeline : app_state.graphicsPipeline;
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, currentPipeline);
-    
-    VkBuffer vertexBuffers[] = {app_state.vertexBuffer};
-    VkDeviceSize offsets[] = {0};
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-    vkCmdBindIndexBuffer(commandBuffer, app_state.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, app_state.pipelineLayout, 0, 1, &app_state.descriptorSetSphere, 0, nullptr);
-    if (app_state.indexCount > 0) {
-        vkCmdDrawIndexed(commandBuffer, app_state.indexCount, 1, 0, 0, 0);
-    }
+    // Scene draws are recorded into secondary command buffers, possibly on several threads.
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
-    VkBuffer planeVb[] = {app_state.planeVertexBuffer};
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, planeVb, offsets);
-    vkCmdBindIndexBuffer(commandBuffer, app_state.planeIndexBuffer, 0, VK_INDEX_TYPE_UINT32);
-    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, app_state.pipelineLayout, 0, 1, &app_state.descriptorSetPlane, 0, nullptr);
-    if (app_state.planeIndexCount > 0) {
-        vkCmdDrawIndexed(commandBuffer, app_state.planeIndexCount, 1, 0, 0, 0);
+    if (res.staticCommands) {
+        vkCmdExecuteCommands(commandBuffer, 1, &res.staticSceneCommands);
+    } else {
+        veekay::parallel::recordSubpass(frame, veekay::app.vk_render_pass, 0, frame.framebuffer,
+                                        2 + res.stressObjects, recordSceneDraws);
     }
     
-    vkCmdEndRenderPass(commandBuffer);
+    veekay::endRenderPass(commandBuffer);
+
+    // Page requests of this frame, read back when the slot comes around again.
+    if (res.virtualShadows) {
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                             0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+    veekay::profiler::endPass(commandBuffer);
+
     vkEndCommandBuffer(commandBuffer);
 }
 
-int main() {
+static bool parsePresentMode(const std::string& name, veekay::PresentMode& mode) {
+    for (int i = 0; i < IM_ARRAYSIZE(kPresentModeNames); ++i) {
+        if (name == kPresentModeNames[i]) {
+            mode = static_cast<veekay::PresentMode>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char** argv) {
     veekay::ApplicationInfo appInfo{
         .init = init,
         .shutdown = shutdown,
         .update = update,
-        .render = render
+        .render = render,
+        .late_update = lateUpdate
     };
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--frames-in-flight" && hasValue) {
+            appInfo.frames_in_flight = static_cast<uint32_t>(std::max(std::atoi(argv[++i]), 1));
+        } else if (arg == "--present-mode" && hasValue && parsePresentMode(argv[i + 1], appInfo.present_mode)) {
+            ++i;
+        } else if (arg == "--workers" && hasValue) {
+            appInfo.worker_threads = static_cast<uint32_t>(std::max(std::atoi(argv[++i]), 0));
+        } else if (arg == "--dynamic-resolution" && hasValue) {
+            appInfo.dynamic_resolution = true;
+            appInfo.target_frame_ms = std::atof(argv[++i]);
+        } else if (arg == "--quality-governor" && hasValue) {
+            app_state.qualityGovernor = true;
+            double budget = std::atof(argv[++i]);
+            app_state.governor.setBudget(budget > 0.0 ? budget : 1000.0 / 60.0);
+        } else if (arg == "--low-latency") {
+            appInfo.low_latency = true;
+            app_state.lowLatency = true;
+        } else if (arg == "--static-commands") {
+            app_state.staticCommands = true;
+        } else if (arg == "--on-demand") {
+            appInfo.on_demand = true;
+        } else if (arg == "--pipelined") {
+            appInfo.pipelined = true;
+        } else if (arg == "--uncapped") {
+            appInfo.uncapped = true;
+        } else if (arg == "--headless" && hasValue) {
+            appInfo.headless = true;
+            appInfo.headless_frames = static_cast<uint32_t>(std::max(std::atoi(argv[++i]), 1));
+        } else if (arg == "--size" && hasValue &&
+                   std::sscanf(argv[i + 1], "%ux%u", &appInfo.headless_width, &appInfo.headless_height) == 2) {
+            ++i;
+        } else if (arg == "--output" && hasValue) {
+            appInfo.headless_output = argv[++i];
+        } else if (arg == "--profile" && hasValue) {
+            appInfo.profile_output = argv[++i];
+        } else if (arg == "--benchmark" && hasValue) {
+            try {
+                app_state.benchmark.load(argv[++i]);
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << std::endl;
+                return 1;
+            }
+            app_state.benchmarkEnabled = true;
+        } else if (arg == "--benchmark-output" && hasValue) {
+            app_state.benchmarkOutput = argv[++i];
+        } else {
+            std::cerr << "Unknown or incomplete option: " << arg << std::endl;
+            std::cerr << "Usage: " << argv[0] << " [--frames-in-flight N]"
+                      << " [--present-mode fifo|fifo_relaxed|mailbox|immediate] [--uncapped] [--low-latency] [--on-demand] [--static-commands] [--pipelined] [--dynamic-resolution MS] [--quality-governor MS] [--workers N]"
+                      << " [--headless N [--size WxH] [--output image.ppm]]"
+                      << " [--profile timings.csv|timings.json]"
+                      << " [--benchmark script.txt [--benchmark-output report.json]]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (app_state.qualityGovernor) {
+        applyQualityTier(app_state.governor.tier());
+    }
+
+    if (app_state.benchmarkEnabled) {
+        for (const auto& [name, value] : app_state.benchmark.settingsAt(std::numeric_limits<double>::max())) {
+            const auto* end = std::end(kBenchmarkSettings);
+            if (std::find(std::begin(kBenchmarkSettings), end, name) == end) {
+                std::cerr << "Unknown benchmark setting: " << name << std::endl;
+                return 1;
+            }
+        }
+
+        appInfo.fixed_time_step = app_state.benchmark.timeStep();
+        if (appInfo.headless) {
+            // The benchmark stops the app itself, make sure headless mode does not cut it short.
+            appInfo.headless_frames = std::max<uint32_t>(appInfo.headless_frames,
+                                                        app_state.benchmark.totalFrames() + veekay::max_frames_in_flight);
+        }
+    }
     
     return veekay::run(appInfo);
 }
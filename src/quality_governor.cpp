@@ -0,0 +1,96 @@
+#include "quality_governor.h"
+#include <algorithm>
+
+namespace {
+
+// Вес нового замера в экспоненциальном сглаживании
+constexpr double kSmoothing = 0.1;
+
+// Понижаться сразу за бюджетом, повышаться только с заметным запасом
+constexpr double kUpThreshold = 0.7;
+
+constexpr uint32_t kDownHoldFrames = 30;
+constexpr uint32_t kUpHoldFrames = 120;
+constexpr uint32_t kMaxUpHoldFrames = kUpHoldFrames * 16;
+
+// GPU-замеры приходят на frames_in_flight кадров позже, после смены ждём с запасом
+constexpr uint32_t kSettleFrames = 8;
+
+} // namespace
+
+QualityGovernor::QualityGovernor(int tierCount, int initialTier)
+    : tierCount_(std::max(tierCount, 1)),
+      tier_(std::clamp(initialTier, 0, tierCount_ - 1)),
+      upHoldFrames_(tierCount_, kUpHoldFrames) {
+}
+
+void QualityGovernor::setTier(int tier) {
+    switchTo(std::clamp(tier, 0, tierCount_ - 1));
+    raised_ = false;
+}
+
+void QualityGovernor::switchTo(int tier) {
+    tier_ = tier;
+    settleFrames_ = kSettleFrames;
+    smoothed_ = false;
+    overBudgetFrames_ = 0;
+    underBudgetFrames_ = 0;
+}
+
+bool QualityGovernor::addSample(double cpuMs, double gpuMs, Change& change) {
+    if (settleFrames_ > 0) {
+        --settleFrames_;
+        return false;
+    }
+
+    if (!smoothed_) {
+        cpuMs_ = cpuMs;
+        gpuMs_ = gpuMs;
+        smoothed_ = true;
+    } else {
+        cpuMs_ += (cpuMs - cpuMs_) * kSmoothing;
+        gpuMs_ += (gpuMs - gpuMs_) * kSmoothing;
+    }
+
+    if (raised_) {
+        ++framesSinceRaise_;
+    }
+
+    // Кадр ограничен тем, кто из CPU и GPU медленнее
+    double frameMs = std::max(cpuMs_, gpuMs_);
+
+    if (frameMs > budgetMs_) {
+        ++overBudgetFrames_;
+        underBudgetFrames_ = 0;
+    } else if (frameMs < budgetMs_ * kUpThreshold) {
+        ++underBudgetFrames_;
+        overBudgetFrames_ = 0;
+    } else {
+        overBudgetFrames_ = 0;
+        underBudgetFrames_ = 0;
+    }
+
+    int from = tier_;
+
+    if (overBudgetFrames_ >= kDownHoldFrames && tier_ > 0) {
+        // Повышение не удержалось: в следующий раз ждать дольше
+        if (raised_ && framesSinceRaise_ < upHoldFrames_[tier_] * 2) {
+            upHoldFrames_[tier_] = std::min(upHoldFrames_[tier_] * 2, kMaxUpHoldFrames);
+        }
+
+        raised_ = false;
+        switchTo(tier_ - 1);
+    } else if (underBudgetFrames_ >= upHoldFrames_[std::min(tier_ + 1, tierCount_ - 1)] &&
+               tier_ + 1 < tierCount_) {
+        raised_ = true;
+        framesSinceRaise_ = 0;
+        switchTo(tier_ + 1);
+    }
+
+    if (tier_ == from) {
+        return false;
+    }
+
+    change = {from, tier_, cpuMs_, gpuMs_};
+    return true;
+}
@@ -0,0 +1,148 @@
+#include "shadow_atlas.h"
+#include <algorithm>
+#include <bit>
+
+ShadowAtlas::ShadowAtlas(uint32_t size, uint32_t minTileSize)
+    : size_(std::bit_ceil(size)),
+      minTileSize_(std::clamp(std::bit_ceil(minTileSize), 1u, size_)) {
+    clear();
+}
+
+void ShadowAtlas::clear() {
+    nodes_.clear();
+    freeBlocks_.clear();
+    nodes_.push_back(Node{0, 0, size_, -1, false});
+    usedArea_ = 0;
+}
+
+bool ShadowAtlas::allocate(uint32_t size, Tile& tile) {
+    size = std::clamp(std::bit_ceil(std::max(size, 1u)), minTileSize_, size_);
+
+    // Сначала ищем место в уже разбитых узлах, чтобы не дробить целые свободные квадраты
+    int32_t node = find(0, size, false);
+    if (node < 0) {
+        node = find(0, size, true);
+    }
+    if (node < 0) {
+        return false;
+    }
+
+    nodes_[node].used = true;
+    usedArea_ += static_cast<uint64_t>(size) * size;
+    tile = Tile{nodes_[node].x, nodes_[node].y, size};
+    return true;
+}
+
+int32_t ShadowAtlas::find(int32_t node, uint32_t size, bool allowSplit) {
+    if (nodes_[node].used || nodes_[node].size < size) {
+        return -1;
+    }
+
+    if (nodes_[node].firstChild < 0) {
+        if (nodes_[node].size == size) {
+            return node;
+        }
+        if (!allowSplit) {
+            return -1;
+        }
+        // В только что разбитом узле место гарантированно найдётся
+        split(node);
+    }
+
+    for (int32_t i = 0; i < 4; ++i) {
+        int32_t found = find(nodes_[node].firstChild + i, size, allowSplit);
+        if (found >= 0) {
+            return found;
+        }
+    }
+    return -1;
+}
+
+void ShadowAtlas::split(int32_t node) {
+    int32_t first;
+    if (!freeBlocks_.empty()) {
+        first = freeBlocks_.back();
+        freeBlocks_.pop_back();
+    } else {
+        first = static_cast<int32_t>(nodes_.size());
+        nodes_.resize(nodes_.size() + 4);
+    }
+
+    // nodes_ мог переехать при resize, поэтому копия, а не ссылка
+    Node parent = nodes_[node];
+    uint32_t half = parent.size / 2;
+    nodes_[first + 0] = Node{parent.x, parent.y, half, -1, false};
+    nodes_[first + 1] = Node{parent.x + half, parent.y, half, -1, false};
+    nodes_[first + 2] = Node{parent.x, parent.y + half, half, -1, false};
+    nodes_[first + 3] = Node{parent.x + half, parent.y + half, half, -1, false};
+    nodes_[node].firstChild = first;
+}
+
+void ShadowAtlas::release(const Tile& tile) {
+    if (tile.size != 0 && releaseAt(0, tile)) {
+        usedArea_ -= static_cast<uint64_t>(tile.size) * tile.size;
+    }
+}
+
+bool ShadowAtlas::allocate(const Group& group, uint32_t size) {
+    for (uint32_t i = 0; i < group.count; ++i) {
+        if (!allocate(size, group.tiles[i])) {
+            for (uint32_t j = 0; j < i; ++j) {
+                release(group.tiles[j]);
+                group.tiles[j] = {};
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+void ShadowAtlas::repack(const Group* groups, uint32_t groupCount) {
+    clear();
+    for (uint32_t g = 0; g < groupCount; ++g) {
+        const Group& group = groups[g];
+        std::fill(group.tiles, group.tiles + group.count, Tile{});
+        for (uint32_t size = group.size; size >= minTileSize_; size /= 2) {
+            if (allocate(group, size)) {
+                break;
+            }
+        }
+    }
+}
+
+bool ShadowAtlas::releaseAt(int32_t node, const Tile& tile) {
+    Node& n = nodes_[node];
+    if (tile.x < n.x || tile.y < n.y || tile.x >= n.x + n.size || tile.y >= n.y + n.size) {
+        return false;
+    }
+
+    if (n.size == tile.size) {
+        if (!n.used) {
+            return false;
+        }
+        n.used = false;
+        return true;
+    }
+
+    if (n.firstChild < 0) {
+        return false;
+    }
+
+    int32_t first = n.firstChild;
+    bool released = false;
+    for (int32_t i = 0; i < 4 && !released; ++i) {
+        released = releaseAt(first + i, tile);
+    }
+
+    // Четыре свободных листа снова становятся одним свободным узлом
+    bool mergeable = true;
+    for (int32_t i = 0; i < 4; ++i) {
+        const Node& child = nodes_[first + i];
+        mergeable = mergeable && !child.used && child.firstChild < 0;
+    }
+    if (released && mergeable) {
+        nodes_[node].firstChild = -1;
+        freeBlocks_.push_back(first);
+    }
+    return released;
+}
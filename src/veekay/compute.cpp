@@ -0,0 +1,27 @@
+#include <veekay/compute.hpp>
+
+namespace {
+
+uint32_t graphics_family;
+uint32_t compute_family;
+
+} // namespace
+
+namespace veekay::compute {
+
+// NOTE: Called by veekay::run(), not part of the public interface
+
+void setup(uint32_t graphics_queue_family, uint32_t compute_queue_family) {
+	graphics_family = graphics_queue_family;
+	compute_family = compute_queue_family;
+}
+
+bool isAsync() {
+	return compute_family != graphics_family;
+}
+
+uint32_t queueFamily() {
+	return compute_family;
+}
+
+} // namespace veekay::compute
@@ -0,0 +1,64 @@
+#include <veekay/deletion.hpp>
+
+#include <algorithm>
+#include <climits>
+#include <mutex>
+#include <vector>
+
+#include <veekay/application.hpp>
+
+namespace {
+
+struct Entry {
+	uint64_t timeline_value;
+	std::function<void()> destroy;
+};
+
+std::mutex mutex;
+std::vector<Entry> entries;
+
+} // namespace
+
+namespace veekay::deletion {
+
+// NOTE: Called by veekay::run(), not part of the public interface
+
+// NOTE: Destroys what the GPU is done with, or everything once the device is idle
+void collect(bool all) {
+	uint64_t completed = all ? UINT64_MAX : timelineCompleted();
+
+	std::vector<Entry> done;
+
+	{
+		std::lock_guard lock(mutex);
+
+		auto first_done = std::partition(entries.begin(), entries.end(), [completed](const Entry& e) {
+			return e.timeline_value > completed;
+		});
+
+		done.assign(std::make_move_iterator(first_done), std::make_move_iterator(entries.end()));
+		entries.erase(first_done, entries.end());
+	}
+
+	// NOTE: Outside the lock, a callback may defer something else
+	for (Entry& e : done) {
+		e.destroy();
+	}
+}
+
+void defer(std::function<void()> destroy) {
+	// NOTE: The frame being recorded (or about to be) submits the next value
+	defer(timelineSubmitted() + 1, std::move(destroy));
+}
+
+void defer(uint64_t timeline_value, std::function<void()> destroy) {
+	std::lock_guard lock(mutex);
+	entries.push_back({timeline_value, std::move(destroy)});
+}
+
+size_t pendingCount() {
+	std::lock_guard lock(mutex);
+	return entries.size();
+}
+
+} // namespace veekay::deletion
@@ -5,6 +5,8 @@
 #include <algorithm>
 
 #include <veekay/application.hpp>
+#include <veekay/deletion.hpp>
+
 namespace veekay::graphics {
 
 Buffer::Buffer(size_t size, const void* data,
@@ -251,4 +253,171 @@ Texture::~Texture() {
 	vkDestroyImage(device, image, nullptr);
 }
 
+TransientBuffer::TransientBuffer(VkDeviceSize capacity, VkBufferUsageFlags usage)
+: capacity{capacity}, cursor{0} {
+	buffer = new Buffer(capacity, nullptr, usage);
+}
+
+TransientBuffer::~TransientBuffer() {
+	delete buffer;
+}
+
+TransientAllocation TransientBuffer::allocate(VkDeviceSize size, VkDeviceSize alignment) {
+	VkDeviceSize offset = (cursor + alignment - 1) / alignment * alignment;
+
+	if (offset + size > capacity) {
+		throw std::runtime_error("Vulkan transient buffer is out of space");
+	}
+
+	cursor = offset + size;
+
+	return TransientAllocation{
+		.buffer = buffer->buffer,
+		.offset = offset,
+		.data = static_cast<char*>(buffer->mapped_region) + offset,
+	};
+}
+
+void TransientBuffer::reset() {
+	cursor = 0;
+}
+
+GeometryBuffer::GeometryBuffer(uint32_t vertex_stride,
+                               uint32_t vertex_capacity,
+                               uint32_t index_capacity)
+: vertex_stride{vertex_stride},
+  vertex_capacity{std::max(vertex_capacity, 1u)},
+  index_capacity{std::max(index_capacity, 1u)},
+  vertex_count{0}, index_count{0},
+  freed_vertices{0}, freed_indices{0} {
+	vertex_buffer = new Buffer(size_t(this->vertex_capacity) * vertex_stride, nullptr,
+	                           VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+	index_buffer = new Buffer(size_t(this->index_capacity) * sizeof(uint32_t), nullptr,
+	                          VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+}
+
+GeometryBuffer::~GeometryBuffer() {
+	delete index_buffer;
+	delete vertex_buffer;
+}
+
+uint32_t GeometryBuffer::upload(const void* vertices, uint32_t vertex_count,
+                                const uint32_t* indices, uint32_t index_count) {
+	if (this->vertex_count + vertex_count > vertex_capacity ||
+	    this->index_count + index_count > index_capacity) {
+		// NOTE: The copy reclaims holes too, so only grow past what live meshes need
+		uint32_t vertices_needed = this->vertex_count - freed_vertices + vertex_count;
+		uint32_t indices_needed = this->index_count - freed_indices + index_count;
+
+		reallocate(vertices_needed > vertex_capacity ? std::max(vertex_capacity * 2, vertices_needed) : vertex_capacity,
+		           indices_needed > index_capacity ? std::max(index_capacity * 2, indices_needed) : index_capacity);
+	}
+
+	Mesh mesh{
+		.first_index = this->index_count,
+		.index_count = index_count,
+		.vertex_offset = static_cast<int32_t>(this->vertex_count),
+		.vertex_count = vertex_count,
+		.alive = true,
+	};
+
+	std::copy(static_cast<const char*>(vertices),
+	          static_cast<const char*>(vertices) + size_t(vertex_count) * vertex_stride,
+	          static_cast<char*>(vertex_buffer->mapped_region) + size_t(this->vertex_count) * vertex_stride);
+
+	std::copy(indices, indices + index_count,
+	          static_cast<uint32_t*>(index_buffer->mapped_region) + this->index_count);
+
+	this->vertex_count += vertex_count;
+	this->index_count += index_count;
+
+	meshes.push_back(mesh);
+	return static_cast<uint32_t>(meshes.size() - 1);
+}
+
+void GeometryBuffer::free(uint32_t mesh) {
+	Mesh& m = meshes[mesh];
+	if (!m.alive) {
+		return;
+	}
+
+	m.alive = false;
+
+	// NOTE: Frames in flight may still draw the range, even a trailing one is left for reallocate()
+	freed_vertices += m.vertex_count;
+	freed_indices += m.index_count;
+
+	m.index_count = 0;
+	m.vertex_count = 0;
+}
+
+void GeometryBuffer::compact() {
+	if (freed_vertices > 0 || freed_indices > 0) {
+		reallocate(vertex_capacity, index_capacity);
+	}
+}
+
+void GeometryBuffer::reallocate(uint32_t vertex_capacity, uint32_t index_capacity) {
+	Buffer* vertices = new Buffer(size_t(vertex_capacity) * vertex_stride, nullptr,
+	                              VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+	Buffer* indices = new Buffer(size_t(index_capacity) * sizeof(uint32_t), nullptr,
+	                             VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+
+	const char* src_vertices = static_cast<const char*>(vertex_buffer->mapped_region);
+	const uint32_t* src_indices = static_cast<const uint32_t*>(index_buffer->mapped_region);
+	char* dst_vertices = static_cast<char*>(vertices->mapped_region);
+	uint32_t* dst_indices = static_cast<uint32_t*>(indices->mapped_region);
+
+	uint32_t vertex_cursor = 0;
+	uint32_t index_cursor = 0;
+
+	for (Mesh& m : meshes) {
+		if (!m.alive) {
+			continue;
+		}
+
+		const char* src = src_vertices + size_t(m.vertex_offset) * vertex_stride;
+		std::copy(src, src + size_t(m.vertex_count) * vertex_stride,
+		          dst_vertices + size_t(vertex_cursor) * vertex_stride);
+		std::copy(src_indices + m.first_index, src_indices + m.first_index + m.index_count,
+		          dst_indices + index_cursor);
+
+		m.vertex_offset = static_cast<int32_t>(vertex_cursor);
+		m.first_index = index_cursor;
+
+		vertex_cursor += m.vertex_count;
+		index_cursor += m.index_count;
+	}
+
+	deletion::deferDelete(vertex_buffer);
+	deletion::deferDelete(index_buffer);
+
+	vertex_buffer = vertices;
+	index_buffer = indices;
+	this->vertex_capacity = vertex_capacity;
+	this->index_capacity = index_capacity;
+
+	vertex_count = vertex_cursor;
+	index_count = index_cursor;
+	freed_vertices = 0;
+	freed_indices = 0;
+}
+
+void GeometryBuffer::bind(VkCommandBuffer cmd) const {
+	VkDeviceSize offset = 0;
+	vkCmdBindVertexBuffers(cmd, 0, 1, &vertex_buffer->buffer, &offset);
+	vkCmdBindIndexBuffer(cmd, index_buffer->buffer, 0, VK_INDEX_TYPE_UINT32);
+}
+
+void GeometryBuffer::draw(VkCommandBuffer cmd, uint32_t mesh,
+                          uint32_t instance_count, uint32_t first_instance) const {
+	const Mesh& m = meshes[mesh];
+	if (!m.alive || m.index_count == 0) {
+		return;
+	}
+
+	vkCmdDrawIndexed(cmd, m.index_count, instance_count,
+	                 m.first_index, m.vertex_offset, first_instance);
+}
+
 } // namespace veekay::graphics
@@ -9,6 +9,9 @@
 namespace {
 	// TODO: Move window to Application state?
 	GLFWwindow* window;
+
+	// NOTE: Set by every callback, lets on-demand rendering tell input from a timeout
+	bool activity;
 } // namespace
 
 namespace veekay::input {
@@ -33,6 +36,10 @@ bool isButtonPressed(Button button) {
 }
 
 void setCaptured(bool capture) {
+	if (!window) { // NOTE: Headless runs have nothing to capture
+		return;
+	}
+
 	glfwSetInputMode(window, GLFW_CURSOR,
 	                 capture ? GLFW_CURSOR_DISABLED : GLFW_CURSOR_NORMAL);
 }
@@ -170,6 +177,8 @@ void setup(void* const window_ptr) {
 
 		size_t index = static_cast<size_t>(result);
 
+		activity = true;
+
 		switch (action) {
 			case GLFW_PRESS:
 				keyboard::states[index] = true;
@@ -202,6 +211,8 @@ void setup(void* const window_ptr) {
 				return;
 		}
 
+		activity = true;
+
 		switch (action) {
 			case GLFW_PRESS:
 				mouse::states[index] = true;
@@ -216,11 +227,13 @@ void setup(void* const window_ptr) {
 	glfwSetCursorPosCallback(window, [](GLFWwindow*, double x, double y) {
 		mouse::cursor_position.x = float(x);
 		mouse::cursor_position.y = float(y);
+		activity = true;
 	});
 
 	glfwSetScrollCallback(window, [](GLFWwindow*, double x, double y) {
 		mouse::scroll_delta.x = float(x);
 		mouse::scroll_delta.y = float(y);
+		activity = true;
 	});
 }
 
@@ -232,4 +245,11 @@ void cache() {
 	mouse::scroll_delta = {};
 }
 
+// NOTE: Whether any callback fired since the last call
+bool consumeActivity() {
+	bool result = activity;
+	activity = false;
+	return result;
+}
+
 } // namespace glint::input
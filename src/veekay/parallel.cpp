@@ -0,0 +1,273 @@
+#include <veekay/parallel.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// NOTE: Below this many items per chunk, handing work to another thread costs more than it saves
+constexpr uint32_t min_items_per_thread = 32;
+
+constexpr uint32_t max_threads = 32;
+
+// NOTE: One per recording thread per frame slot, so pools are never shared between threads
+struct ThreadPool {
+	VkCommandPool command_pool;
+	std::vector<VkCommandBuffer> buffers; // NOTE: Reused every time the slot comes around
+	uint32_t used;
+};
+
+struct Job {
+	const veekay::FrameContext* frame;
+	VkRenderPass render_pass;
+	uint32_t subpass;
+	VkFramebuffer framebuffer;
+	uint32_t item_count;
+	uint32_t chunk_count;
+	veekay::parallel::RecordFunc record;
+
+	VkCommandBuffer* results; // NOTE: One per chunk, written by the thread recording it
+};
+
+std::vector<std::vector<ThreadPool>> slots; // NOTE: [frame slot][thread]
+uint32_t current_slot;
+std::atomic<uint32_t> active_threads = 1; // NOTE: Set from update(), read by the recording thread
+
+std::vector<std::thread> workers;
+std::mutex mutex;
+std::condition_variable wake_condition;
+std::condition_variable done_condition;
+Job job;
+uint64_t job_generation;
+uint32_t jobs_pending;
+bool quit;
+
+VkCommandBuffer acquireBuffer(ThreadPool& pool) {
+	if (pool.used == pool.buffers.size()) {
+		VkCommandBufferAllocateInfo info{
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+			.commandPool = pool.command_pool,
+			.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+			.commandBufferCount = 1,
+		};
+
+		VkCommandBuffer buffer;
+		if (vkAllocateCommandBuffers(veekay::app.vk_device, &info, &buffer) != VK_SUCCESS) {
+			std::cerr << "Failed to allocate Vulkan secondary command buffer\n";
+			return VK_NULL_HANDLE;
+		}
+
+		pool.buffers.push_back(buffer);
+	}
+
+	return pool.buffers[pool.used++];
+}
+
+void recordChunk(uint32_t chunk) {
+	ThreadPool& pool = slots[current_slot][chunk];
+
+	VkCommandBuffer cmd = acquireBuffer(pool);
+	job.results[chunk] = cmd;
+
+	if (cmd == VK_NULL_HANDLE) {
+		return;
+	}
+
+	VkCommandBufferInheritanceInfo inheritance{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+		.renderPass = job.render_pass,
+		.subpass = job.subpass,
+		.framebuffer = job.framebuffer,
+	};
+
+	VkCommandBufferBeginInfo info{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+		         VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+		.pInheritanceInfo = &inheritance,
+	};
+
+	vkBeginCommandBuffer(cmd, &info);
+
+	uint32_t first = uint64_t(job.item_count) * chunk / job.chunk_count;
+	uint32_t last = uint64_t(job.item_count) * (chunk + 1) / job.chunk_count;
+
+	job.record(cmd, *job.frame, first, last - first);
+
+	vkEndCommandBuffer(cmd);
+}
+
+void workerLoop(uint32_t thread_index) {
+	uint64_t seen_generation = 0;
+
+	for (;;) {
+		{
+			std::unique_lock lock(mutex);
+			wake_condition.wait(lock, [&] { return quit || job_generation != seen_generation; });
+
+			if (quit) {
+				return;
+			}
+
+			seen_generation = job_generation;
+
+			if (thread_index >= job.chunk_count) {
+				continue;
+			}
+		}
+
+		recordChunk(thread_index);
+
+		{
+			std::lock_guard lock(mutex);
+			if (--jobs_pending == 0) {
+				done_condition.notify_one();
+			}
+		}
+	}
+}
+
+} // namespace
+
+namespace veekay::parallel {
+
+// NOTE: Called by veekay::run(), not part of the public interface
+
+bool setup(uint32_t worker_count, uint32_t frames_in_flight, uint32_t queue_family) {
+	worker_count = std::min(worker_count, max_threads - 1);
+
+	slots.resize(frames_in_flight);
+
+	for (auto& threads : slots) {
+		threads.resize(worker_count + 1);
+
+		for (ThreadPool& pool : threads) {
+			VkCommandPoolCreateInfo info{
+				.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+				.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+				.queueFamilyIndex = queue_family,
+			};
+
+			if (vkCreateCommandPool(app.vk_device, &info, nullptr, &pool.command_pool) != VK_SUCCESS) {
+				std::cerr << "Failed to create Vulkan command pool for recording thread\n";
+				return false;
+			}
+
+			pool.used = 0;
+		}
+	}
+
+	quit = false;
+	job_generation = 0;
+
+	for (uint32_t i = 1; i <= worker_count; ++i) {
+		workers.emplace_back(workerLoop, i);
+	}
+
+	active_threads = worker_count + 1;
+
+	return true;
+}
+
+void shutdown() {
+	{
+		std::lock_guard lock(mutex);
+		quit = true;
+	}
+
+	wake_condition.notify_all();
+
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+
+	workers.clear();
+
+	for (auto& threads : slots) {
+		for (ThreadPool& pool : threads) {
+			vkDestroyCommandPool(app.vk_device, pool.command_pool, nullptr);
+		}
+	}
+
+	slots.clear();
+}
+
+// NOTE: Call after the slot's timeline wait, recycles every thread's buffers of that slot
+void beginFrame(uint32_t slot_index) {
+	current_slot = slot_index;
+
+	for (ThreadPool& pool : slots[slot_index]) {
+		if (pool.used != 0) {
+			vkResetCommandPool(app.vk_device, pool.command_pool, 0);
+			pool.used = 0;
+		}
+	}
+}
+
+uint32_t maxThreadCount() {
+	return static_cast<uint32_t>(workers.size()) + 1;
+}
+
+void setThreadCount(uint32_t count) {
+	active_threads.store(std::clamp(count, 1u, maxThreadCount()), std::memory_order_relaxed);
+}
+
+uint32_t threadCount() {
+	return active_threads.load(std::memory_order_relaxed);
+}
+
+void recordSubpass(const FrameContext& frame,
+                   VkRenderPass render_pass, uint32_t subpass, VkFramebuffer framebuffer,
+                   uint32_t item_count, RecordFunc record) {
+	uint32_t chunk_count = std::clamp((item_count + min_items_per_thread - 1) / min_items_per_thread,
+	                                  1u, threadCount());
+
+	VkCommandBuffer results[max_threads];
+
+	{ // NOTE: Idle workers may still be looking at the previous job, so publish under the lock
+		std::lock_guard lock(mutex);
+
+		job = {
+			.frame = &frame,
+			.render_pass = render_pass,
+			.subpass = subpass,
+			.framebuffer = framebuffer,
+			.item_count = item_count,
+			.chunk_count = chunk_count,
+			.record = record,
+			.results = results,
+		};
+
+		if (chunk_count > 1) {
+			jobs_pending = chunk_count - 1;
+			++job_generation;
+		}
+	}
+
+	if (chunk_count > 1) {
+		wake_condition.notify_all();
+	}
+
+	recordChunk(0);
+
+	if (chunk_count > 1) {
+		std::unique_lock lock(mutex);
+		done_condition.wait(lock, [] { return jobs_pending == 0; });
+	}
+
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < chunk_count; ++i) {
+		if (results[i] != VK_NULL_HANDLE) {
+			results[count++] = results[i];
+		}
+	}
+
+	vkCmdExecuteCommands(frame.command_buffer, count, results);
+}
+
+} // namespace veekay::parallel
@@ -0,0 +1,485 @@
+#include <veekay/profiler.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+
+#include <imgui.h>
+
+#include <veekay/application.hpp>
+
+namespace {
+
+// NOTE: Frames kept for the overlay's rolling average and p99
+constexpr size_t history_size = 256;
+
+constexpr size_t cpu_stage_count = static_cast<size_t>(veekay::profiler::CpuStage::count);
+
+struct Slot {
+	VkQueryPool query_pool;
+	uint32_t query_count; // NOTE: Timestamps written by the frame currently using the slot
+	bool pending;         // NOTE: Holds a submitted frame whose results were not read yet
+
+	veekay::profiler::FrameTimings timings;
+
+	// NOTE: Pass id of each begin/end query pair
+	uint32_t pass_ids[veekay::profiler::max_passes];
+	uint32_t pass_count;
+};
+
+bool gpu_supported;
+double timestamp_period_ms;
+uint64_t timestamp_mask;
+
+std::vector<Slot> slots;
+
+/* NOTE:
+	With a pipelined loop the simulation thread starts frame N+1 while the
+	render thread still records frame N, so each thread tracks its own frame.
+*/
+thread_local Slot* current;
+thread_local std::vector<uint32_t> open_passes; // NOTE: Indices into current->pass_ids
+
+// NOTE: Guards pass_names, history and session, which both threads touch
+std::mutex mutex;
+
+std::vector<std::string> pass_names;
+
+std::vector<veekay::profiler::FrameTimings> history;
+size_t history_head;
+
+bool keep_session;
+std::vector<veekay::profiler::FrameTimings> session;
+
+bool overlay_visible;
+
+uint32_t passId(const char* name) {
+	std::lock_guard lock(mutex);
+
+	for (uint32_t i = 0; i < pass_names.size(); ++i) {
+		if (pass_names[i] == name) {
+			return i;
+		}
+	}
+
+	if (pass_names.size() == veekay::profiler::max_passes) {
+		return UINT32_MAX;
+	}
+
+	pass_names.emplace_back(name);
+	return static_cast<uint32_t>(pass_names.size() - 1);
+}
+
+void resolve(Slot& slot) {
+	veekay::profiler::FrameTimings& timings = slot.timings;
+
+	timings.gpu_ms = 0.0;
+	std::fill(std::begin(timings.pass_ms), std::end(timings.pass_ms), -1.0);
+
+	if (gpu_supported && slot.query_count != 0) {
+		uint64_t stamps[veekay::profiler::max_passes * 2];
+
+		// NOTE: The slot's timeline value was reached, so results are available without waiting
+		VkResult result = vkGetQueryPoolResults(veekay::app.vk_device, slot.query_pool,
+		                                        0, slot.query_count,
+		                                        sizeof(stamps), stamps, sizeof(uint64_t),
+		                                        VK_QUERY_RESULT_64_BIT);
+
+		if (result == VK_SUCCESS) {
+			uint64_t first = UINT64_MAX;
+			uint64_t last = 0;
+
+			for (uint32_t i = 0; i < slot.pass_count; ++i) {
+				uint64_t begin = stamps[i * 2] & timestamp_mask;
+				uint64_t end = stamps[i * 2 + 1] & timestamp_mask;
+
+				double& ms = timings.pass_ms[slot.pass_ids[i]];
+				ms = std::max(ms, 0.0) + double(end - begin) * timestamp_period_ms;
+
+				first = std::min(first, begin);
+				last = std::max(last, end);
+			}
+
+			timings.gpu_ms = double(last - first) * timestamp_period_ms;
+		}
+	}
+
+	std::lock_guard lock(mutex);
+
+	if (history.size() < history_size) {
+		history.push_back(timings);
+	} else {
+		history[history_head] = timings;
+	}
+
+	history_head = (history_head + 1) % history_size;
+
+	if (keep_session) {
+		session.push_back(timings);
+	}
+}
+
+struct Summary {
+	double average;
+	double p99;
+};
+
+template <typename Getter>
+Summary summarize(Getter get) {
+	std::vector<double> values;
+	values.reserve(history.size());
+
+	for (const auto& timings : history) {
+		double value = get(timings);
+		if (value >= 0.0) {
+			values.push_back(value);
+		}
+	}
+
+	if (values.empty()) {
+		return {0.0, 0.0};
+	}
+
+	double sum = 0.0;
+	for (double value : values) {
+		sum += value;
+	}
+
+	size_t index = std::min(values.size() - 1, values.size() * 99 / 100);
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+
+	return {sum / values.size(), values[index]};
+}
+
+void overlayRow(const char* name, Summary summary) {
+	ImGui::TableNextRow();
+	ImGui::TableNextColumn();
+	ImGui::TextUnformatted(name);
+	ImGui::TableNextColumn();
+	ImGui::Text("%.3f", summary.average);
+	ImGui::TableNextColumn();
+	ImGui::Text("%.3f", summary.p99);
+}
+
+bool writeCSV(std::ofstream& file) {
+	file << "frame";
+	for (size_t i = 0; i < cpu_stage_count; ++i) {
+		file << ",cpu_" << veekay::profiler::cpuStageName(static_cast<veekay::profiler::CpuStage>(i)) << "_ms";
+	}
+	file << ",input_to_present_ms,gpu_ms";
+	for (const std::string& name : pass_names) {
+		file << ",gpu_" << name << "_ms";
+	}
+	file << '\n';
+
+	for (const auto& timings : session) {
+		file << timings.number;
+		for (double ms : timings.cpu_ms) {
+			file << ',' << ms;
+		}
+		file << ',' << timings.latency_ms << ',' << timings.gpu_ms;
+		for (size_t i = 0; i < pass_names.size(); ++i) {
+			file << ',';
+			if (timings.pass_ms[i] >= 0.0) {
+				file << timings.pass_ms[i];
+			}
+		}
+		file << '\n';
+	}
+
+	return bool(file);
+}
+
+bool writeJSON(std::ofstream& file) {
+	file << "{\n\t\"passes\": [";
+	for (size_t i = 0; i < pass_names.size(); ++i) {
+		file << (i ? ", " : "") << '"' << pass_names[i] << '"';
+	}
+	file << "],\n\t\"frames\": [\n";
+
+	for (size_t f = 0; f < session.size(); ++f) {
+		const auto& timings = session[f];
+
+		file << "\t\t{\"frame\": " << timings.number << ", \"cpu_ms\": {";
+		for (size_t i = 0; i < cpu_stage_count; ++i) {
+			file << (i ? ", " : "") << '"'
+			     << veekay::profiler::cpuStageName(static_cast<veekay::profiler::CpuStage>(i))
+			     << "\": " << timings.cpu_ms[i];
+		}
+		file << "}, \"input_to_present_ms\": " << timings.latency_ms
+		     << ", \"gpu_ms\": " << timings.gpu_ms << ", \"pass_ms\": {";
+
+		bool first = true;
+		for (size_t i = 0; i < pass_names.size(); ++i) {
+			if (timings.pass_ms[i] >= 0.0) {
+				file << (first ? "" : ", ") << '"' << pass_names[i] << "\": " << timings.pass_ms[i];
+				first = false;
+			}
+		}
+		file << "}}" << (f + 1 < session.size() ? "," : "") << '\n';
+	}
+
+	file << "\t]\n}\n";
+
+	return bool(file);
+}
+
+} // namespace
+
+namespace veekay::profiler {
+
+// NOTE: Called by veekay::run(), not part of the public interface
+
+void setup(uint32_t queue_family, uint32_t frames_in_flight, bool record_session) {
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(app.vk_physical_device, &properties);
+
+	uint32_t family_count = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(app.vk_physical_device, &family_count, nullptr);
+
+	std::vector<VkQueueFamilyProperties> families(family_count);
+	vkGetPhysicalDeviceQueueFamilyProperties(app.vk_physical_device, &family_count, families.data());
+
+	uint32_t valid_bits = families[queue_family].timestampValidBits;
+
+	gpu_supported = valid_bits != 0 && properties.limits.timestampPeriod > 0.0f;
+	timestamp_period_ms = double(properties.limits.timestampPeriod) / 1e6;
+	timestamp_mask = valid_bits >= 64 ? UINT64_MAX : (uint64_t(1) << valid_bits) - 1;
+
+	if (!gpu_supported) {
+		std::cerr << "Timestamp queries are not supported, GPU timings are disabled\n";
+	}
+
+	slots.resize(frames_in_flight);
+
+	for (Slot& slot : slots) {
+		slot = {};
+
+		if (!gpu_supported) {
+			continue;
+		}
+
+		VkQueryPoolCreateInfo info{
+			.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+			.queryType = VK_QUERY_TYPE_TIMESTAMP,
+			.queryCount = max_passes * 2,
+		};
+
+		if (vkCreateQueryPool(app.vk_device, &info, nullptr, &slot.query_pool) != VK_SUCCESS) {
+			std::cerr << "Failed to create Vulkan timestamp query pool, GPU timings are disabled\n";
+			gpu_supported = false;
+			continue;
+		}
+
+		vkResetQueryPool(app.vk_device, slot.query_pool, 0, max_passes * 2);
+	}
+
+	keep_session = record_session;
+}
+
+void shutdown() {
+	for (Slot& slot : slots) {
+		if (slot.query_pool != VK_NULL_HANDLE) {
+			vkDestroyQueryPool(app.vk_device, slot.query_pool, nullptr);
+		}
+	}
+
+	slots.clear();
+}
+
+// NOTE: Call after the slot's timeline wait, collects the results of its previous frame
+void beginFrame(uint32_t slot_index, uint64_t number) {
+	Slot& slot = slots[slot_index];
+
+	if (slot.pending) {
+		resolve(slot);
+
+		if (gpu_supported && slot.query_count != 0) {
+			vkResetQueryPool(app.vk_device, slot.query_pool, 0, slot.query_count);
+		}
+	}
+
+	slot.pending = false;
+	slot.query_count = 0;
+	slot.pass_count = 0;
+	slot.timings = {};
+	slot.timings.number = number;
+
+	current = &slot;
+	open_passes.clear();
+}
+
+// NOTE: Makes the calling thread record into the slot, for frames begun on another thread
+void bindFrame(uint32_t slot_index) {
+	current = &slots[slot_index];
+	open_passes.clear();
+}
+
+// NOTE: Collects every frame still in flight, the device must be idle
+void finish() {
+	std::vector<Slot*> pending;
+
+	for (Slot& slot : slots) {
+		if (slot.pending) {
+			pending.push_back(&slot);
+		}
+	}
+
+	std::sort(pending.begin(), pending.end(), [](const Slot* a, const Slot* b) {
+		return a->timings.number < b->timings.number;
+	});
+
+	for (Slot* slot : pending) {
+		resolve(*slot);
+		slot->pending = false;
+	}
+}
+
+void recordCpu(CpuStage stage, double ms) {
+	current->timings.cpu_ms[static_cast<size_t>(stage)] = ms;
+}
+
+void recordLatency(double ms) {
+	current->timings.latency_ms = ms;
+}
+
+// NOTE: Marks the frame as submitted, present time may still be recorded afterwards
+void endFrame() {
+	current->pending = true;
+
+	if (!open_passes.empty()) {
+		std::lock_guard lock(mutex);
+		std::cerr << "Profiler pass \"" << pass_names[current->pass_ids[open_passes.back()]]
+		          << "\" was not closed\n";
+	}
+}
+
+void drawOverlay() {
+	if (!overlay_visible) {
+		return;
+	}
+
+	std::lock_guard lock(mutex);
+
+	ImGui::SetNextWindowBgAlpha(0.75f);
+	if (ImGui::Begin("Profiler", &overlay_visible, ImGuiWindowFlags_AlwaysAutoResize)) {
+		ImGui::Text("Last %zu frames", history.size());
+
+		if (ImGui::BeginTable("timings", 3, ImGuiTableFlags_RowBg)) {
+			ImGui::TableSetupColumn("Stage");
+			ImGui::TableSetupColumn("avg ms");
+			ImGui::TableSetupColumn("p99 ms");
+			ImGui::TableHeadersRow();
+
+			for (size_t i = 0; i < cpu_stage_count; ++i) {
+				std::string name = std::string("CPU ") + cpuStageName(static_cast<CpuStage>(i));
+				overlayRow(name.c_str(), summarize([i](const FrameTimings& t) { return t.cpu_ms[i]; }));
+			}
+
+			overlayRow("Input to present", summarize([](const FrameTimings& t) { return t.latency_ms; }));
+
+			if (gpu_supported) {
+				overlayRow("GPU frame", summarize([](const FrameTimings& t) { return t.gpu_ms; }));
+
+				for (size_t i = 0; i < pass_names.size(); ++i) {
+					std::string name = "GPU " + pass_names[i];
+					overlayRow(name.c_str(), summarize([i](const FrameTimings& t) { return t.pass_ms[i]; }));
+				}
+			}
+
+			ImGui::EndTable();
+		}
+	}
+	ImGui::End();
+}
+
+void beginPass(VkCommandBuffer cmd, const char* name) {
+	if (current->pass_count == max_passes) {
+		std::cerr << "Too many profiler passes in one frame, \"" << name << "\" is ignored\n";
+		return;
+	}
+
+	uint32_t id = passId(name);
+
+	if (id == UINT32_MAX) {
+		std::cerr << "Too many distinct profiler passes, \"" << name << "\" is ignored\n";
+		return;
+	}
+
+	uint32_t index = current->pass_count++;
+
+	current->pass_ids[index] = id;
+	open_passes.push_back(index);
+
+	if (gpu_supported) {
+		vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, current->query_pool, index * 2);
+		current->query_count = std::max(current->query_count, index * 2 + 2);
+	}
+}
+
+void endPass(VkCommandBuffer cmd) {
+	if (open_passes.empty()) {
+		return;
+	}
+
+	uint32_t index = open_passes.back();
+	open_passes.pop_back();
+
+	if (gpu_supported) {
+		vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, current->query_pool, index * 2 + 1);
+	}
+}
+
+bool latest(FrameTimings& timings) {
+	std::lock_guard lock(mutex);
+
+	if (history.empty()) {
+		return false;
+	}
+
+	timings = history[(history_head + history_size - 1) % history_size];
+	return true;
+}
+
+const std::vector<std::string>& passNames() {
+	return pass_names;
+}
+
+const char* cpuStageName(CpuStage stage) {
+	switch (stage) {
+	case CpuStage::update: return "update";
+	case CpuStage::record: return "record";
+	case CpuStage::submit: return "submit";
+	case CpuStage::present: return "present";
+	default: return "unknown";
+	}
+}
+
+void setOverlayVisible(bool visible) {
+	overlay_visible = visible;
+}
+
+bool isOverlayVisible() {
+	return overlay_visible;
+}
+
+bool exportTimings(const char* path) {
+	std::ofstream file(path);
+	if (!file) {
+		std::cerr << "Failed to open " << path << " for writing\n";
+		return false;
+	}
+
+	std::lock_guard lock(mutex);
+
+	size_t length = std::strlen(path);
+	bool json = length >= 5 && std::strcmp(path + length - 5, ".json") == 0;
+
+	return json ? writeJSON(file) : writeCSV(file);
+}
+
+} // namespace veekay::profiler
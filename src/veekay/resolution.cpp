@@ -0,0 +1,618 @@
+#include <veekay/resolution.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+#include <veekay/application.hpp>
+#include <veekay/profiler.hpp>
+
+namespace {
+
+constexpr char vertex_shader_path[] = "shaders/upscale_vert.spv";
+constexpr char fragment_shader_path[] = "shaders/upscale_frag.spv";
+
+// NOTE: Default budget when ApplicationInfo::target_frame_ms is 0
+constexpr double default_target_ms = 1000.0 / 60.0;
+
+// NOTE: Weight of a new GPU sample in the running average, timestamps are noisy
+constexpr double smoothing = 0.2;
+
+// NOTE: Within this fraction of the budget the scale is left alone, avoids oscillation
+constexpr double dead_band = 0.1;
+
+// NOTE: Largest scale change per GPU sample, results lag frames_in_flight frames behind
+constexpr float max_step = 0.05f;
+
+// NOTE: Every resize allocates a new set while retired ones wait for frames in flight
+constexpr uint32_t max_descriptor_sets = veekay::max_frames_in_flight + 2;
+
+struct PushConstants {
+	float uv_scale[2]; // NOTE: Rendered part of the scene target, in UV
+	float texel[2];    // NOTE: One texel of the scene target, in UV
+	float sharpness;
+};
+
+bool enabled;
+bool dynamic = true;
+
+float scale = veekay::resolution::max_scale;
+double target_ms;
+double gpu_ms;
+uint64_t last_sample = UINT64_MAX;
+veekay::resolution::ControllerState state = veekay::resolution::ControllerState::no_timings;
+
+// NOTE: Read by the render thread when recording the upscale
+std::atomic<float> sharpness_value = 0.5f;
+
+VkRenderPass scene_render_pass;
+VkFormat color_format;
+
+VkImage color_image;
+VkDeviceMemory color_memory;
+VkImageView color_view;
+VkFramebuffer scene_framebuffer;
+
+VkSampler sampler;
+VkDescriptorSetLayout descriptor_set_layout;
+VkDescriptorPool descriptor_pool;
+VkDescriptorSet descriptor_set;
+VkPipelineLayout pipeline_layout;
+VkPipeline pipeline;
+
+VkShaderModule loadShaderModule(const char* path) {
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file) {
+		std::cerr << "Failed to open shader " << path << '\n';
+		return VK_NULL_HANDLE;
+	}
+
+	size_t size = file.tellg();
+	std::vector<uint32_t> code(size / sizeof(uint32_t));
+
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(code.data()), size);
+
+	VkShaderModuleCreateInfo info{
+		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+		.codeSize = size,
+		.pCode = code.data(),
+	};
+
+	VkShaderModule module;
+	if (vkCreateShaderModule(veekay::app.vk_device, &info, nullptr, &module) != VK_SUCCESS) {
+		std::cerr << "Failed to create Vulkan shader module from " << path << '\n';
+		return VK_NULL_HANDLE;
+	}
+
+	return module;
+}
+
+bool createSceneTarget(VkRenderPass scene_pass, VkFormat format, VkImageView depth_view) {
+	VkDevice device = veekay::app.vk_device;
+
+	{
+		VkImageCreateInfo info{
+			.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+			.imageType = VK_IMAGE_TYPE_2D,
+			.format = format,
+			.extent = {veekay::app.window_width, veekay::app.window_height, 1},
+			.mipLevels = 1,
+			.arrayLayers = 1,
+			.samples = VK_SAMPLE_COUNT_1_BIT,
+			.tiling = VK_IMAGE_TILING_OPTIMAL,
+			.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		};
+
+		if (vkCreateImage(device, &info, nullptr, &color_image) != VK_SUCCESS) {
+			std::cerr << "Failed to create Vulkan scene color image\n";
+			return false;
+		}
+	}
+
+	{
+		VkMemoryRequirements requirements;
+		vkGetImageMemoryRequirements(device, color_image, &requirements);
+
+		VkPhysicalDeviceMemoryProperties properties;
+		vkGetPhysicalDeviceMemoryProperties(veekay::app.vk_physical_device, &properties);
+
+		uint32_t index = UINT_MAX;
+		for (uint32_t i = 0; i < properties.memoryTypeCount; ++i) {
+			const VkMemoryType& type = properties.memoryTypes[i];
+
+			if ((requirements.memoryTypeBits & (1 << i)) &&
+			    (type.propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
+				index = i;
+				break;
+			}
+		}
+
+		if (index == UINT_MAX) {
+			std::cerr << "Failed to find required memory type for Vulkan scene color image\n";
+			return false;
+		}
+
+		VkMemoryAllocateInfo info{
+			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+			.allocationSize = requirements.size,
+			.memoryTypeIndex = index,
+		};
+
+		if (vkAllocateMemory(device, &info, nullptr, &color_memory) != VK_SUCCESS ||
+		    vkBindImageMemory(device, color_image, color_memory, 0) != VK_SUCCESS) {
+			std::cerr << "Failed to allocate memory for Vulkan scene color image\n";
+			return false;
+		}
+	}
+
+	{
+		VkImageViewCreateInfo info{
+			.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+			.image = color_image,
+			.viewType = VK_IMAGE_VIEW_TYPE_2D,
+			.format = format,
+			.subresourceRange = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.baseMipLevel = 0,
+				.levelCount = 1,
+				.baseArrayLayer = 0,
+				.layerCount = 1,
+			},
+		};
+
+		if (vkCreateImageView(device, &info, nullptr, &color_view) != VK_SUCCESS) {
+			std::cerr << "Failed to create Vulkan scene color image view\n";
+			return false;
+		}
+	}
+
+	{
+		VkImageView attachments[] = {color_view, depth_view};
+
+		VkFramebufferCreateInfo info{
+			.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+			.renderPass = scene_pass,
+			.attachmentCount = 2,
+			.pAttachments = attachments,
+			.width = veekay::app.window_width,
+			.height = veekay::app.window_height,
+			.layers = 1,
+		};
+
+		if (vkCreateFramebuffer(device, &info, nullptr, &scene_framebuffer) != VK_SUCCESS) {
+			std::cerr << "Failed to create Vulkan scene framebuffer\n";
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool createUpscalePipeline(VkRenderPass present_pass, uint32_t subpass) {
+	VkDevice device = veekay::app.vk_device;
+
+	{
+		VkSamplerCreateInfo info{
+			.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+			.magFilter = VK_FILTER_LINEAR,
+			.minFilter = VK_FILTER_LINEAR,
+			.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+			.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+			.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+			.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+			.maxLod = 0.0f,
+		};
+
+		if (vkCreateSampler(device, &info, nullptr, &sampler) != VK_SUCCESS) {
+			std::cerr << "Failed to create Vulkan upscale sampler\n";
+			return false;
+		}
+	}
+
+	{
+		VkDescriptorSetLayoutBinding binding{
+			.binding = 0,
+			.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+		};
+
+		VkDescriptorSetLayoutCreateInfo info{
+			.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+			.bindingCount = 1,
+			.pBindings = &binding,
+		};
+
+		if (vkCreateDescriptorSetLayout(device, &info, nullptr, &descriptor_set_layout) != VK_SUCCESS) {
+			std::cerr << "Failed to create Vulkan upscale descriptor set layout\n";
+			return false;
+		}
+	}
+
+	{
+		VkDescriptorPoolSize size{
+			.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			.descriptorCount = max_descriptor_sets,
+		};
+
+		VkDescriptorPoolCreateInfo info{
+			.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+			.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
+			.maxSets = max_descriptor_sets,
+			.poolSizeCount = 1,
+			.pPoolSizes = &size,
+		};
+
+		if (vkCreateDescriptorPool(device, &info, nullptr, &descriptor_pool) != VK_SUCCESS) {
+			std::cerr << "Failed to create Vulkan upscale descriptor pool\n";
+			return false;
+		}
+	}
+
+	{
+		VkPushConstantRange range{
+			.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+			.offset = 0,
+			.size = sizeof(PushConstants),
+		};
+
+		VkPipelineLayoutCreateInfo info{
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+			.setLayoutCount = 1,
+			.pSetLayouts = &descriptor_set_layout,
+			.pushConstantRangeCount = 1,
+			.pPushConstantRanges = &range,
+		};
+
+		if (vkCreatePipelineLayout(device, &info, nullptr, &pipeline_layout) != VK_SUCCESS) {
+			std::cerr << "Failed to create Vulkan upscale pipeline layout\n";
+			return false;
+		}
+	}
+
+	VkShaderModule vertex_module = loadShaderModule(vertex_shader_path);
+	VkShaderModule fragment_module = loadShaderModule(fragment_shader_path);
+
+	if (vertex_module == VK_NULL_HANDLE || fragment_module == VK_NULL_HANDLE) {
+		vkDestroyShaderModule(device, vertex_module, nullptr);
+		vkDestroyShaderModule(device, fragment_module, nullptr);
+		return false;
+	}
+
+	VkPipelineShaderStageCreateInfo stages[] = {
+		{
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.stage = VK_SHADER_STAGE_VERTEX_BIT,
+			.module = vertex_module,
+			.pName = "main",
+		},
+		{
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+			.module = fragment_module,
+			.pName = "main",
+		},
+	};
+
+	// NOTE: Fullscreen triangle generated from gl_VertexIndex, no vertex buffers
+	VkPipelineVertexInputStateCreateInfo vertex_input{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+	};
+
+	VkPipelineInputAssemblyStateCreateInfo input_assembly{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+		.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+	};
+
+	VkPipelineViewportStateCreateInfo viewport{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+		.viewportCount = 1,
+		.scissorCount = 1,
+	};
+
+	VkPipelineRasterizationStateCreateInfo rasterization{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+		.polygonMode = VK_POLYGON_MODE_FILL,
+		.cullMode = VK_CULL_MODE_NONE,
+		.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+		.lineWidth = 1.0f,
+	};
+
+	VkPipelineMultisampleStateCreateInfo multisample{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+		.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+	};
+
+	VkPipelineColorBlendAttachmentState blend_attachment{
+		.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+		                  VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+	};
+
+	VkPipelineColorBlendStateCreateInfo blend{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+		.attachmentCount = 1,
+		.pAttachments = &blend_attachment,
+	};
+
+	VkDynamicState dynamic_states[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+
+	VkPipelineDynamicStateCreateInfo dynamic_state{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+		.dynamicStateCount = 2,
+		.pDynamicStates = dynamic_states,
+	};
+
+	VkGraphicsPipelineCreateInfo info{
+		.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+		.stageCount = 2,
+		.pStages = stages,
+		.pVertexInputState = &vertex_input,
+		.pInputAssemblyState = &input_assembly,
+		.pViewportState = &viewport,
+		.pRasterizationState = &rasterization,
+		.pMultisampleState = &multisample,
+		.pColorBlendState = &blend,
+		.pDynamicState = &dynamic_state,
+		.layout = pipeline_layout,
+		.renderPass = present_pass,
+		.subpass = subpass,
+	};
+
+	VkResult result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &info, nullptr, &pipeline);
+
+	vkDestroyShaderModule(device, vertex_module, nullptr);
+	vkDestroyShaderModule(device, fragment_module, nullptr);
+
+	if (result != VK_SUCCESS) {
+		std::cerr << "Failed to create Vulkan upscale pipeline\n";
+		return false;
+	}
+
+	return true;
+}
+
+// NOTE: Points a fresh set at the current scene target, in-flight frames keep their old one
+bool allocateDescriptorSet() {
+	VkDevice device = veekay::app.vk_device;
+
+	VkDescriptorSetAllocateInfo info{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.descriptorPool = descriptor_pool,
+		.descriptorSetCount = 1,
+		.pSetLayouts = &descriptor_set_layout,
+	};
+
+	if (vkAllocateDescriptorSets(device, &info, &descriptor_set) != VK_SUCCESS) {
+		std::cerr << "Failed to allocate Vulkan upscale descriptor set\n";
+		return false;
+	}
+
+	VkDescriptorImageInfo image_info{
+		.sampler = sampler,
+		.imageView = color_view,
+		.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	};
+
+	VkWriteDescriptorSet write{
+		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+		.dstSet = descriptor_set,
+		.dstBinding = 0,
+		.descriptorCount = 1,
+		.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+		.pImageInfo = &image_info,
+	};
+
+	vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+
+	return true;
+}
+
+// NOTE: GPU time grows roughly with pixel count, so the scale follows the square root of the ratio
+void updateController() {
+	using veekay::resolution::ControllerState;
+
+	if (!dynamic) {
+		state = ControllerState::manual;
+		return;
+	}
+
+	veekay::profiler::FrameTimings timings;
+	if (!veekay::profiler::latest(timings) || timings.gpu_ms <= 0.0) {
+		state = ControllerState::no_timings;
+		return;
+	}
+
+	if (timings.number == last_sample) {
+		return;
+	}
+
+	gpu_ms = last_sample == UINT64_MAX ? timings.gpu_ms : gpu_ms + (timings.gpu_ms - gpu_ms) * smoothing;
+	last_sample = timings.number;
+
+	double ratio = target_ms / gpu_ms;
+
+	if (std::abs(ratio - 1.0) <= dead_band) {
+		state = ControllerState::stable;
+		return;
+	}
+
+	float desired = std::clamp(float(scale * std::sqrt(ratio)),
+	                           veekay::resolution::min_scale, veekay::resolution::max_scale);
+	float next = scale + std::clamp(desired - scale, -max_step, max_step);
+
+	state = next < scale ? ControllerState::lowering :
+	        next > scale ? ControllerState::raising : ControllerState::stable;
+	scale = next;
+}
+
+uint32_t scaledExtent(uint32_t size) {
+	return std::max(1u, static_cast<uint32_t>(std::lround(size * scale)));
+}
+
+} // namespace
+
+namespace veekay::resolution {
+
+// NOTE: Called by veekay::run(), not part of the public interface
+
+bool setup(VkRenderPass scene_pass, VkRenderPass present_pass, uint32_t upscale_subpass,
+           VkFormat format, VkImageView depth_view, double target_frame_ms) {
+	enabled = true;
+	target_ms = target_frame_ms > 0.0 ? target_frame_ms : default_target_ms;
+
+	scene_render_pass = scene_pass;
+	color_format = format;
+
+	return createSceneTarget(scene_pass, format, depth_view) &&
+	       createUpscalePipeline(present_pass, upscale_subpass) &&
+	       allocateDescriptorSet();
+}
+
+/* NOTE:
+	Rebuilds the scene target at the new window size. Frames in flight still
+	render into and sample the old one, so instead of destroying it the caller
+	gets destroy_old to run once they are done. Left empty when disabled.
+*/
+bool resize(VkImageView depth_view, std::function<void()>& destroy_old) {
+	if (!enabled) {
+		return true;
+	}
+
+	destroy_old = [image = color_image, memory = color_memory, view = color_view,
+	               framebuffer = scene_framebuffer, set = descriptor_set] {
+		VkDevice device = app.vk_device;
+
+		vkFreeDescriptorSets(device, descriptor_pool, 1, &set);
+		vkDestroyFramebuffer(device, framebuffer, nullptr);
+		vkDestroyImageView(device, view, nullptr);
+		vkDestroyImage(device, image, nullptr);
+		vkFreeMemory(device, memory, nullptr);
+	};
+
+	return createSceneTarget(scene_render_pass, color_format, depth_view) && allocateDescriptorSet();
+}
+
+void shutdown() {
+	if (!enabled) {
+		return;
+	}
+
+	VkDevice device = app.vk_device;
+
+	vkDestroyPipeline(device, pipeline, nullptr);
+	vkDestroyPipelineLayout(device, pipeline_layout, nullptr);
+	vkDestroyDescriptorPool(device, descriptor_pool, nullptr);
+	vkDestroyDescriptorSetLayout(device, descriptor_set_layout, nullptr);
+	vkDestroySampler(device, sampler, nullptr);
+
+	vkDestroyFramebuffer(device, scene_framebuffer, nullptr);
+	vkDestroyImageView(device, color_view, nullptr);
+	vkDestroyImage(device, color_image, nullptr);
+	vkFreeMemory(device, color_memory, nullptr);
+
+	enabled = false;
+}
+
+// NOTE: Picks the frame's scene extent, call after the slot's profiler::beginFrame
+void beginFrame(FrameContext& frame) {
+	if (enabled) {
+		updateController();
+	}
+
+	frame.render_width = enabled ? scaledExtent(app.window_width) : app.window_width;
+	frame.render_height = enabled ? scaledExtent(app.window_height) : app.window_height;
+}
+
+VkFramebuffer sceneFramebuffer() {
+	return scene_framebuffer;
+}
+
+// NOTE: Records the upscale draw, the present pass must be in its upscale subpass
+void composite(VkCommandBuffer cmd, const FrameContext& frame) {
+	VkViewport viewport{
+		.width = float(app.window_width),
+		.height = float(app.window_height),
+		.minDepth = 0.0f,
+		.maxDepth = 1.0f,
+	};
+
+	VkRect2D scissor{
+		.extent = {app.window_width, app.window_height},
+	};
+
+	PushConstants constants{
+		.uv_scale = {float(frame.render_width) / app.window_width,
+		             float(frame.render_height) / app.window_height},
+		.texel = {1.0f / app.window_width, 1.0f / app.window_height},
+		.sharpness = sharpness_value.load(std::memory_order_relaxed),
+	};
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+	vkCmdSetViewport(cmd, 0, 1, &viewport);
+	vkCmdSetScissor(cmd, 0, 1, &scissor);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout,
+	                        0, 1, &descriptor_set, 0, nullptr);
+	vkCmdPushConstants(cmd, pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT,
+	                   0, sizeof(constants), &constants);
+	vkCmdDraw(cmd, 3, 1, 0, 0);
+}
+
+bool isEnabled() {
+	return enabled;
+}
+
+Status status() {
+	return {
+		.scale = scale,
+		.width = scaledExtent(app.window_width),
+		.height = scaledExtent(app.window_height),
+		.gpu_ms = gpu_ms,
+		.target_ms = target_ms,
+		.state = state,
+	};
+}
+
+const char* controllerStateName(ControllerState state) {
+	switch (state) {
+	case ControllerState::manual: return "manual";
+	case ControllerState::no_timings: return "waiting for GPU timings";
+	case ControllerState::stable: return "stable";
+	case ControllerState::lowering: return "lowering";
+	case ControllerState::raising: return "raising";
+	default: return "unknown";
+	}
+}
+
+void setDynamic(bool value) {
+	dynamic = value;
+}
+
+bool isDynamic() {
+	return dynamic;
+}
+
+void setScale(float value) {
+	scale = std::clamp(value, min_scale, max_scale);
+}
+
+void setTargetFrameTime(double ms) {
+	target_ms = std::max(ms, 0.1);
+}
+
+void setSharpness(float value) {
+	sharpness_value.store(std::clamp(value, 0.0f, 1.0f), std::memory_order_relaxed);
+}
+
+float sharpness() {
+	return sharpness_value.load(std::memory_order_relaxed);
+}
+
+} // namespace veekay::resolution
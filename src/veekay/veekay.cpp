@@ -1,6 +1,13 @@
 #include <cstdint>
 #include <climits>
 #include <iostream>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 #include <vector>
 
@@ -23,9 +30,19 @@ constexpr uint32_t window_default_width = 1280;
 constexpr uint32_t window_default_height = 720;
 constexpr char window_title[] = "Veekay";
 
-constexpr uint32_t max_frames_in_flight = 2;
+// NOTE: Headless mode has no clock to follow, frames advance by a fixed step unless one is given
+constexpr double headless_time_step = 1.0 / 60.0;
+
+constexpr uint32_t default_frames_in_flight = 2;
+
+// NOTE: Upper bound for the default number of recording workers
+constexpr uint32_t default_max_workers = 7;
+
+// NOTE: Per-frame scratch space for FrameContext::transient
+constexpr VkDeviceSize transient_buffer_size = 4 * 1024 * 1024;
 
 GLFWwindow* window;
+bool headless;
 
 VkInstance vk_instance;
 VkDebugUtilsMessengerEXT vk_debug_messenger;
@@ -35,18 +52,43 @@ VkSurfaceKHR vk_surface;
 
 VkSwapchainKHR vk_swapchain;
 VkFormat vk_swapchain_format;
+VkPresentModeKHR vk_present_mode;
 std::vector<VkImage> vk_swapchain_images;
 std::vector<VkImageView> vk_swapchain_image_views;
 
+// NOTE: Headless runs render into plain images, their memory lives here
+std::vector<VkDeviceMemory> offscreen_memory;
+
+// NOTE: Layout the color target is left in after a frame, PRESENT_SRC or TRANSFER_SRC
+VkImageLayout vk_color_final_layout;
+
 VkQueue vk_graphics_queue;
 uint32_t vk_graphics_queue_family;
 
+// NOTE: Same as the graphics family when the device has no separate compute family
+uint32_t vk_compute_queue_family;
+
 // NOTE: ImGui rendering objects
-VkDescriptorPool imgui_descriptor_pool;
-VkRenderPass imgui_render_pass;
-VkCommandPool imgui_command_pool;
-std::vector<VkCommandBuffer> imgui_command_buffers;
-std::vector<VkFramebuffer> imgui_framebuffers;
+VkDescriptorPool imgui_descriptor_pool; // NOTE: UI is drawn in the last subpass of vk_render_pass
+
+// NOTE: What endRenderPass() draws, ImGui's own draw data or a slot's snapshot of it
+ImDrawData* ui_draw_data;
+
+// NOTE: Frame whose render() is running, endRenderPass() needs its image and scene extent
+const veekay::FrameContext* recording_frame;
+
+// NOTE: Copy of one frame's UI geometry, the pipelined loop keeps one per slot
+struct UiSnapshot {
+	ImDrawData draw_data;
+};
+
+std::vector<UiSnapshot> ui_snapshots;
+
+// NOTE: vkQueueSubmit/vkQueuePresentKHR need external sync once two threads submit
+std::mutex queue_mutex;
+
+VkSemaphore vk_graphics_timeline;
+std::atomic<uint64_t> graphics_timeline_value; // NOTE: Last value a submission will signal
 
 VkFormat vk_image_depth_format;
 VkImage vk_image_depth;
@@ -56,13 +98,36 @@ VkImageView vk_image_depth_view;
 VkRenderPass vk_render_pass;
 std::vector<VkFramebuffer> vk_framebuffers;
 
-std::vector<VkSemaphore> vk_render_semaphores;
+// NOTE: Dynamic resolution only: vk_render_pass renders offscreen, this one upscales and draws the UI
+bool dynamic_resolution;
+VkRenderPass vk_present_render_pass;
+
+// NOTE: Signaled when rendering to a swapchain image is done, one per image
 std::vector<VkSemaphore> vk_present_semaphores;
-std::vector<VkFence> vk_in_flight_fences;
+
+std::vector<veekay::FrameContext> frames;
 uint32_t vk_current_frame;
+uint64_t frame_number;
+
+veekay::PresentMode requested_present_mode;
+
+// NOTE: Set on resize and by OUT_OF_DATE/SUBOPTIMAL results, the main thread rebuilds before the next frame
+std::atomic<bool> swapchain_out_of_date;
 
+// NOTE: Index of the UI subpass in vk_render_pass, or in vk_present_render_pass after the upscale
+constexpr uint32_t ui_subpass = 1;
+
+// NOTE: On-demand mode keeps drawing this many frames after a request, ImGui needs a frame to settle
+constexpr uint32_t redraw_frame_count = 2;
+
+// NOTE: Longest on-demand sleep, bounds how late a missed wake-up is noticed
+constexpr double on_demand_wait_timeout = 0.5;
+
+bool on_demand;
+std::atomic<uint32_t> redraw_frames; // NOTE: Frames still to draw before sleeping again
+
+// NOTE: Used only for one-time submissions such as init()
 VkCommandPool vk_command_pool;
-std::vector<VkCommandBuffer> vk_command_buffers;
 
 } // namespace
 
@@ -74,321 +139,258 @@ namespace input {
 
 void setup(void* const window_ptr);
 void cache();
+bool consumeActivity();
 
 } // namespace input
 
-} // namespace veekay
-
-int veekay::run(const veekay::ApplicationInfo& app_info) {
-	veekay::app.running = true;
-	
-	if (!glfwInit()) {
-		std::cerr << "Failed to initialize GLFW\n";
-		return 1;
-	}
-
-	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-
-	window = glfwCreateWindow(window_default_width, window_default_height,
-	                          window_title, nullptr, nullptr);
-	if (!window) {
-		std::cerr << "Failed to create GLFW window\n";
-		return 1;
-	}
-
-	veekay::input::setup(window);
-
-	/* NOTE:
-		needed because otherwise on macos everything will be rendered in the top
-		corner of the application window
-	*/
-#if defined(__APPLE__) && defined(__MACH__)
-	int framebuffer_width, framebuffer_height;
-	glfwGetFramebufferSize(window, &framebuffer_width, &framebuffer_height);
-
-	app.window_width = framebuffer_width;
-	app.window_height = framebuffer_height;
-#else
-	app.window_width = window_default_width;
-	app.window_height = window_default_height;
-#endif
-
-	{ // NOTE: Initialize Vulkan: grab device and create swapchain
-		vkb::InstanceBuilder instance_builder;
-
-		auto builder_result = instance_builder.require_api_version(1, 3, 0)
-		                                      .request_validation_layers()
-		                                      .use_default_debug_messenger()
-		                                      .build();
-		if (!builder_result) {
-			std::cerr << builder_result.error().message() << '\n';
-			return 1;
-		}
-
-		auto instance = builder_result.value();
-
-		vk_instance = instance.instance;
-		vk_debug_messenger = instance.debug_messenger;
-
-		if (glfwCreateWindowSurface(vk_instance, window, nullptr, &vk_surface) != VK_SUCCESS) {
-			const char* message;
-			glfwGetError(&message);
-			std::cerr << message << '\n';
-			return 1;
-		}
-
-		vkb::PhysicalDeviceSelector physical_device_selector(instance);
-
-		VkPhysicalDeviceFeatures device_features{};
-
-		device_features.samplerAnisotropy = VK_TRUE;
-		device_features.fillModeNonSolid = VK_TRUE;
-		device_features.wideLines = VK_TRUE;
-
-		auto selector_result = physical_device_selector.set_surface(vk_surface)
-													   .set_required_features(device_features)
-													   .select();
-		if (!selector_result) {
-			std::cerr << selector_result.error().message() << '\n';
-			return 1;
-		}
+namespace profiler {
 
-		auto physical_device = selector_result.value();
+void setup(uint32_t queue_family, uint32_t frames_in_flight, bool record_session);
+void shutdown();
+void beginFrame(uint32_t slot_index, uint64_t number);
+void bindFrame(uint32_t slot_index);
+void recordCpu(CpuStage stage, double ms);
+void recordLatency(double ms);
+void endFrame();
+void finish();
+void drawOverlay();
 
-		{
-			vkb::DeviceBuilder device_builder(physical_device);
+} // namespace profiler
 
-			VkPhysicalDeviceVulkan13Features features13{
-				.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
-				.pNext = nullptr,
-				.dynamicRendering = VK_TRUE,
-			};
+namespace parallel {
 
-			device_builder.add_pNext(&features13);
+bool setup(uint32_t worker_count, uint32_t frames_in_flight, uint32_t queue_family);
+void shutdown();
+void beginFrame(uint32_t slot_index);
 
-			auto result = device_builder.build();
+} // namespace parallel
 
-			if (!result) {
-				std::cerr << result.error().message() << '\n';
-				return 1;
-			}
+namespace resolution {
 
-			auto device = result.value();
+bool setup(VkRenderPass scene_pass, VkRenderPass present_pass, uint32_t upscale_subpass,
+           VkFormat color_format, VkImageView depth_view, double target_frame_ms);
+void shutdown();
+void beginFrame(FrameContext& frame);
+bool resize(VkImageView depth_view, std::function<void()>& destroy_old);
+VkFramebuffer sceneFramebuffer();
+void composite(VkCommandBuffer cmd, const FrameContext& frame);
 
-			vk_device = device.device;
-			vk_physical_device = device.physical_device;
+} // namespace resolution
 
-			auto queue_type = vkb::QueueType::graphics;
-			
-			vk_graphics_queue = device.get_queue(queue_type).value();
-			vk_graphics_queue_family = device.get_queue_index(queue_type).value();
-		}
+namespace compute {
 
-		vkb::SwapchainBuilder swapchain_builder(vk_physical_device, vk_device, vk_surface);
+void setup(uint32_t graphics_queue_family, uint32_t compute_queue_family);
 
-		vk_swapchain_format = VK_FORMAT_B8G8R8A8_UNORM;
+} // namespace compute
 
-		VkSurfaceFormatKHR surface_format{
-			.format = vk_swapchain_format,
-			.colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR,
-		};
+namespace deletion {
 
-		auto swapchain_result = swapchain_builder.set_desired_format(surface_format)
-		                                         .set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
-		                                         .set_desired_extent(app.window_width, app.window_height)
-		                                         .add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
-		                                         .build();
+void collect(bool all);
 
-		if (!swapchain_result) {
-			std::cerr << swapchain_result.error().message() << '\n';
-			return 1;
-		}
+} // namespace deletion
 
-		auto swapchain = swapchain_result.value();
+} // namespace veekay
 
-		vk_swapchain = swapchain.swapchain;
-		vk_swapchain_images = swapchain.get_images().value();
-		vk_swapchain_image_views = swapchain.get_image_views().value();
+namespace {
 
-		veekay::app.vk_device = vk_device;
-		veekay::app.vk_physical_device = vk_physical_device;
+const char* presentModeName(VkPresentModeKHR mode) {
+	switch (mode) {
+	case VK_PRESENT_MODE_IMMEDIATE_KHR: return "IMMEDIATE";
+	case VK_PRESENT_MODE_MAILBOX_KHR: return "MAILBOX";
+	case VK_PRESENT_MODE_FIFO_KHR: return "FIFO";
+	case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "FIFO_RELAXED";
+	default: return "UNKNOWN";
 	}
+}
 
-	{ // NOTE: ImGui initialization
-		IMGUI_CHECKVERSION();
-		ImGui::CreateContext();
-		ImGuiIO& io = ImGui::GetIO(); (void)io;
+veekay::PresentMode fromVulkanPresentMode(VkPresentModeKHR mode) {
+	switch (mode) {
+	case VK_PRESENT_MODE_IMMEDIATE_KHR: return veekay::PresentMode::immediate;
+	case VK_PRESENT_MODE_MAILBOX_KHR: return veekay::PresentMode::mailbox;
+	case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return veekay::PresentMode::fifo_relaxed;
+	default: return veekay::PresentMode::fifo;
+	}
+}
 
-		ImGui::StyleColorsDark();
+/* NOTE:
+	Submits one command buffer to the graphics queue and makes it signal the
+	next timeline value, which is returned. Binary semaphores are only needed
+	for the swapchain, which cannot use timelines. Takes queue_mutex itself.
+*/
+uint64_t submitGraphics(VkCommandBuffer cmd,
+                        VkSemaphore wait_semaphore, VkPipelineStageFlags wait_stage,
+                        VkSemaphore signal_semaphore) {
+	std::lock_guard lock(queue_mutex);
+
+	uint64_t value = graphics_timeline_value.load(std::memory_order_relaxed) + 1;
+
+	VkSemaphore signal_semaphores[] = {vk_graphics_timeline, signal_semaphore};
+	uint64_t signal_values[] = {value, 0}; // NOTE: Ignored for the binary semaphore
+
+	uint32_t signal_count = signal_semaphore != VK_NULL_HANDLE ? 2 : 1;
+	uint32_t wait_count = wait_semaphore != VK_NULL_HANDLE ? 1 : 0;
+
+	VkTimelineSemaphoreSubmitInfo timeline_info{
+		.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+		.signalSemaphoreValueCount = signal_count,
+		.pSignalSemaphoreValues = signal_values,
+	};
+
+	VkSubmitInfo info{
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.pNext = &timeline_info,
+		.waitSemaphoreCount = wait_count,
+		.pWaitSemaphores = &wait_semaphore,
+		.pWaitDstStageMask = &wait_stage,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &cmd,
+		.signalSemaphoreCount = signal_count,
+		.pSignalSemaphores = signal_semaphores,
+	};
+
+	if (vkQueueSubmit(vk_graphics_queue, 1, &info, VK_NULL_HANDLE) != VK_SUCCESS) {
+		std::cerr << "Failed to submit to Vulkan graphics queue\n";
+	}
 
-		ImGui_ImplGlfw_InitForVulkan(window, true);
+	graphics_timeline_value.store(value, std::memory_order_release);
 
-		{
-			VkDescriptorPoolSize size = {
-				.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-				.descriptorCount = IMGUI_IMPL_VULKAN_MINIMUM_IMAGE_SAMPLER_POOL_SIZE,
-			};
+	return value;
+}
 
-			VkDescriptorPoolCreateInfo info = {
-				.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-				.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
-				.maxSets = size.descriptorCount,
-				.poolSizeCount = 1,
-				.pPoolSizes = &size,
-			};
+// NOTE: Returns the requested mode or the closest supported one, FIFO is always available
+VkPresentModeKHR choosePresentMode(veekay::PresentMode mode) {
+	uint32_t count = 0;
+	vkGetPhysicalDeviceSurfacePresentModesKHR(vk_physical_device, vk_surface, &count, nullptr);
+
+	std::vector<VkPresentModeKHR> supported(count);
+	vkGetPhysicalDeviceSurfacePresentModesKHR(vk_physical_device, vk_surface, &count, supported.data());
+
+	std::vector<VkPresentModeKHR> preferred;
+
+	switch (mode) {
+	case veekay::PresentMode::fifo:
+		break;
+	case veekay::PresentMode::fifo_relaxed:
+		preferred = {VK_PRESENT_MODE_FIFO_RELAXED_KHR};
+		break;
+	case veekay::PresentMode::mailbox:
+		preferred = {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR};
+		break;
+	case veekay::PresentMode::immediate:
+		preferred = {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR};
+		break;
+	}
 
-			if (vkCreateDescriptorPool(vk_device, &info, 0, &imgui_descriptor_pool) != VK_SUCCESS) {
-				std::cerr << "Failed to create Vulkan descriptor pool for ImGui\n";
-				return 1;
-			}
+	for (VkPresentModeKHR m : preferred) {
+		if (std::find(supported.begin(), supported.end(), m) != supported.end()) {
+			return m;
 		}
+	}
 
-		{
-			VkAttachmentDescription attachment{
-				.format = vk_swapchain_format,
-				.samples = VK_SAMPLE_COUNT_1_BIT,
-				.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD,
-				.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-				.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-				.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-				.initialLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-				.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-			};
-
-			VkAttachmentReference ref{
-				.attachment = 0,
-				.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-			};
-
-			VkSubpassDescription subpass{
-				.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
-				.colorAttachmentCount = 1,
-				.pColorAttachments = &ref,
-			};
+	return VK_PRESENT_MODE_FIFO_KHR;
+}
 
-			VkSubpassDependency dependency{
-				.srcSubpass = VK_SUBPASS_EXTERNAL,
-				.dstSubpass = 0,
-				.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-				.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-				.srcAccessMask = 0,
-				.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-			};
+/* NOTE:
+	Objects replaced while submitted frames may still use them, such as the
+	previous swapchain's framebuffers. Rebuilding happens between frames, so
+	the last value already submitted covers every user and no
+	vkDeviceWaitIdle is needed.
+*/
+void retire(std::function<void()> destroy) {
+	veekay::deletion::defer(graphics_timeline_value.load(std::memory_order_acquire), std::move(destroy));
+}
 
-			VkRenderPassCreateInfo info{
-				.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-				.attachmentCount = 1,
-				.pAttachments = &attachment,
-				.subpassCount = 1,
-				.pSubpasses = &subpass,
-				.dependencyCount = 1,
-				.pDependencies = &dependency,
-			};
+/* NOTE:
+	Present semaphores and the old swapchain may still be waited on by a
+	vkQueuePresentKHR, which the graphics timeline does not cover. Without
+	VK_EXT_swapchain_maintenance1 present fences nothing signals when the
+	presentation engine lets go of them, so they wait until frames_in_flight
+	frames were presented on the new swapchain, then for the GPU to finish
+	those. Drivers are done with the old presents by then, the spec does not
+	promise it.
+*/
+struct PresentRetiree {
+	uint32_t presents_left;
+	std::function<void()> destroy;
+};
+
+std::vector<PresentRetiree> present_retirees; // NOTE: Guarded by queue_mutex
+
+void retireAfterPresents(std::function<void()> destroy) {
+	std::lock_guard lock(queue_mutex);
+	present_retirees.push_back({veekay::app.frames_in_flight, std::move(destroy)});
+}
 
-			if (vkCreateRenderPass(vk_device, &info, nullptr, &imgui_render_pass) != VK_SUCCESS) {
-				std::cerr << "Failed to create ImGui Vulkan render pass\n";
-				return 1;
-			}
+// NOTE: Called with queue_mutex held after each present, or with everything = true once the device is idle
+void advancePresentRetirees(bool everything) {
+	for (PresentRetiree& r : present_retirees) {
+		if (everything || --r.presents_left == 0) {
+			retire(std::move(r.destroy));
+			r.destroy = nullptr;
 		}
+	}
 
-		{
-			VkFramebufferCreateInfo info{
-				.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-				.renderPass = imgui_render_pass,
-				.attachmentCount = 1,
-				.width = app.window_width,
-				.height = app.window_height,
-				.layers = 1,
-			};
-
-			const size_t count = vk_swapchain_images.size();
-
-			imgui_framebuffers.resize(count);
-
-			for (size_t i = 0; i < count; ++i) {
-				info.pAttachments = &vk_swapchain_image_views[i];
-				if (vkCreateFramebuffer(vk_device, &info, nullptr, &imgui_framebuffers[i]) != VK_SUCCESS) {
-					std::cerr << "Failed to create Vulkan framebuffer " << i << '\n';
-					return 1;
-				}
-			}
-		}
+	std::erase_if(present_retirees, [](const PresentRetiree& r) { return !r.destroy; });
+}
 
-		{
-			size_t count = imgui_framebuffers.size();
+// NOTE: Creates the swapchain and its image views, retiring the previous swapchain if any
+bool createSwapchain() {
+	VkPresentModeKHR present_mode = choosePresentMode(requested_present_mode);
 
-			imgui_command_buffers.resize(count);
+	if (fromVulkanPresentMode(present_mode) != requested_present_mode) {
+		std::cerr << "Requested present mode is not supported, falling back to "
+		          << presentModeName(present_mode) << '\n';
+	}
 
-			{
-				VkCommandPoolCreateInfo info{
-					.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-					.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-					.queueFamilyIndex = vk_graphics_queue_family,
-				};
+	vkb::SwapchainBuilder swapchain_builder(vk_physical_device, vk_device, vk_surface);
 
-				if (vkCreateCommandPool(vk_device, &info, nullptr, &imgui_command_pool) != VK_SUCCESS) {
-					std::cerr << "Failed to create ImGui Vulkan command pool\n";
-					return 1;
-				}
-			}
+	VkSurfaceFormatKHR surface_format{
+		.format = vk_swapchain_format,
+		.colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR,
+	};
 
-			{
-				VkCommandBufferAllocateInfo info{
-					.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-					.commandPool = imgui_command_pool,
-					.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-					.commandBufferCount = static_cast<uint32_t>(imgui_command_buffers.size()),
-				};
+	VkSwapchainKHR old_swapchain = vk_swapchain;
 
-				if (vkAllocateCommandBuffers(vk_device, &info, imgui_command_buffers.data()) != VK_SUCCESS) {
-					std::cerr << "Failed to allocate ImGui Vulkan command buffers\n";
-					return 1;
-				}
-			}
-		}
+	auto swapchain_result = swapchain_builder.set_desired_format(surface_format)
+	                                         .set_desired_present_mode(present_mode)
+	                                         .set_desired_extent(veekay::app.window_width, veekay::app.window_height)
+	                                         .add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
+	                                         .set_old_swapchain(old_swapchain)
+	                                         .build();
 
-		ImGui_ImplVulkan_InitInfo info{
-			.Instance = vk_instance,
-			.PhysicalDevice = vk_physical_device,
-			.Device = vk_device,
-			.QueueFamily = vk_graphics_queue_family,
-			.Queue = vk_graphics_queue,
-			.DescriptorPool = imgui_descriptor_pool,
-			.MinImageCount = static_cast<uint32_t>(vk_swapchain_images.size()),
-			.ImageCount = static_cast<uint32_t>(vk_swapchain_images.size()),
-			.RenderPass = imgui_render_pass,
-		};
+	if (!swapchain_result) {
+		std::cerr << swapchain_result.error().message() << '\n';
+		return false;
+	}
 
-		ImGui_ImplVulkan_Init(&info);
+	if (old_swapchain != VK_NULL_HANDLE) {
+		retireAfterPresents([old_swapchain] { vkDestroySwapchainKHR(vk_device, old_swapchain, nullptr); });
 	}
 
-	{
-		VkFormat candidates[] = {
-			VK_FORMAT_D32_SFLOAT,
-			VK_FORMAT_D32_SFLOAT_S8_UINT,
-			VK_FORMAT_D24_UNORM_S8_UINT,
-		};
+	auto swapchain = swapchain_result.value();
 
-		vk_image_depth_format = VK_FORMAT_UNDEFINED;
+	// NOTE: The surface decides, the requested extent is only a hint
+	veekay::app.window_width = swapchain.extent.width;
+	veekay::app.window_height = swapchain.extent.height;
 
-		for (const auto& f : candidates) {
-			VkFormatProperties properties;
-			vkGetPhysicalDeviceFormatProperties(vk_physical_device, f, &properties);
+	vk_swapchain = swapchain.swapchain;
+	vk_swapchain_images = swapchain.get_images().value();
+	vk_swapchain_image_views = swapchain.get_image_views().value();
 
-			if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
-				vk_image_depth_format = f;
-				break;
-			}
-		}
-	}
+	vk_present_mode = present_mode;
+	veekay::app.present_mode = fromVulkanPresentMode(present_mode);
+
+	return true;
+}
 
+// NOTE: Window-sized depth buffer shared by every frame, the scene pass clears it each frame
+bool createDepthTarget() {
 	{ // NOTE: Create depth buffer
 		VkImageCreateInfo info{
 			.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
 			.imageType = VK_IMAGE_TYPE_2D,
 			.format = vk_image_depth_format,
-			.extent = {app.window_width, app.window_height, 1},
+			.extent = {veekay::app.window_width, veekay::app.window_height, 1},
 			.mipLevels = 1,
 			.arrayLayers = 1,
 			.samples = VK_SAMPLE_COUNT_1_BIT,
@@ -398,7 +400,7 @@ int veekay::run(const veekay::ApplicationInfo& app_info) {
 
 		if (vkCreateImage(vk_device, &info, nullptr, &vk_image_depth) != VK_SUCCESS) {
 			std::cerr << "Failed to create Vulkan depth image\n";
-			return 1;
+			return false;
 		}
 	}
 
@@ -422,7 +424,7 @@ int veekay::run(const veekay::ApplicationInfo& app_info) {
 
 		if (index == UINT_MAX) {
 			std::cerr << "Failed to find required memory type for Vulkan depth image\n";
-			return 1;
+			return false;
 		}
 
 		VkMemoryAllocateInfo info = {
@@ -433,12 +435,12 @@ int veekay::run(const veekay::ApplicationInfo& app_info) {
 
 		if (vkAllocateMemory(vk_device, &info, nullptr, &vk_image_depth_memory) != VK_SUCCESS) {
 			std::cerr << "Failed to allocate memory for Vulkan depth image\n";
-			return 1;
+			return false;
 		}
 
 		if (vkBindImageMemory(vk_device, vk_image_depth, vk_image_depth_memory, 0) != VK_SUCCESS) {
 			std::cerr << "Failed to bind Vulkan depth image with device memory\n";
-			return 1;
+			return false;
 		}
 	}
 
@@ -459,146 +461,1012 @@ int veekay::run(const veekay::ApplicationInfo& app_info) {
 
 		if (vkCreateImageView(vk_device, &info, nullptr, &vk_image_depth_view) != VK_SUCCESS) {
 			std::cerr << "Failed to create Vulkan depth image view\n";
-			return 1;
+			return false;
 		}
 	}
 
-	{ // NOTE: Create render pass
-		VkAttachmentDescription color_attachment{
-			.format = vk_swapchain_format,
+	return true;
+}
 
-			.samples = VK_SAMPLE_COUNT_1_BIT,
+// NOTE: Headless stand-in for the swapchain, one color image per frame-in-flight slot
+bool createOffscreenTargets() {
+	const uint32_t count = veekay::app.frames_in_flight;
 
-			.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-			.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+	VkPhysicalDeviceMemoryProperties properties;
+	vkGetPhysicalDeviceMemoryProperties(vk_physical_device, &properties);
 
-			.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-			.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+	vk_swapchain_images.resize(count);
+	vk_swapchain_image_views.resize(count);
+	offscreen_memory.resize(count);
 
-			.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-			.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-		};
+	for (uint32_t i = 0; i < count; ++i) {
+		{
+			VkImageCreateInfo info{
+				.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+				.imageType = VK_IMAGE_TYPE_2D,
+				.format = vk_swapchain_format,
+				.extent = {veekay::app.window_width, veekay::app.window_height, 1},
+				.mipLevels = 1,
+				.arrayLayers = 1,
+				.samples = VK_SAMPLE_COUNT_1_BIT,
+				.tiling = VK_IMAGE_TILING_OPTIMAL,
+				.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+			};
 
-		VkAttachmentDescription depth_attachment{
-			.format = vk_image_depth_format,
-			.samples = VK_SAMPLE_COUNT_1_BIT,
-			.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-			.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-			.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-			.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-			.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-			.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-		};
+			if (vkCreateImage(vk_device, &info, nullptr, &vk_swapchain_images[i]) != VK_SUCCESS) {
+				std::cerr << "Failed to create Vulkan offscreen image " << i << '\n';
+				return false;
+			}
+		}
 
-		VkAttachmentReference color_ref{
-			.attachment = 0,
-			.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-		};
+		{
+			VkMemoryRequirements requirements;
+			vkGetImageMemoryRequirements(vk_device, vk_swapchain_images[i], &requirements);
 
-		VkAttachmentReference depth_ref{
-			.attachment = 1,
-			.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-		};
+			uint32_t index = UINT_MAX;
+			for (uint32_t j = 0; j < properties.memoryTypeCount; ++j) {
+				const VkMemoryType& type = properties.memoryTypes[j];
 
-		VkSubpassDescription subpass{
-			.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
-			.colorAttachmentCount = 1,
-			.pColorAttachments = &color_ref,
-			.pDepthStencilAttachment = &depth_ref,
+				if ((requirements.memoryTypeBits & (1 << j)) &&
+				    (type.propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
+					index = j;
+					break;
+				}
+			}
+
+			if (index == UINT_MAX) {
+				std::cerr << "Failed to find required memory type for Vulkan offscreen image\n";
+				return false;
+			}
+
+			VkMemoryAllocateInfo info{
+				.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+				.allocationSize = requirements.size,
+				.memoryTypeIndex = index,
+			};
+
+			if (vkAllocateMemory(vk_device, &info, nullptr, &offscreen_memory[i]) != VK_SUCCESS ||
+			    vkBindImageMemory(vk_device, vk_swapchain_images[i], offscreen_memory[i], 0) != VK_SUCCESS) {
+				std::cerr << "Failed to allocate memory for Vulkan offscreen image " << i << '\n';
+				return false;
+			}
+		}
+
+		{
+			VkImageViewCreateInfo info{
+				.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+				.image = vk_swapchain_images[i],
+				.viewType = VK_IMAGE_VIEW_TYPE_2D,
+				.format = vk_swapchain_format,
+				.subresourceRange = {
+					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+					.baseMipLevel = 0,
+					.levelCount = 1,
+					.baseArrayLayer = 0,
+					.layerCount = 1,
+				},
+			};
+
+			if (vkCreateImageView(vk_device, &info, nullptr, &vk_swapchain_image_views[i]) != VK_SUCCESS) {
+				std::cerr << "Failed to create Vulkan offscreen image view " << i << '\n';
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+// NOTE: Image views are owned by destroySwapchainFramebuffers(), call it first
+void destroyOffscreenTargets() {
+	for (size_t i = 0, e = vk_swapchain_images.size(); i != e; ++i) {
+		vkDestroyImage(vk_device, vk_swapchain_images[i], nullptr);
+		vkFreeMemory(vk_device, offscreen_memory[i], nullptr);
+	}
+
+	vk_swapchain_images.clear();
+	offscreen_memory.clear();
+}
+
+// NOTE: Copies an offscreen image in TRANSFER_SRC_OPTIMAL layout to a binary PPM file
+bool writeImagePPM(const char* path, VkImage image) {
+	const uint32_t width = veekay::app.window_width;
+	const uint32_t height = veekay::app.window_height;
+
+	veekay::graphics::Buffer readback(width * height * 4, nullptr, VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+
+	VkCommandBuffer cmd; {
+		VkCommandBufferAllocateInfo info{
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+			.commandPool = vk_command_pool,
+			.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+			.commandBufferCount = 1,
+		};
+
+		if (vkAllocateCommandBuffers(vk_device, &info, &cmd) != VK_SUCCESS) {
+			std::cerr << "Failed to allocate Vulkan readback command buffer\n";
+			return false;
+		}
+	}
+
+	{
+		VkCommandBufferBeginInfo info{
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+			.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+		};
+
+		vkBeginCommandBuffer(cmd, &info);
+	}
+
+	{
+		// NOTE: The render pass has no external dependency out, make the color writes visible to the copy
+		VkImageMemoryBarrier color_to_copy{
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+			.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+			.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.image = image,
+			.subresourceRange = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.baseMipLevel = 0,
+				.levelCount = 1,
+				.baseArrayLayer = 0,
+				.layerCount = 1,
+			},
+		};
+
+		vkCmdPipelineBarrier(cmd,
+		                     VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		                     VK_PIPELINE_STAGE_TRANSFER_BIT,
+		                     0,
+		                     0, nullptr,
+		                     0, nullptr,
+		                     1, &color_to_copy);
+
+		VkBufferImageCopy region{
+			.imageSubresource = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.mipLevel = 0,
+				.baseArrayLayer = 0,
+				.layerCount = 1,
+			},
+			.imageExtent = {width, height, 1},
+		};
+
+		vkCmdCopyImageToBuffer(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		                       readback.buffer, 1, &region);
+
+		VkBufferMemoryBarrier copy_to_host{
+			.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+			.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.buffer = readback.buffer,
+			.offset = 0,
+			.size = VK_WHOLE_SIZE,
+		};
+
+		vkCmdPipelineBarrier(cmd,
+		                     VK_PIPELINE_STAGE_TRANSFER_BIT,
+		                     VK_PIPELINE_STAGE_HOST_BIT,
+		                     0,
+		                     0, nullptr,
+		                     1, &copy_to_host,
+		                     0, nullptr);
+	}
+
+	{
+		vkEndCommandBuffer(cmd);
+
+		veekay::waitTimeline(submitGraphics(cmd, VK_NULL_HANDLE, 0, VK_NULL_HANDLE));
+
+		vkFreeCommandBuffers(vk_device, vk_command_pool, 1, &cmd);
+	}
+
+	std::ofstream file(path, std::ios::binary);
+	if (!file) {
+		std::cerr << "Failed to open " << path << " for writing\n";
+		return false;
+	}
+
+	file << "P6\n" << width << ' ' << height << "\n255\n";
+
+	// NOTE: Offscreen images are BGRA, PPM wants RGB
+	const uint8_t* pixels = static_cast<const uint8_t*>(readback.mapped_region);
+	std::vector<uint8_t> row(width * 3);
+
+	for (uint32_t y = 0; y < height; ++y) {
+		for (uint32_t x = 0; x < width; ++x) {
+			const uint8_t* pixel = pixels + (y * width + x) * 4;
+			row[x * 3 + 0] = pixel[2];
+			row[x * 3 + 1] = pixel[1];
+			row[x * 3 + 2] = pixel[0];
+		}
+
+		file.write(reinterpret_cast<const char*>(row.data()), row.size());
+	}
+
+	return true;
+}
+
+// NOTE: Everything that references swapchain images: framebuffers and present semaphores
+bool createSwapchainFramebuffers() {
+	const size_t count = vk_swapchain_images.size();
+
+	{
+		VkImageView attachments[] = {VK_NULL_HANDLE, vk_image_depth_view};
+
+		// NOTE: Under dynamic resolution the window only gets the upscaled color, depth stays offscreen
+		VkFramebufferCreateInfo info{
+			.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+
+			.renderPass = dynamic_resolution ? vk_present_render_pass : vk_render_pass,
+
+			.attachmentCount = dynamic_resolution ? 1u : 2u,
+			.pAttachments = attachments,
+
+			.width = veekay::app.window_width,
+			.height = veekay::app.window_height,
+			.layers = 1,
+		};
+
+		vk_framebuffers.resize(count);
+
+		for (size_t i = 0; i < count; ++i) {
+			attachments[0] = vk_swapchain_image_views[i];
+			if (vkCreateFramebuffer(vk_device, &info, nullptr, &vk_framebuffers[i]) != VK_SUCCESS) {
+				std::cerr << "Failed to create Vulkan framebuffer " << i << '\n';
+				return false;
+			}
+		}
+	}
+
+	if (!headless) {
+		VkSemaphoreCreateInfo sem_info{
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+		};
+
+		vk_present_semaphores.resize(count);
+
+		for (size_t i = 0; i < count; ++i) {
+			vkCreateSemaphore(vk_device, &sem_info, nullptr, &vk_present_semaphores[i]);
+		}
+	}
+
+	return true;
+}
+
+void destroySwapchainFramebuffers() {
+	retireAfterPresents([semaphores = std::move(vk_present_semaphores)] {
+		for (VkSemaphore semaphore : semaphores) {
+			vkDestroySemaphore(vk_device, semaphore, nullptr);
+		}
+	});
+
+	retire([framebuffers = std::move(vk_framebuffers), views = std::move(vk_swapchain_image_views)] {
+		for (size_t i = 0, e = views.size(); i != e; ++i) {
+			vkDestroyFramebuffer(vk_device, framebuffers[i], nullptr);
+			vkDestroyImageView(vk_device, views[i], nullptr);
+		}
+	});
+
+	vk_present_semaphores.clear();
+	vk_framebuffers.clear();
+	vk_swapchain_image_views.clear();
+}
+
+void releaseDrawData(ImDrawData& draw_data) {
+	for (ImDrawList* list : draw_data.CmdLists) {
+		IM_DELETE(list);
+	}
+
+	draw_data.Clear();
+}
+
+/* NOTE:
+	ImGui reuses its draw lists on the next NewFrame(), which the simulation
+	thread runs while the render thread may still record this frame, so the
+	lists are cloned. Texture uploads are done right here instead of in
+	ImGui_ImplVulkan_RenderDrawData, since they touch ImGui's own state.
+*/
+void snapshotDrawData(UiSnapshot& snapshot, ImDrawData* source) {
+	if (source->Textures != nullptr) {
+		std::lock_guard lock(queue_mutex);
+
+		for (ImTextureData* texture : *source->Textures) {
+			if (texture->Status != ImTextureStatus_OK) {
+				ImGui_ImplVulkan_UpdateTexture(texture);
+			}
+		}
+	}
+
+	ImDrawData& copy = snapshot.draw_data;
+
+	releaseDrawData(copy);
+
+	copy.Valid = source->Valid;
+	copy.DisplayPos = source->DisplayPos;
+	copy.DisplaySize = source->DisplaySize;
+	copy.FramebufferScale = source->FramebufferScale;
+	copy.OwnerViewport = source->OwnerViewport;
+
+	for (ImDrawList* list : source->CmdLists) {
+		ImDrawList* clone = list->CloneOutput();
+
+		copy.CmdLists.push_back(clone);
+		copy.CmdListsCount += 1;
+		copy.TotalVtxCount += clone->VtxBuffer.Size;
+		copy.TotalIdxCount += clone->IdxBuffer.Size;
+	}
+}
+
+/* NOTE:
+	ImGui rotates ImageCount vertex/index buffers, one per rendered frame, so
+	it needs at least frames_in_flight of them or it rewrites a buffer an
+	in-flight frame still reads. Headless runs may have a single image, and
+	ImGui asserts MinImageCount >= 2. Only frames_in_flight matters for the
+	ring, so this is set once at init: changing it later makes ImGui wait for
+	the device and free buffers retired frames may still use.
+*/
+uint32_t imguiImageCount() {
+	const uint32_t images = static_cast<uint32_t>(vk_swapchain_images.size());
+	return std::max({images, veekay::app.frames_in_flight, 2u});
+}
+
+/* NOTE:
+	Rebuilds the swapchain and everything sized by the window, device and
+	passes stay. Frames in flight keep rendering to the old objects, which are
+	retired instead of waiting for the device. A minimized window has no
+	extent, so this blocks until it is restored or closed.
+*/
+bool rebuildSwapchain() {
+	int width = 0, height = 0;
+	glfwGetFramebufferSize(window, &width, &height);
+
+	while ((width == 0 || height == 0) && !glfwWindowShouldClose(window)) {
+		glfwWaitEvents();
+		glfwGetFramebufferSize(window, &width, &height);
+	}
+
+	swapchain_out_of_date = false;
+
+	uint32_t old_width = veekay::app.window_width;
+	uint32_t old_height = veekay::app.window_height;
+
+	veekay::app.window_width = static_cast<uint32_t>(std::max(width, 1));
+	veekay::app.window_height = static_cast<uint32_t>(std::max(height, 1));
+
+	destroySwapchainFramebuffers();
+
+	if (!createSwapchain()) {
+		return false;
+	}
+
+	if (veekay::app.window_width != old_width || veekay::app.window_height != old_height) {
+		retire([image = vk_image_depth, memory = vk_image_depth_memory, view = vk_image_depth_view] {
+			vkDestroyImageView(vk_device, view, nullptr);
+			vkFreeMemory(vk_device, memory, nullptr);
+			vkDestroyImage(vk_device, image, nullptr);
+		});
+
+		if (!createDepthTarget()) {
+			return false;
+		}
+
+		std::function<void()> destroy_scene_target;
+
+		if (!veekay::resolution::resize(vk_image_depth_view, destroy_scene_target)) {
+			return false;
+		}
+
+		if (destroy_scene_target) {
+			retire(std::move(destroy_scene_target));
+		}
+	}
+
+	return createSwapchainFramebuffers();
+}
+
+} // namespace
+
+void veekay::endRenderPass(VkCommandBuffer cmd) {
+	if (!dynamic_resolution) {
+		vkCmdNextSubpass(cmd, VK_SUBPASS_CONTENTS_INLINE);
+	} else {
+		vkCmdEndRenderPass(cmd);
+
+		VkRenderPassBeginInfo info{
+			.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+			.renderPass = vk_present_render_pass,
+			.framebuffer = vk_framebuffers[recording_frame->image_index],
+			.renderArea = {.extent = {app.window_width, app.window_height}},
+		};
+
+		vkCmdBeginRenderPass(cmd, &info, VK_SUBPASS_CONTENTS_INLINE);
+
+		veekay::profiler::beginPass(cmd, "upscale");
+		veekay::resolution::composite(cmd, *recording_frame);
+		veekay::profiler::endPass(cmd);
+
+		vkCmdNextSubpass(cmd, VK_SUBPASS_CONTENTS_INLINE);
+	}
+
+	veekay::profiler::beginPass(cmd, "imgui");
+	ImGui_ImplVulkan_RenderDrawData(ui_draw_data, cmd);
+	veekay::profiler::endPass(cmd);
+
+	vkCmdEndRenderPass(cmd);
+}
+
+void veekay::setPresentMode(veekay::PresentMode mode) {
+	requested_present_mode = mode;
+}
+
+void veekay::requestRedraw() {
+	uint32_t previous = redraw_frames.exchange(redraw_frame_count);
+
+	// NOTE: Only the main thread can wake from glfwWaitEventsTimeout by itself
+	if (on_demand && previous == 0) {
+		glfwPostEmptyEvent();
+	}
+}
+
+uint64_t veekay::timelineSubmitted() {
+	return graphics_timeline_value.load(std::memory_order_acquire);
+}
+
+uint64_t veekay::timelineCompleted() {
+	uint64_t value = 0;
+	vkGetSemaphoreCounterValue(vk_device, vk_graphics_timeline, &value);
+	return value;
+}
+
+void veekay::waitTimeline(uint64_t value) {
+	VkSemaphoreWaitInfo info{
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+		.semaphoreCount = 1,
+		.pSemaphores = &vk_graphics_timeline,
+		.pValues = &value,
+	};
+
+	vkWaitSemaphores(vk_device, &info, UINT64_MAX);
+}
+
+int veekay::run(const veekay::ApplicationInfo& app_info) {
+	veekay::app.running = true;
+	requested_present_mode = app_info.uncapped ? veekay::PresentMode::immediate : app_info.present_mode;
+	veekay::app.frames_in_flight = app_info.frames_in_flight == 0
+	                               ? default_frames_in_flight
+	                               : std::clamp(app_info.frames_in_flight, 1u, veekay::max_frames_in_flight);
+
+	// NOTE: With a single slot the two pipeline stages could never overlap
+	if (app_info.pipelined) {
+		veekay::app.frames_in_flight = std::max(veekay::app.frames_in_flight, 2u);
+	}
+
+	headless = app_info.headless;
+	on_demand = app_info.on_demand && !headless;
+	redraw_frames = redraw_frame_count;
+	dynamic_resolution = app_info.dynamic_resolution;
+	vk_color_final_layout = headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+	if (headless) {
+		app.window_width = app_info.headless_width == 0 ? window_default_width : app_info.headless_width;
+		app.window_height = app_info.headless_height == 0 ? window_default_height : app_info.headless_height;
+	} else {
+		if (!glfwInit()) {
+			std::cerr << "Failed to initialize GLFW\n";
+			return 1;
+		}
+
+		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+		glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+
+		window = glfwCreateWindow(window_default_width, window_default_height,
+		                          window_title, nullptr, nullptr);
+		if (!window) {
+			std::cerr << "Failed to create GLFW window\n";
+			return 1;
+		}
+
+		veekay::input::setup(window);
+
+		// NOTE: Exposed or restored windows need their contents drawn again
+		glfwSetWindowRefreshCallback(window, [](GLFWwindow*) { veekay::requestRedraw(); });
+
+		glfwSetFramebufferSizeCallback(window, [](GLFWwindow*, int, int) {
+			swapchain_out_of_date = true;
+			veekay::requestRedraw();
+		});
+
+		/* NOTE:
+			needed because otherwise on macos everything will be rendered in the top
+			corner of the application window
+		*/
+#if defined(__APPLE__) && defined(__MACH__)
+		int framebuffer_width, framebuffer_height;
+		glfwGetFramebufferSize(window, &framebuffer_width, &framebuffer_height);
+
+		app.window_width = framebuffer_width;
+		app.window_height = framebuffer_height;
+#else
+		app.window_width = window_default_width;
+		app.window_height = window_default_height;
+#endif
+	}
+
+	{ // NOTE: Initialize Vulkan: grab device and create swapchain
+		vkb::InstanceBuilder instance_builder;
+
+		auto builder_result = instance_builder.require_api_version(1, 3, 0)
+		                                      .request_validation_layers()
+		                                      .use_default_debug_messenger()
+		                                      .set_headless(headless)
+		                                      .build();
+		if (!builder_result) {
+			std::cerr << builder_result.error().message() << '\n';
+			return 1;
+		}
+
+		auto instance = builder_result.value();
+
+		vk_instance = instance.instance;
+		vk_debug_messenger = instance.debug_messenger;
+
+		if (!headless && glfwCreateWindowSurface(vk_instance, window, nullptr, &vk_surface) != VK_SUCCESS) {
+			const char* message;
+			glfwGetError(&message);
+			std::cerr << message << '\n';
+			return 1;
+		}
+
+		vkb::PhysicalDeviceSelector physical_device_selector(instance);
+
+		VkPhysicalDeviceFeatures device_features{};
+
+		device_features.samplerAnisotropy = VK_TRUE;
+		device_features.fillModeNonSolid = VK_TRUE;
+		device_features.wideLines = VK_TRUE;
+		device_features.multiViewport = VK_TRUE; // NOTE: Several viewports per draw, e.g. shadow atlas tiles
+		device_features.fragmentStoresAndAtomics = VK_TRUE; // NOTE: Fragment shaders write feedback, e.g. shadow page requests
+
+		auto selector_result = physical_device_selector.set_surface(vk_surface)
+													   .set_required_features(device_features)
+													   .select();
+		if (!selector_result) {
+			std::cerr << selector_result.error().message() << '\n';
+			return 1;
+		}
+
+		auto physical_device = selector_result.value();
+
+		{
+			vkb::DeviceBuilder device_builder(physical_device);
+
+			VkPhysicalDeviceVulkan11Features features11{
+				.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES,
+				.pNext = nullptr,
+				.multiview = VK_TRUE, // NOTE: Layered passes such as shadow cascades render in one go
+			};
+
+			VkPhysicalDeviceVulkan12Features features12{
+				.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+				.pNext = nullptr,
+				.hostQueryReset = VK_TRUE, // NOTE: Profiler recycles timestamp queries on the CPU
+				.timelineSemaphore = VK_TRUE, // NOTE: Frame and queue synchronization
+				.shaderOutputViewportIndex = VK_TRUE, // NOTE: Vertex shaders pick the viewport
+			};
+
+			VkPhysicalDeviceVulkan13Features features13{
+				.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+				.pNext = nullptr,
+				.dynamicRendering = VK_TRUE,
+			};
+
+			device_builder.add_pNext(&features11);
+			device_builder.add_pNext(&features12);
+			device_builder.add_pNext(&features13);
+
+			auto result = device_builder.build();
+
+			if (!result) {
+				std::cerr << result.error().message() << '\n';
+				return 1;
+			}
+
+			auto device = result.value();
+
+			vk_device = device.device;
+			vk_physical_device = device.physical_device;
+
+			auto queue_type = vkb::QueueType::graphics;
+			
+			vk_graphics_queue = device.get_queue(queue_type).value();
+			vk_graphics_queue_family = device.get_queue_index(queue_type).value();
+
+			// NOTE: Prefers a family without graphics
+			auto compute_family = device.get_queue_index(vkb::QueueType::compute);
+			vk_compute_queue_family = compute_family ? compute_family.value() : vk_graphics_queue_family;
+		}
+
+		veekay::app.vk_device = vk_device;
+		veekay::app.vk_physical_device = vk_physical_device;
+		veekay::app.graphics_queue_family = vk_graphics_queue_family;
+	}
+
+	{ // NOTE: Create graphics timeline semaphore
+		VkSemaphoreTypeCreateInfo type_info{
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+			.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+			.initialValue = 0,
+		};
+
+		VkSemaphoreCreateInfo info{
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+			.pNext = &type_info,
+		};
+
+		if (vkCreateSemaphore(vk_device, &info, nullptr, &vk_graphics_timeline) != VK_SUCCESS) {
+			std::cerr << "Failed to create Vulkan timeline semaphore\n";
+			return 1;
+		}
+
+		graphics_timeline_value = 0;
+		veekay::app.vk_graphics_timeline = vk_graphics_timeline;
+	}
+
+	vk_swapchain_format = VK_FORMAT_B8G8R8A8_UNORM;
+
+	if (headless ? !createOffscreenTargets() : !createSwapchain()) {
+		return 1;
+	}
+
+	{
+		VkFormat candidates[] = {
+			VK_FORMAT_D32_SFLOAT,
+			VK_FORMAT_D32_SFLOAT_S8_UINT,
+			VK_FORMAT_D24_UNORM_S8_UINT,
+		};
+
+		vk_image_depth_format = VK_FORMAT_UNDEFINED;
+
+		for (const auto& f : candidates) {
+			VkFormatProperties properties;
+			vkGetPhysicalDeviceFormatProperties(vk_physical_device, f, &properties);
+
+			if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+				vk_image_depth_format = f;
+				break;
+			}
+		}
+	}
+
+	if (!createDepthTarget()) {
+		return 1;
+	}
+
+	{ // NOTE: Create render pass
+		VkAttachmentDescription color_attachment{
+			.format = vk_swapchain_format,
+
+			.samples = VK_SAMPLE_COUNT_1_BIT,
+
+			.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+			.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+
+			.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+			.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+
+			.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+			.finalLayout = dynamic_resolution ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : vk_color_final_layout,
+		};
+
+		VkAttachmentDescription depth_attachment{
+			.format = vk_image_depth_format,
+			.samples = VK_SAMPLE_COUNT_1_BIT,
+			.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+			.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE, // NOTE: Nothing reads depth after the pass
+			.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+			.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+			.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+			.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+		};
+
+		VkAttachmentReference color_ref{
+			.attachment = 0,
+			.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+		};
+
+		VkAttachmentReference depth_ref{
+			.attachment = 1,
+			.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+		};
+
+		/* NOTE:
+			Subpass 0 is the scene, subpass 1 draws the UI on top of the same color
+			attachment. Keeping both in one pass saves a store/load round-trip of the
+			swapchain image and lets the frame go out as a single command buffer.
+		*/
+		VkSubpassDescription subpasses[] = {
+			{
+				.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+				.colorAttachmentCount = 1,
+				.pColorAttachments = &color_ref,
+				.pDepthStencilAttachment = &depth_ref,
+			},
+			{
+				.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+				.colorAttachmentCount = 1,
+				.pColorAttachments = &color_ref,
+			},
+		};
+
+		VkAttachmentDescription attachments[] = {color_attachment, depth_attachment};
+
+		VkSubpassDependency dependencies[] = {
+			{ // NOTE: Fragment shader stage covers the previous frame's upscale reading the scene target
+				.srcSubpass = VK_SUBPASS_EXTERNAL,
+				.dstSubpass = 0,
+				.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+				                VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+				                VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+				.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+				                VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+				.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+				.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+				                 VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+				.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT,
+			},
+			{
+				.srcSubpass = 0,
+				.dstSubpass = ui_subpass,
+				.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+				.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+				.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+				.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+				                 VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+				.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT,
+			},
+			{ // NOTE: Dynamic resolution only, the upscale samples the scene right after
+				.srcSubpass = 0,
+				.dstSubpass = VK_SUBPASS_EXTERNAL,
+				.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+				.dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+				.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+				.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+			},
+		};
+
+		// NOTE: Under dynamic resolution the scene pass ends after subpass 0, the UI moves to the present pass
+		VkSubpassDependency scene_dependencies[] = {dependencies[0], dependencies[2]};
+
+		VkRenderPassCreateInfo info{
+			.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+
+			.attachmentCount = 2,
+			.pAttachments = attachments,
+
+			.subpassCount = dynamic_resolution ? 1u : 2u,
+			.pSubpasses = subpasses,
+
+			.dependencyCount = 2,
+			.pDependencies = dynamic_resolution ? scene_dependencies : dependencies,
+		};
+
+		if (vkCreateRenderPass(vk_device, &info, nullptr, &vk_render_pass) != VK_SUCCESS) {
+			std::cerr << "Failed to create render pass\n";
+			return 1;
+		}
+
+		veekay::app.vk_render_pass = vk_render_pass;
+	}
+
+	if (dynamic_resolution) { // NOTE: Create present render pass: upscale, then UI on top
+		VkAttachmentDescription color_attachment{
+			.format = vk_swapchain_format,
+			.samples = VK_SAMPLE_COUNT_1_BIT,
+			.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE, // NOTE: The upscale covers every pixel
+			.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+			.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+			.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+			.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+			.finalLayout = vk_color_final_layout,
 		};
 
-		VkAttachmentDescription attachments[] = {color_attachment, depth_attachment};
+		VkAttachmentReference color_ref{
+			.attachment = 0,
+			.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+		};
+
+		VkSubpassDescription subpasses[] = {
+			{
+				.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+				.colorAttachmentCount = 1,
+				.pColorAttachments = &color_ref,
+			},
+			{
+				.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+				.colorAttachmentCount = 1,
+				.pColorAttachments = &color_ref,
+			},
+		};
 
-		VkSubpassDependency dependency{
-			.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
-			                VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
-			.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
-			                VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
-			.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
-			.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
-			                 VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
-			.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT,
+		VkSubpassDependency dependencies[] = {
+			{
+				.srcSubpass = VK_SUBPASS_EXTERNAL,
+				.dstSubpass = 0,
+				.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+				.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+				.srcAccessMask = 0,
+				.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+			},
+			{
+				.srcSubpass = 0,
+				.dstSubpass = ui_subpass,
+				.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+				.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+				.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+				.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+				                 VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+				.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT,
+			},
 		};
 
 		VkRenderPassCreateInfo info{
 			.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
 
-			.attachmentCount = 2,
-			.pAttachments = attachments,
+			.attachmentCount = 1,
+			.pAttachments = &color_attachment,
 
-			.subpassCount = 1,
-			.pSubpasses = &subpass,
+			.subpassCount = 2,
+			.pSubpasses = subpasses,
 
-			.dependencyCount = 1,
-			.pDependencies = &dependency,
+			.dependencyCount = 2,
+			.pDependencies = dependencies,
 		};
 
-		if (vkCreateRenderPass(vk_device, &info, nullptr, &vk_render_pass) != VK_SUCCESS) {
-			std::cerr << "Failed to create render pass\n";
+		if (vkCreateRenderPass(vk_device, &info, nullptr, &vk_present_render_pass) != VK_SUCCESS) {
+			std::cerr << "Failed to create present render pass\n";
 			return 1;
 		}
 
-		veekay::app.vk_render_pass = vk_render_pass;
+		if (!veekay::resolution::setup(vk_render_pass, vk_present_render_pass, 0, vk_swapchain_format,
+		                               vk_image_depth_view, app_info.target_frame_ms)) {
+			return 1;
+		}
 	}
 
-	{ // NOTE: Create framebuffer objects from swapchain images
-		VkImageView attachments[] = {VK_NULL_HANDLE, vk_image_depth_view};
-
-		VkFramebufferCreateInfo info{
-			.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-
-			.renderPass = vk_render_pass,
+	{ // NOTE: ImGui initialization
+		IMGUI_CHECKVERSION();
+		ImGui::CreateContext();
+		ImGuiIO& io = ImGui::GetIO(); (void)io;
 
-			.attachmentCount = 2,
-			.pAttachments = attachments,
+		ImGui::StyleColorsDark();
 
-			.width = app.window_width,
-			.height = app.window_height,
-			.layers = 1,
-		};
+		if (headless) {
+			io.DisplaySize = ImVec2(float(app.window_width), float(app.window_height));
+		} else {
+			ImGui_ImplGlfw_InitForVulkan(window, true);
+		}
 
-		const size_t count = vk_swapchain_images.size();
+		{
+			VkDescriptorPoolSize size = {
+				.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+				.descriptorCount = IMGUI_IMPL_VULKAN_MINIMUM_IMAGE_SAMPLER_POOL_SIZE,
+			};
 
-		vk_framebuffers.resize(count);
+			VkDescriptorPoolCreateInfo info = {
+				.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+				.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
+				.maxSets = size.descriptorCount,
+				.poolSizeCount = 1,
+				.pPoolSizes = &size,
+			};
 
-		for (size_t i = 0; i < count; ++i) {
-			attachments[0] = vk_swapchain_image_views[i];
-			if (vkCreateFramebuffer(vk_device, &info, nullptr, &vk_framebuffers[i]) != VK_SUCCESS) {
-				std::cerr << "Failed to create Vulkan framebuffer " << i << '\n';
+			if (vkCreateDescriptorPool(vk_device, &info, 0, &imgui_descriptor_pool) != VK_SUCCESS) {
+				std::cerr << "Failed to create Vulkan descriptor pool for ImGui\n";
 				return 1;
 			}
 		}
-	}
 
-	{ // NOTE: Create sync primitives
-		VkFenceCreateInfo fence_info{
-			.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-			.flags = VK_FENCE_CREATE_SIGNALED_BIT,
+		ImGui_ImplVulkan_InitInfo info{
+			.Instance = vk_instance,
+			.PhysicalDevice = vk_physical_device,
+			.Device = vk_device,
+			.QueueFamily = vk_graphics_queue_family,
+			.Queue = vk_graphics_queue,
+			.DescriptorPool = imgui_descriptor_pool,
+			.MinImageCount = imguiImageCount(),
+			.ImageCount = imguiImageCount(),
+			.RenderPass = dynamic_resolution ? vk_present_render_pass : vk_render_pass,
+			.Subpass = ui_subpass,
 		};
 
-		VkSemaphoreCreateInfo sem_info{
-			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
-		};
+		ImGui_ImplVulkan_Init(&info);
+	}
 
-		vk_present_semaphores.resize(vk_swapchain_images.size());
+	if (!createSwapchainFramebuffers()) {
+		return 1;
+	}
 
-		for (size_t i = 0, e = vk_swapchain_images.size(); i != e; ++i) {
-			vkCreateSemaphore(vk_device, &sem_info, nullptr, &vk_present_semaphores[i]);
+	{ // NOTE: Create per-frame resources: command pool, buffers, sync and transient memory
+		frames.resize(app.frames_in_flight);
+
+		for (uint32_t i = 0; i < app.frames_in_flight; ++i) {
+			veekay::FrameContext& frame = frames[i];
+
+			frame.index = i;
+
+			{
+				VkCommandPoolCreateInfo info{
+					.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+					.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+					.queueFamilyIndex = vk_graphics_queue_family,
+				};
+
+				if (vkCreateCommandPool(vk_device, &info, nullptr, &frame.command_pool) != VK_SUCCESS) {
+					std::cerr << "Failed to create Vulkan command pool for frame " << i << '\n';
+					return 1;
+				}
+			}
+
+			{
+				VkCommandBufferAllocateInfo info{
+					.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+					.commandPool = frame.command_pool,
+					.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+					.commandBufferCount = 1,
+				};
+
+				if (vkAllocateCommandBuffers(vk_device, &info, &frame.command_buffer) != VK_SUCCESS) {
+					std::cerr << "Failed to allocate Vulkan command buffer for frame " << i << '\n';
+					return 1;
+				}
+			}
+
+			{
+				VkSemaphoreCreateInfo sem_info{
+					.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+				};
+
+				vkCreateSemaphore(vk_device, &sem_info, nullptr, &frame.image_available_semaphore);
+			}
+
+			frame.timeline_value = 0;
+
+			frame.transient = new veekay::graphics::TransientBuffer(
+				transient_buffer_size,
+				VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
 		}
+	}
+
+	veekay::profiler::setup(vk_graphics_queue_family, app.frames_in_flight,
+	                        app_info.profile_output != nullptr);
+
+	{ // NOTE: Start recording workers, one spare hardware thread each unless told otherwise
+		uint32_t workers = app_info.worker_threads;
 
-		vk_render_semaphores.resize(max_frames_in_flight);
-		vk_in_flight_fences.resize(max_frames_in_flight);
+		if (workers == 0) {
+			uint32_t hardware = std::thread::hardware_concurrency();
+			workers = std::min(hardware > 1 ? hardware - 1 : 0u, default_max_workers);
+		}
 
-		for (uint32_t i = 0; i < max_frames_in_flight; ++i) {
-			vkCreateSemaphore(vk_device, &sem_info, nullptr, &vk_render_semaphores[i]);
-			vkCreateFence(vk_device, &fence_info, nullptr, &vk_in_flight_fences[i]);
+		if (!veekay::parallel::setup(workers, app.frames_in_flight, vk_graphics_queue_family)) {
+			return 1;
 		}
 	}
 
-	{ // NOTE: Create command pool from graphics queue
+	veekay::compute::setup(vk_graphics_queue_family, vk_compute_queue_family);
+
+	{ // NOTE: Create command pool for one-time submissions
 		VkCommandPoolCreateInfo info{
 			.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-			.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+			.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
 			.queueFamilyIndex = vk_graphics_queue_family,
 		};
 
@@ -608,22 +1476,6 @@ int veekay::run(const veekay::ApplicationInfo& app_info) {
 		}
 	}
 
-	{ // NOTE: Allocate command buffers
-		vk_command_buffers.resize(vk_framebuffers.size());
-		
-		VkCommandBufferAllocateInfo info{
-			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-			.commandPool = vk_command_pool,
-			.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-			.commandBufferCount = static_cast<uint32_t>(vk_command_buffers.size()),
-		};
-
-		if (vkAllocateCommandBuffers(vk_device, &info, vk_command_buffers.data()) != VK_SUCCESS) {
-			std::cerr << "Failed to allocate Vulkan command buffers\n";
-			return 1;
-		}
-	}
-
 	VkCommandBuffer onetime_command_buffer; {
 		VkCommandBufferAllocateInfo info{
 			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
@@ -652,95 +1504,153 @@ int veekay::run(const veekay::ApplicationInfo& app_info) {
 	{
 		vkEndCommandBuffer(onetime_command_buffer);
 
-		VkSubmitInfo info{
-			.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-			.commandBufferCount = 1,
-			.pCommandBuffers = &onetime_command_buffer,
-		};
-
-		vkQueueSubmit(vk_graphics_queue, 1, &info, VK_NULL_HANDLE);
-		vkQueueWaitIdle(vk_graphics_queue);
+		veekay::waitTimeline(submitGraphics(onetime_command_buffer, VK_NULL_HANDLE, 0, VK_NULL_HANDLE));
 
 		vkFreeCommandBuffers(vk_device, vk_command_pool, 1, &onetime_command_buffer);
 	}
 
-	while (veekay::app.running && !glfwWindowShouldClose(window)) {
-		veekay::input::cache();
-		
-		glfwPollEvents();
-		double time = glfwGetTime();
+	double fps_report_time = headless ? 0.0 : glfwGetTime();
+	uint32_t fps_report_frames = 0;
 
-		ImGui_ImplVulkan_NewFrame();
-		ImGui_ImplGlfw_NewFrame();
-		ImGui::NewFrame();
+	const double time_step = app_info.fixed_time_step > 0.0 ? app_info.fixed_time_step : headless_time_step;
+	const bool fixed_time = headless || app_info.fixed_time_step > 0.0;
 
-		app_info.update(time);
+	auto headless_start = std::chrono::steady_clock::now();
+	uint32_t last_image_index = 0;
 
-		ImGui::Render();
+	// NOTE: When each frame's input was last sampled, for the input to present latency
+	std::chrono::steady_clock::time_point input_times[veekay::max_frames_in_flight];
 
-		// NOTE: Wait until the previous frame finishes
-		vkWaitForFences(vk_device, 1, &vk_in_flight_fences[vk_current_frame], true, UINT64_MAX);
-		vkResetFences(vk_device, 1, &vk_in_flight_fences[vk_current_frame]);
+	const bool late_input = app_info.low_latency && app_info.late_update && !app_info.pipelined && !headless;
 
-		// NOTE: Get current swapchain framebuffer index
-		uint32_t swapchain_image_index = 0;
-		vkAcquireNextImageKHR(vk_device, vk_swapchain, UINT64_MAX,
-		                      vk_render_semaphores[vk_current_frame],
-		                      nullptr, &swapchain_image_index);
+	// NOTE: Input was already cached before an on-demand sleep, events since then belong to the next frame
+	bool input_cached = false;
 
-		VkCommandBuffer cmd = vk_command_buffers[swapchain_image_index];
+	// NOTE: First half of a frame: waits for the slot, runs update() and builds the UI
+	auto simulateFrame = [&](veekay::FrameContext& frame) {
+		// NOTE: Wait until the GPU is done with this slot before update() overwrites its data,
+		//       in low latency mode also until the previous frame is done, so input is fresh
+		veekay::waitTimeline(app_info.low_latency ? veekay::timelineSubmitted() : frame.timeline_value);
+		frame.transient->reset();
 
-		app_info.render(cmd, vk_framebuffers[swapchain_image_index]);
+		veekay::profiler::beginFrame(frame.index, frame_number);
+		veekay::resolution::beginFrame(frame);
 
-		VkCommandBuffer imgui_cmd = imgui_command_buffers[swapchain_image_index];
-		{ // NOTE: Draw ImGui
-			vkResetCommandBuffer(imgui_cmd, 0);
+		frame.number = frame_number;
+		frame.image_index = UINT32_MAX;
+		frame.framebuffer = VK_NULL_HANDLE;
 
-			{
-				VkCommandBufferBeginInfo info{
-					.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-					.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-				};
+		if (!input_cached) {
+			veekay::input::cache();
+		}
+
+		input_cached = false;
+
+		double time;
 
-				vkBeginCommandBuffer(imgui_cmd, &info);
+		if (headless) {
+			ImGui::GetIO().DeltaTime = float(time_step);
+			ImGui_ImplVulkan_NewFrame();
+		} else {
+			glfwPollEvents();
+			ImGui_ImplVulkan_NewFrame();
+			ImGui_ImplGlfw_NewFrame();
+
+			if (veekay::input::consumeActivity()) {
+				veekay::requestRedraw();
 			}
+		}
 
-			{
-				VkRenderPassBeginInfo info{
-					.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-					.renderPass = imgui_render_pass,
-					.framebuffer = imgui_framebuffers[swapchain_image_index],
-					.renderArea = {
-						.extent = {app.window_width, app.window_height},
-					},
-				};
+		input_times[frame.index] = std::chrono::steady_clock::now();
+
+		time = fixed_time ? frame_number * time_step : glfwGetTime();
+
+		ImGui::NewFrame();
+
+		auto update_start = std::chrono::steady_clock::now();
+
+		app_info.update(frame, time);
+
+		auto update_end = std::chrono::steady_clock::now();
+		veekay::profiler::recordCpu(veekay::profiler::CpuStage::update,
+		                            std::chrono::duration<double, std::milli>(update_end - update_start).count());
+
+		veekay::profiler::drawOverlay();
+		ImGui::Render();
+
+		++frame_number;
+	};
+
+	// NOTE: Second half of a frame: records, submits and presents a simulated slot
+	auto renderFrame = [&](veekay::FrameContext& frame, ImDrawData* draw_data) {
+		vkResetCommandPool(vk_device, frame.command_pool, 0);
+
+		veekay::profiler::bindFrame(frame.index);
+		veekay::parallel::beginFrame(frame.index);
+
+		ui_draw_data = draw_data;
+		recording_frame = &frame;
 
-				vkCmdBeginRenderPass(imgui_cmd, &info, VK_SUBPASS_CONTENTS_INLINE);
+		// NOTE: Get current swapchain framebuffer index, headless slots own their image
+		uint32_t swapchain_image_index = frame.index;
+		if (!headless) {
+			VkResult result = vkAcquireNextImageKHR(vk_device, vk_swapchain, UINT64_MAX,
+			                                        frame.image_available_semaphore,
+			                                        nullptr, &swapchain_image_index);
+
+			if (result == VK_SUBOPTIMAL_KHR) {
+				swapchain_out_of_date = true;
+			} else if (result != VK_SUCCESS) {
+				// NOTE: Nothing was acquired and the semaphore stays unsignaled, drop the frame
+				swapchain_out_of_date = true;
+				return;
 			}
+		}
 
-			ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), imgui_cmd);
+		// NOTE: Acquire may have blocked for a while, input from now on is fresher
+		if (late_input) {
+			veekay::input::cache();
+			glfwPollEvents();
+			input_times[frame.index] = std::chrono::steady_clock::now();
 
-			vkCmdEndRenderPass(imgui_cmd);
-			vkEndCommandBuffer(imgui_cmd);
+			app_info.late_update(frame);
 		}
 
-		{ // NOTE: Submit commands to graphics queue
-			VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		frame.image_index = swapchain_image_index;
+		frame.framebuffer = dynamic_resolution ? veekay::resolution::sceneFramebuffer()
+		                                       : vk_framebuffers[swapchain_image_index];
 
-			VkCommandBuffer buffers[] = { cmd, imgui_cmd };
+		auto stage_start = std::chrono::steady_clock::now();
+		auto stage_end = [&stage_start](veekay::profiler::CpuStage stage) {
+			auto now = std::chrono::steady_clock::now();
+			veekay::profiler::recordCpu(stage, std::chrono::duration<double, std::milli>(now - stage_start).count());
+			stage_start = now;
+		};
 
-			VkSubmitInfo info{
-				.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-				.waitSemaphoreCount = 1,
-				.pWaitSemaphores = &vk_render_semaphores[vk_current_frame],
-				.pWaitDstStageMask = &wait_stage,
-				.commandBufferCount = 2,
-				.pCommandBuffers = buffers,
-				.signalSemaphoreCount = 1,
-				.pSignalSemaphores = &vk_present_semaphores[swapchain_image_index],
-			};
+		app_info.render(frame);
+
+		stage_end(veekay::profiler::CpuStage::record);
+
+		// NOTE: Swapchain images still need binary semaphores, completion goes through the timeline
+		frame.timeline_value = submitGraphics(
+			frame.command_buffer,
+			headless ? VK_NULL_HANDLE : frame.image_available_semaphore,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			headless ? VK_NULL_HANDLE : vk_present_semaphores[swapchain_image_index]);
+
+		stage_end(veekay::profiler::CpuStage::submit);
+		veekay::profiler::endFrame();
 
-			vkQueueSubmit(vk_graphics_queue, 1, &info, vk_in_flight_fences[vk_current_frame]);
+		last_image_index = swapchain_image_index;
+
+		auto inputLatency = [&] {
+			auto now = std::chrono::steady_clock::now();
+			veekay::profiler::recordLatency(std::chrono::duration<double, std::milli>(now - input_times[frame.index]).count());
+		};
+
+		if (headless) {
+			inputLatency();
+			return;
 		}
 
 		{ // NOTE: Present renderer frame
@@ -753,56 +1663,260 @@ int veekay::run(const veekay::ApplicationInfo& app_info) {
 				.pImageIndices = &swapchain_image_index,
 			};
 
-			vkQueuePresentKHR(vk_graphics_queue, &info);
+			std::lock_guard lock(queue_mutex);
+			VkResult result = vkQueuePresentKHR(vk_graphics_queue, &info);
+
+			if (!present_retirees.empty()) {
+				advancePresentRetirees(false);
+			}
+
+			if (result == VK_SUBOPTIMAL_KHR || result == VK_ERROR_OUT_OF_DATE_KHR) {
+				swapchain_out_of_date = true;
+			}
+		}
+
+		stage_end(veekay::profiler::CpuStage::present);
+		inputLatency();
+
+		if (app_info.uncapped) { // NOTE: Report raw frame rate once per second
+			++fps_report_frames;
+
+			double now = glfwGetTime();
+			double elapsed = now - fps_report_time;
+
+			if (elapsed >= 1.0) {
+				double fps = fps_report_frames / elapsed;
+				std::cout << "FPS: " << fps << " (" << 1000.0 / fps << " ms/frame, "
+				          << presentModeName(vk_present_mode) << ")\n";
+
+				fps_report_time = now;
+				fps_report_frames = 0;
+			}
+		}
+	};
+
+	auto keepRunning = [&] {
+		return veekay::app.running &&
+		       (headless ? frame_number < app_info.headless_frames : !glfwWindowShouldClose(window));
+	};
+
+	auto presentModeChanged = [&] {
+		return !headless && requested_present_mode != app.present_mode &&
+		       choosePresentMode(requested_present_mode) != vk_present_mode;
+	};
+
+	auto swapchainStale = [&] {
+		return !headless && (swapchain_out_of_date || presentModeChanged());
+	};
+
+	// NOTE: Takes one requested frame, true if there was one
+	auto consumeRedraw = [] {
+		uint32_t count = redraw_frames.load();
+		while (count != 0 && !redraw_frames.compare_exchange_weak(count, count - 1)) {
+		}
+		return count != 0;
+	};
+
+	// NOTE: On-demand mode only: sleeps until input, a refresh or requestRedraw() wants a frame
+	auto waitForRedraw = [&] {
+		if (!on_demand || consumeRedraw()) {
+			return;
+		}
+
+		veekay::input::cache();
+		input_cached = true;
+
+		do {
+			glfwWaitEventsTimeout(on_demand_wait_timeout);
+
+			if (veekay::input::consumeActivity()) {
+				veekay::requestRedraw();
+			}
+		} while (keepRunning() && !swapchainStale() && !consumeRedraw());
+	};
+
+	if (!app_info.pipelined) {
+		while (keepRunning()) {
+			waitForRedraw();
 
-			vk_current_frame = (vk_current_frame + 1) % max_frames_in_flight;
+			if (!keepRunning()) {
+				break;
+			}
+
+			veekay::deletion::collect(false);
+
+			if (swapchainStale() && !rebuildSwapchain()) {
+				return 1;
+			}
+
+			veekay::FrameContext& frame = frames[vk_current_frame];
+
+			simulateFrame(frame);
+			renderFrame(frame, ImGui::GetDrawData());
+
+			vk_current_frame = (vk_current_frame + 1) % app.frames_in_flight;
+		}
+	} else {
+		/* NOTE:
+			Slots travel in a ring between the two threads: the simulation thread
+			takes a free slot, waits for its timeline value, runs update() and snapshots the
+			UI into it, then hands it over through ready_slots. The render thread
+			records and submits it and gives it back through free_slots. A slot is
+			therefore never touched by both threads at once, and everything the
+			render thread reads for frame N was written before the hand-off.
+		*/
+		ui_snapshots.resize(app.frames_in_flight);
+
+		veekay::SpscQueue<uint32_t, veekay::max_frames_in_flight + 1> ready_slots;
+		veekay::SpscQueue<uint32_t, veekay::max_frames_in_flight> free_slots;
+
+		constexpr uint32_t stop_slot = UINT32_MAX;
+
+		for (uint32_t i = 0; i < app.frames_in_flight; ++i) {
+			free_slots.push(i);
+		}
+
+		std::thread render_thread([&] {
+			for (uint32_t slot; (slot = ready_slots.pop()) != stop_slot;) {
+				renderFrame(frames[slot], &ui_snapshots[slot].draw_data);
+				free_slots.push(slot);
+			}
+		});
+
+		bool failed = false;
+
+		while (keepRunning()) {
+			waitForRedraw();
+
+			if (!keepRunning()) {
+				break;
+			}
+
+			veekay::deletion::collect(false);
+
+			if (swapchainStale()) {
+				// NOTE: Holding every slot means the render thread is idle and owns nothing
+				uint32_t held[veekay::max_frames_in_flight];
+
+				for (uint32_t i = 0; i < app.frames_in_flight; ++i) {
+					held[i] = free_slots.pop();
+				}
+
+				failed = !rebuildSwapchain();
+
+				for (uint32_t i = 0; i < app.frames_in_flight; ++i) {
+					free_slots.push(held[i]);
+				}
+
+				if (failed) {
+					break;
+				}
+			}
+
+			uint32_t slot = free_slots.pop();
+
+			simulateFrame(frames[slot]);
+			snapshotDrawData(ui_snapshots[slot], ImGui::GetDrawData());
+
+			ready_slots.push(slot);
+		}
+
+		ready_slots.push(stop_slot);
+		render_thread.join();
+
+		if (failed) {
+			return 1;
 		}
 	}
 
 	vkDeviceWaitIdle(vk_device);
+	veekay::deletion::collect(true);
 
-	app_info.shutdown();
+	veekay::profiler::finish();
 
-	vkDestroyCommandPool(vk_device, vk_command_pool, nullptr);
+	if (app_info.profile_output && !veekay::profiler::exportTimings(app_info.profile_output)) {
+		std::cerr << "Failed to write profiler timings\n";
+	}
 
-	for (size_t i = 0, e = vk_swapchain_images.size(); i != e; ++i) {
-		vkDestroySemaphore(vk_device, vk_present_semaphores[i], nullptr);
+	if (headless) {
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - headless_start).count();
+
+		std::cout << "Rendered " << frame_number << " frames in " << seconds << " s ("
+		          << (frame_number ? 1000.0 * seconds / frame_number : 0.0) << " ms/frame)\n";
+
+		if (app_info.headless_output && frame_number > 0 &&
+		    !writeImagePPM(app_info.headless_output, vk_swapchain_images[last_image_index])) {
+			return 1;
+		}
 	}
 
-	for (size_t i = 0; i < max_frames_in_flight; ++i) {
-		vkDestroySemaphore(vk_device, vk_render_semaphores[i], nullptr);
-		vkDestroyFence(vk_device, vk_in_flight_fences[i], nullptr);
+	app_info.shutdown();
+
+	veekay::profiler::shutdown();
+	veekay::parallel::shutdown();
+
+	vkDestroyCommandPool(vk_device, vk_command_pool, nullptr);
+
+	for (veekay::FrameContext& frame : frames) {
+		delete frame.transient;
+		vkDestroySemaphore(vk_device, frame.image_available_semaphore, nullptr);
+		vkDestroyCommandPool(vk_device, frame.command_pool, nullptr);
 	}
 	
+	veekay::resolution::shutdown();
+
 	vkDestroyRenderPass(vk_device, vk_render_pass, nullptr);
 
+	if (dynamic_resolution) {
+		vkDestroyRenderPass(vk_device, vk_present_render_pass, nullptr);
+	}
+
 	vkDestroyImageView(vk_device, vk_image_depth_view, nullptr);
 	vkFreeMemory(vk_device, vk_image_depth_memory, nullptr);
 	vkDestroyImage(vk_device, vk_image_depth, nullptr);
 
-	vkDestroyCommandPool(vk_device, imgui_command_pool, nullptr);
-	vkDestroyRenderPass(vk_device, imgui_render_pass, nullptr);
+	destroySwapchainFramebuffers();
+	{
+		std::lock_guard lock(queue_mutex);
+		advancePresentRetirees(true);
+	}
+	veekay::deletion::collect(true);
 
-	for (size_t i = 0, e = vk_framebuffers.size(); i != e; ++i) {
-		vkDestroyFramebuffer(vk_device, vk_framebuffers[i], nullptr);
-		vkDestroyFramebuffer(vk_device, imgui_framebuffers[i], nullptr);
-		vkDestroyImageView(vk_device, vk_swapchain_image_views[i], nullptr);
+	for (UiSnapshot& snapshot : ui_snapshots) {
+		releaseDrawData(snapshot.draw_data);
 	}
 
+	ui_snapshots.clear();
+
 	ImGui_ImplVulkan_Shutdown();
-	ImGui_ImplGlfw_Shutdown();
+	if (!headless) {
+		ImGui_ImplGlfw_Shutdown();
+	}
 	ImGui::DestroyContext();
 
 	vkDestroyDescriptorPool(vk_device, imgui_descriptor_pool, nullptr);
-	
-	vkDestroySwapchainKHR(vk_device, vk_swapchain, nullptr);
+
+	if (headless) {
+		destroyOffscreenTargets();
+	} else {
+		vkDestroySwapchainKHR(vk_device, vk_swapchain, nullptr);
+	}
+
+	vkDestroySemaphore(vk_device, vk_graphics_timeline, nullptr);
+
 	vkDestroyDevice(vk_device, nullptr);
-	vkDestroySurfaceKHR(vk_instance, vk_surface, nullptr);
+
+	if (!headless) {
+		vkDestroySurfaceKHR(vk_instance, vk_surface, nullptr);
+	}
+
 	vkb::destroy_debug_utils_messenger(vk_instance, vk_debug_messenger);
 	vkDestroyInstance(vk_instance, nullptr);
 
-	glfwDestroyWindow(window);
-	glfwTerminate();
+	if (!headless) {
+		glfwDestroyWindow(window);
+		glfwTerminate();
+	}
 	
 	return 0;
 }
@@ -0,0 +1,164 @@
+#include "virtual_shadow_map.h"
+#include <algorithm>
+#include <bit>
+
+VirtualShadowMap::VirtualShadowMap(uint32_t tableSize, uint32_t poolPages)
+    : tableSize_(std::bit_ceil(tableSize)),
+      poolPages_(poolPages),
+      table_(tableSize_ * tableSize_, 0),
+      cells_(tableSize_ * tableSize_, -1),
+      physical_(poolPages_ * poolPages_) {
+    // Сначала раздаются младшие страницы
+    for (uint32_t i = static_cast<uint32_t>(physical_.size()); i > 0; --i) {
+        free_.push_back(i - 1);
+    }
+}
+
+uint32_t VirtualShadowMap::cell(Page page) const {
+    // tableSize_ — степень двойки, маска даёт неотрицательный остаток и для отрицательных координат
+    uint32_t mask = tableSize_ - 1;
+    return (static_cast<uint32_t>(page.y) & mask) * tableSize_ + (static_cast<uint32_t>(page.x) & mask);
+}
+
+bool VirtualShadowMap::inWindow(Page page) const {
+    int32_t size = static_cast<int32_t>(tableSize_);
+    return page.x >= origin_.x && page.x < origin_.x + size && page.y >= origin_.y && page.y < origin_.y + size;
+}
+
+void VirtualShadowMap::unmap(uint32_t physical) {
+    Physical& p = physical_[physical];
+    uint32_t c = cell(p.page);
+    cells_[c] = -1;
+    table_[c] = 0;
+    p.mapped = false;
+    p.dirty = false;
+    free_.push_back(physical);
+    --residentPages_;
+}
+
+void VirtualShadowMap::invalidateAll() {
+    for (uint32_t i = 0; i < physical_.size(); ++i) {
+        if (physical_[i].mapped) {
+            unmap(i);
+        }
+    }
+}
+
+void VirtualShadowMap::invalidate(Page min, Page max) {
+    int32_t size = static_cast<int32_t>(tableSize_);
+    min.x = std::max(min.x, origin_.x);
+    min.y = std::max(min.y, origin_.y);
+    max.x = std::min(max.x, origin_.x + size - 1);
+    max.y = std::min(max.y, origin_.y + size - 1);
+
+    for (int32_t y = min.y; y <= max.y; ++y) {
+        for (int32_t x = min.x; x <= max.x; ++x) {
+            uint32_t c = cell(Page{x, y});
+            if (cells_[c] >= 0) {
+                physical_[cells_[c]].dirty = true;
+                table_[c] = 0;
+            }
+        }
+    }
+}
+
+void VirtualShadowMap::setOrigin(Page origin) {
+    if (origin.x == origin_.x && origin.y == origin_.y) {
+        return;
+    }
+    origin_ = origin;
+    for (uint32_t i = 0; i < physical_.size(); ++i) {
+        if (physical_[i].mapped && !inWindow(physical_[i].page)) {
+            unmap(i);
+        }
+    }
+}
+
+void VirtualShadowMap::request(const uint32_t* bits, Page requestOrigin) {
+    int32_t size = static_cast<int32_t>(tableSize_);
+    uint32_t words = tableSize_ * tableSize_ / 32;
+
+    for (uint32_t w = 0; w < words; ++w) {
+        for (uint32_t word = bits[w]; word != 0; word &= word - 1) {
+            uint32_t index = w * 32 + static_cast<uint32_t>(std::countr_zero(word));
+            int32_t cx = static_cast<int32_t>(index % tableSize_);
+            int32_t cy = static_cast<int32_t>(index / tableSize_);
+            // Единственная страница окна запросившего кадра, попадающая в эту ячейку
+            Page page{requestOrigin.x + ((cx - requestOrigin.x) % size + size) % size,
+                      requestOrigin.y + ((cy - requestOrigin.y) % size + size) % size};
+            if (inWindow(page)) {
+                requested_.push_back(page);
+            }
+        }
+    }
+}
+
+bool VirtualShadowMap::allocate(uint64_t frame, uint32_t& physical) {
+    if (!free_.empty()) {
+        physical = free_.back();
+        free_.pop_back();
+        return true;
+    }
+
+    // Вытесняется давно не запрошенная страница; запрошенные в этом кадре не трогаем
+    int64_t victim = -1;
+    for (uint32_t i = 0; i < physical_.size(); ++i) {
+        const Physical& p = physical_[i];
+        if (p.mapped && p.lastUsed < frame && (victim < 0 || p.lastUsed < physical_[victim].lastUsed)) {
+            victim = i;
+        }
+    }
+    if (victim < 0) {
+        return false;
+    }
+    unmap(static_cast<uint32_t>(victim));
+    physical = free_.back();
+    free_.pop_back();
+    return true;
+}
+
+uint32_t VirtualShadowMap::update(uint64_t frame, uint32_t maxRenders, Render* renders) {
+    for (const Page& page : requested_) {
+        int32_t physical = cells_[cell(page)];
+        if (physical >= 0) {
+            physical_[physical].lastUsed = frame;
+        }
+    }
+
+    uint32_t count = 0;
+    auto render = [&](uint32_t physical) {
+        Physical& p = physical_[physical];
+        p.dirty = false;
+        table_[cell(p.page)] = physical + 1;
+        renders[count++] = Render{physical, p.page};
+    };
+
+    // Сначала устаревшие резидентные: их тень уже была на экране
+    for (const Page& page : requested_) {
+        int32_t physical = cells_[cell(page)];
+        if (count < maxRenders && physical >= 0 && physical_[physical].dirty) {
+            render(static_cast<uint32_t>(physical));
+        }
+    }
+
+    for (const Page& page : requested_) {
+        if (count >= maxRenders) {
+            break;
+        }
+        uint32_t c = cell(page);
+        if (cells_[c] >= 0) {
+            continue;
+        }
+        uint32_t physical;
+        if (!allocate(frame, physical)) {
+            break;
+        }
+        physical_[physical] = Physical{page, frame, true, true};
+        cells_[c] = static_cast<int32_t>(physical);
+        ++residentPages_;
+        render(physical);
+    }
+
+    requested_.clear();
+    return count;
+}
@@ -0,0 +1,132 @@
+#include "quality_governor.h"
+#include "test.h"
+
+#include <vector>
+
+namespace {
+
+constexpr double kBudget = 1000.0 / 60.0;
+
+struct Run {
+    std::vector<int> tiers; // уровень после каждого кадра
+    std::vector<QualityGovernor::Change> changes;
+    std::vector<size_t> changeFrames;
+};
+
+// Прогоняет frames кадров; frameMs(кадр, уровень) — синтетическое время кадра
+template <typename FrameMs>
+Run simulate(QualityGovernor& governor, size_t frames, FrameMs frameMs) {
+    Run run;
+    for (size_t i = 0; i < frames; ++i) {
+        double ms = frameMs(i, governor.tier());
+        QualityGovernor::Change change{};
+        if (governor.addSample(ms, ms, change)) {
+            run.changes.push_back(change);
+            run.changeFrames.push_back(i);
+        }
+        run.tiers.push_back(governor.tier());
+    }
+    return run;
+}
+
+} // namespace
+
+TEST(governorIgnoresSingleSpike) {
+    QualityGovernor governor(4, 2);
+    governor.setBudget(kBudget);
+
+    // Ровно в полосе гистерезиса, один кадр в шесть раз дольше бюджета
+    Run run = simulate(governor, 600, [](size_t frame, int) { return frame == 300 ? 100.0 : 13.0; });
+
+    CHECK(run.changes.empty());
+    CHECK(governor.tier() == 2);
+}
+
+TEST(governorIgnoresShortBurst) {
+    QualityGovernor governor(4, 2);
+    governor.setBudget(kBudget);
+
+    // Десять тяжёлых кадров подряд — меньше, чем нужно для понижения
+    Run run = simulate(governor, 600, [](size_t frame, int) {
+        return frame >= 300 && frame < 310 ? 25.0 : 13.0;
+    });
+
+    CHECK(run.changes.empty());
+}
+
+TEST(governorLowersAfterSustainedOverload) {
+    QualityGovernor governor(4, 3);
+    governor.setBudget(kBudget);
+
+    Run run = simulate(governor, 40, [](size_t, int) { return 25.0; });
+
+    CHECK(run.changes.size() == 1);
+    if (!run.changes.empty()) {
+        CHECK(run.changes[0].from == 3);
+        CHECK(run.changes[0].to == 2);
+        CHECK(run.changes[0].gpuMs > kBudget);
+        // Не раньше, чем через 30 кадров сверх бюджета
+        CHECK(run.changeFrames[0] >= 29);
+    }
+}
+
+TEST(governorRaisesAfterSustainedHeadroom) {
+    QualityGovernor governor(4, 0);
+    governor.setBudget(kBudget);
+
+    Run run = simulate(governor, 200, [](size_t, int) { return 5.0; });
+
+    CHECK(run.changes.size() == 1);
+    if (!run.changes.empty()) {
+        CHECK(run.changes[0].to == 1);
+        CHECK(run.changeFrames[0] >= 119);
+    }
+}
+
+TEST(governorBacksOffInsteadOfOscillating) {
+    QualityGovernor governor(4, 1);
+    governor.setBudget(kBudget);
+
+    // Уровень 1 оставляет большой запас, уровень 2 не укладывается в бюджет:
+    // без отката регулятор прыгал бы между ними каждые ~150 кадров
+    Run run = simulate(governor, 6000, [](size_t, int tier) { return tier <= 1 ? 10.0 : 20.0; });
+
+    CHECK(!run.changes.empty());
+    for (int tier : run.tiers) {
+        CHECK(tier == 1 || tier == 2);
+    }
+
+    // Каждая следующая попытка подняться ждёт не меньше предыдущей, и в целом дольше
+    std::vector<size_t> raises;
+    for (size_t i = 0; i < run.changes.size(); ++i) {
+        if (run.changes[i].to > run.changes[i].from) {
+            raises.push_back(run.changeFrames[i]);
+        }
+    }
+    CHECK(raises.size() >= 3);
+    CHECK(raises.size() <= 6);
+    for (size_t i = 2; i < raises.size(); ++i) {
+        CHECK(raises[i] - raises[i - 1] >= raises[i - 1] - raises[i - 2]);
+    }
+    if (raises.size() >= 3) {
+        CHECK(raises[2] - raises[1] > raises[1] - raises[0]);
+    }
+
+    // Между двумя сменами уровня всегда не меньше окна понижения
+    for (size_t i = 1; i < run.changeFrames.size(); ++i) {
+        CHECK(run.changeFrames[i] - run.changeFrames[i - 1] >= 30);
+    }
+}
+
+TEST(governorManualTierResetsCounters) {
+    QualityGovernor governor(4, 3);
+    governor.setBudget(kBudget);
+
+    // 25 кадров перегрузки, затем ручной выбор: счётчик начинается заново
+    simulate(governor, 25, [](size_t, int) { return 25.0; });
+    governor.setTier(3);
+    Run run = simulate(governor, 20, [](size_t, int) { return 25.0; });
+
+    CHECK(run.changes.empty());
+    CHECK(governor.tier() == 3);
+}
@@ -0,0 +1,164 @@
+#include "shadow_atlas.h"
+#include "test.h"
+
+#include <vector>
+
+namespace {
+
+bool overlaps(const ShadowAtlas::Tile& a, const ShadowAtlas::Tile& b) {
+    return a.x < b.x + b.size && b.x < a.x + a.size && a.y < b.y + b.size && b.y < a.y + a.size;
+}
+
+// Выданные тайлы лежат в атласе и не пересекаются
+bool validLayout(const ShadowAtlas& atlas, const std::vector<ShadowAtlas::Tile>& tiles) {
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        if (tiles[i].size == 0) continue;
+        if (tiles[i].x + tiles[i].size > atlas.size() || tiles[i].y + tiles[i].size > atlas.size()) {
+            return false;
+        }
+        for (size_t j = i + 1; j < tiles.size(); ++j) {
+            if (tiles[j].size != 0 && overlaps(tiles[i], tiles[j])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool sameTile(const ShadowAtlas::Tile& a, const ShadowAtlas::Tile& b) {
+    return a.x == b.x && a.y == b.y && a.size == b.size;
+}
+
+} // namespace
+
+TEST(atlasRoundsTileSizes) {
+    ShadowAtlas atlas(1000, 100);
+    CHECK(atlas.size() == 1024);
+    CHECK(atlas.minTileSize() == 128);
+
+    ShadowAtlas::Tile tile;
+    CHECK(atlas.allocate(300, tile));
+    CHECK(tile.size == 512);
+    CHECK(atlas.allocate(1, tile));
+    CHECK(tile.size == 128);
+}
+
+TEST(atlasRefusesWhenFull) {
+    ShadowAtlas atlas(1024, 128);
+    std::vector<ShadowAtlas::Tile> tiles(4);
+    for (ShadowAtlas::Tile& tile : tiles) {
+        CHECK(atlas.allocate(512, tile));
+    }
+    CHECK(validLayout(atlas, tiles));
+    CHECK(atlas.usedArea() == 1024u * 1024u);
+
+    ShadowAtlas::Tile extra;
+    CHECK(!atlas.allocate(128, extra));
+    CHECK(!atlas.allocate(1024, extra));
+    CHECK(atlas.usedArea() == 1024u * 1024u);
+}
+
+TEST(atlasMergesFreedSiblings) {
+    ShadowAtlas atlas(1024, 128);
+    std::vector<ShadowAtlas::Tile> tiles(16);
+    for (ShadowAtlas::Tile& tile : tiles) {
+        CHECK(atlas.allocate(256, tile));
+    }
+    CHECK(validLayout(atlas, tiles));
+
+    // Пока занят хоть один из четырёх соседей, родитель целиком не выдаётся
+    for (size_t i = 0; i < 3; ++i) {
+        atlas.release(tiles[i]);
+    }
+    ShadowAtlas::Tile big;
+    CHECK(!atlas.allocate(512, big));
+
+    // Освобождённые соседи сливаются обратно, вплоть до корня
+    for (size_t i = 3; i < tiles.size(); ++i) {
+        atlas.release(tiles[i]);
+    }
+    CHECK(atlas.usedArea() == 0);
+    CHECK(atlas.allocate(1024, big));
+    CHECK(big.x == 0 && big.y == 0 && big.size == 1024);
+}
+
+TEST(atlasIgnoresDoubleRelease) {
+    ShadowAtlas atlas(1024, 128);
+    ShadowAtlas::Tile a, b;
+    CHECK(atlas.allocate(512, a));
+    CHECK(atlas.allocate(512, b));
+    atlas.release(a);
+    atlas.release(a);
+    CHECK(atlas.usedArea() == 512u * 512u);
+
+    ShadowAtlas::Tile none;
+    atlas.release(none);
+    CHECK(atlas.usedArea() == 512u * 512u);
+}
+
+TEST(atlasGroupIsAllOrNothing) {
+    ShadowAtlas atlas(1024, 128);
+    ShadowAtlas::Tile spot;
+    CHECK(atlas.allocate(512, spot));
+
+    // Шесть граней по 512 не помещаются в оставшиеся три четверти
+    ShadowAtlas::Tile faces[6];
+    CHECK(!atlas.allocate(ShadowAtlas::Group{512, 6, faces}, 512));
+    for (const ShadowAtlas::Tile& face : faces) {
+        CHECK(face.size == 0);
+    }
+    CHECK(atlas.usedArea() == 512u * 512u);
+
+    CHECK(atlas.allocate(ShadowAtlas::Group{256, 6, faces}, 256));
+    CHECK(validLayout(atlas, {spot, faces[0], faces[1], faces[2], faces[3], faces[4], faces[5]}));
+}
+
+TEST(atlasRepackShrinksGroupsThatDoNotFit) {
+    ShadowAtlas atlas(1024, 128);
+    std::vector<ShadowAtlas::Tile> tiles(9);
+    // Прожектор 512, точечный источник 6 × 512, прожектор 256, прожектор 1024
+    std::vector<ShadowAtlas::Group> groups = {
+        {512, 1, &tiles[0]}, {512, 6, &tiles[1]}, {256, 1, &tiles[7]}, {1024, 1, &tiles[8]}};
+    atlas.repack(groups.data(), static_cast<uint32_t>(groups.size()));
+
+    CHECK(sameTile(tiles[0], {0, 0, 512}));
+    for (size_t face = 1; face <= 6; ++face) {
+        CHECK(tiles[face].size == 256);
+    }
+    CHECK(tiles[7].size == 256);
+    // Последнему остаётся свободная четверть
+    CHECK(sameTile(tiles[8], {512, 512, 512}));
+    CHECK(validLayout(atlas, tiles));
+}
+
+TEST(atlasRepackIsDeterministic) {
+    std::vector<ShadowAtlas::Tile> first(10), second(10);
+    auto groupsFor = [](std::vector<ShadowAtlas::Tile>& tiles) {
+        return std::vector<ShadowAtlas::Group>{
+            {1024, 1, &tiles[0]}, {512, 6, &tiles[1]}, {512, 1, &tiles[7]}, {256, 1, &tiles[8]}, {128, 1, &tiles[9]}};
+    };
+
+    ShadowAtlas fresh(2048, 128);
+    std::vector<ShadowAtlas::Group> groups = groupsFor(first);
+    fresh.repack(groups.data(), static_cast<uint32_t>(groups.size()));
+
+    // Раздробленный атлас и мусор в тайлах не влияют на результат
+    ShadowAtlas fragmented(2048, 128);
+    std::vector<ShadowAtlas::Tile> scattered(20);
+    for (ShadowAtlas::Tile& tile : scattered) {
+        fragmented.allocate(128, tile);
+    }
+    for (size_t i = 0; i < scattered.size(); i += 2) {
+        fragmented.release(scattered[i]);
+    }
+    second.assign(second.size(), ShadowAtlas::Tile{7, 7, 7});
+    groups = groupsFor(second);
+    fragmented.repack(groups.data(), static_cast<uint32_t>(groups.size()));
+
+    for (size_t i = 0; i < first.size(); ++i) {
+        CHECK(sameTile(first[i], second[i]));
+        CHECK(first[i].size != 0);
+    }
+    CHECK(validLayout(fresh, first));
+    CHECK(fresh.usedArea() == fragmented.usedArea());
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdio>
+#include <vector>
+
+// Минимальная обвязка модульных тестов без внешних зависимостей:
+// TEST(name) регистрирует тест, CHECK(условие) отмечает провал и продолжает.
+struct TestCase {
+    const char* name;
+    void (*run)();
+};
+
+std::vector<TestCase>& testCases();
+int& testFailures();
+
+struct TestRegistrar {
+    TestRegistrar(const char* name, void (*run)()) { testCases().push_back({name, run}); }
+};
+
+#define TEST(name)                                                  \
+    static void name();                                             \
+    static const TestRegistrar name##Registrar(#name, name);        \
+    static void name()
+
+#define CHECK(condition)                                                                    \
+    do {                                                                                    \
+        if (!(condition)) {                                                                 \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            ++testFailures();                                                               \
+        }                                                                                   \
+    } while (0)
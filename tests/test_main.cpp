@@ -0,0 +1,24 @@
+#include "test.h"
+
+std::vector<TestCase>& testCases() {
+    static std::vector<TestCase> cases;
+    return cases;
+}
+
+int& testFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+int main() {
+    int failedTests = 0;
+    for (const TestCase& test : testCases()) {
+        int before = testFailures();
+        test.run();
+        bool passed = testFailures() == before;
+        failedTests += passed ? 0 : 1;
+        std::printf("[%s] %s\n", passed ? "  OK  " : "FAILED", test.name);
+    }
+    std::printf("%zu tests, %d failed\n", testCases().size(), failedTests);
+    return failedTests == 0 ? 0 : 1;
+}
@@ -0,0 +1,192 @@
+#include "virtual_shadow_map.h"
+#include "test.h"
+
+#include <initializer_list>
+#include <vector>
+
+namespace {
+
+using Page = VirtualShadowMap::Page;
+
+constexpr uint32_t kTable = 8;
+
+uint32_t cellOf(Page page) {
+    return (static_cast<uint32_t>(page.y) & (kTable - 1)) * kTable + (static_cast<uint32_t>(page.x) & (kTable - 1));
+}
+
+// Биты запросов, как их пишет frag.glsl
+std::vector<uint32_t> requestBits(std::initializer_list<Page> pages) {
+    std::vector<uint32_t> bits(kTable * kTable / 32, 0);
+    for (Page page : pages) {
+        uint32_t cell = cellOf(page);
+        bits[cell / 32] |= 1u << (cell % 32);
+    }
+    return bits;
+}
+
+std::vector<VirtualShadowMap::Render> frame(VirtualShadowMap& vsm, uint64_t number, uint32_t maxRenders,
+                                            std::initializer_list<Page> pages) {
+    std::vector<uint32_t> bits = requestBits(pages);
+    vsm.request(bits.data(), vsm.origin());
+    std::vector<VirtualShadowMap::Render> renders(maxRenders);
+    renders.resize(vsm.update(number, maxRenders, renders.data()));
+    return renders;
+}
+
+uint32_t tableEntry(const VirtualShadowMap& vsm, Page page) {
+    return vsm.table()[cellOf(page)];
+}
+
+bool rendered(const std::vector<VirtualShadowMap::Render>& renders, Page page) {
+    for (const VirtualShadowMap::Render& render : renders) {
+        if (render.page.x == page.x && render.page.y == page.y) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+TEST(vsmRendersRequestedPages) {
+    VirtualShadowMap vsm(kTable, 2);
+    auto renders = frame(vsm, 1, 8, {{1, 2}, {3, 4}});
+
+    CHECK(renders.size() == 2);
+    CHECK(rendered(renders, {1, 2}) && rendered(renders, {3, 4}));
+    CHECK(vsm.residentPages() == 2);
+    for (const VirtualShadowMap::Render& render : renders) {
+        CHECK(tableEntry(vsm, render.page) == render.physical + 1);
+    }
+
+    // Уже нарисованные страницы не рисуются снова
+    CHECK(frame(vsm, 2, 8, {{1, 2}, {3, 4}}).empty());
+}
+
+TEST(vsmHandlesNegativePages) {
+    VirtualShadowMap vsm(kTable, 2);
+    vsm.setOrigin({-10, -10});
+
+    auto renders = frame(vsm, 1, 8, {{-3, -3}, {-10, -9}});
+    CHECK(renders.size() == 2);
+    CHECK(rendered(renders, {-3, -3}) && rendered(renders, {-10, -9}));
+    CHECK(tableEntry(vsm, {-3, -3}) != 0);
+    CHECK(tableEntry(vsm, {-10, -9}) != 0);
+}
+
+TEST(vsmKeepsPagesWhileTheWindowMoves) {
+    VirtualShadowMap vsm(kTable, 2);
+    auto renders = frame(vsm, 1, 8, {{0, 0}, {7, 7}});
+    CHECK(renders.size() == 2);
+    uint32_t kept = tableEntry(vsm, {7, 7});
+
+    // (7, 7) остаётся в окне 4..11 и в своей ячейке, (0, 0) выходит из него
+    vsm.setOrigin({4, 4});
+    CHECK(vsm.residentPages() == 1);
+    CHECK(tableEntry(vsm, {7, 7}) == kept);
+    CHECK(tableEntry(vsm, {0, 0}) == 0);
+
+    // Ячейку (0, 0) занимает (8, 8), а (7, 7) не перерисовывается
+    renders = frame(vsm, 2, 8, {{7, 7}, {8, 8}});
+    CHECK(renders.size() == 1);
+    CHECK(rendered(renders, {8, 8}));
+    CHECK(tableEntry(vsm, {8, 8}) != 0);
+    CHECK(tableEntry(vsm, {7, 7}) == kept);
+
+    // Окно уходит в отрицательные координаты
+    vsm.setOrigin({-6, -6});
+    CHECK(vsm.residentPages() == 0);
+    for (uint32_t entry : vsm.table()) {
+        CHECK(entry == 0);
+    }
+}
+
+TEST(vsmMapsRequestsFromAnOlderWindow) {
+    VirtualShadowMap vsm(kTable, 2);
+    std::vector<uint32_t> bits = requestBits({{1, 1}, {5, 5}});
+
+    // Запросы кадра с окном 0..7 приходят, когда окно уже 4..11: (1, 1) из него вышла
+    vsm.setOrigin({4, 4});
+    vsm.request(bits.data(), {0, 0});
+    std::vector<VirtualShadowMap::Render> renders(8);
+    renders.resize(vsm.update(1, 8, renders.data()));
+
+    CHECK(renders.size() == 1);
+    CHECK(rendered(renders, {5, 5}));
+    CHECK(!rendered(renders, {9, 9}));
+}
+
+TEST(vsmEvictsLeastRecentlyUsed) {
+    VirtualShadowMap vsm(kTable, 2); // четыре физические страницы
+    Page a{0, 0}, b{1, 0}, c{2, 0}, d{3, 0}, e{4, 0}, f{5, 0};
+
+    CHECK(frame(vsm, 1, 8, {a, b, c, d}).size() == 4);
+    CHECK(frame(vsm, 2, 8, {a}).empty());
+    CHECK(frame(vsm, 3, 8, {c}).empty());
+
+    // Дольше всех не запрашивались b и d
+    auto renders = frame(vsm, 4, 8, {e});
+    CHECK(renders.size() == 1);
+    CHECK(tableEntry(vsm, b) == 0);
+    CHECK(tableEntry(vsm, a) != 0 && tableEntry(vsm, c) != 0 && tableEntry(vsm, d) != 0);
+
+    renders = frame(vsm, 5, 8, {f});
+    CHECK(renders.size() == 1);
+    CHECK(tableEntry(vsm, d) == 0);
+    CHECK(tableEntry(vsm, a) != 0 && tableEntry(vsm, c) != 0);
+    CHECK(vsm.residentPages() == 4);
+}
+
+TEST(vsmNeverEvictsPagesRequestedThisFrame) {
+    VirtualShadowMap vsm(kTable, 2);
+    Page a{0, 0};
+    CHECK(frame(vsm, 1, 8, {a, {1, 0}, {2, 0}, {3, 0}}).size() == 4);
+
+    // Пул полон: из четырёх новых помещаются три, a остаётся
+    auto renders = frame(vsm, 2, 8, {a, {0, 1}, {1, 1}, {2, 1}, {3, 1}});
+    CHECK(renders.size() == 3);
+    CHECK(!rendered(renders, a));
+    CHECK(tableEntry(vsm, a) != 0);
+    CHECK(vsm.residentPages() == 4);
+}
+
+TEST(vsmClampsRendersToTheBudget) {
+    VirtualShadowMap vsm(kTable, 4);
+    std::initializer_list<Page> pages = {{0, 0}, {1, 0}, {2, 0}, {3, 0}, {4, 0}, {5, 0}};
+
+    CHECK(frame(vsm, 1, 4, pages).size() == 4);
+    CHECK(vsm.residentPages() == 4);
+    // Остальные ждут следующего кадра
+    CHECK(frame(vsm, 2, 4, pages).size() == 2);
+    CHECK(frame(vsm, 3, 4, pages).empty());
+    CHECK(vsm.residentPages() == 6);
+}
+
+TEST(vsmInvalidationClearsRenderedPages) {
+    VirtualShadowMap vsm(kTable, 4);
+    auto renders = frame(vsm, 1, 8, {{0, 0}, {1, 1}, {5, 5}});
+    CHECK(renders.size() == 3);
+    uint32_t physical = tableEntry(vsm, {1, 1});
+
+    vsm.invalidate({0, 0}, {2, 2});
+    CHECK(tableEntry(vsm, {0, 0}) == 0);
+    CHECK(tableEntry(vsm, {1, 1}) == 0);
+    CHECK(tableEntry(vsm, {5, 5}) != 0);
+    CHECK(vsm.residentPages() == 3);
+
+    // Устаревшие страницы рисуются первыми и в ту же физическую страницу
+    renders = frame(vsm, 2, 1, {{7, 7}, {1, 1}, {5, 5}, {0, 0}});
+    CHECK(renders.size() == 1);
+    CHECK(rendered(renders, {1, 1}) || rendered(renders, {0, 0}));
+    CHECK(!rendered(renders, {7, 7}));
+    renders = frame(vsm, 3, 8, {{7, 7}, {1, 1}, {5, 5}, {0, 0}});
+    CHECK(renders.size() == 2);
+    CHECK(tableEntry(vsm, {1, 1}) == physical);
+    CHECK(tableEntry(vsm, {0, 0}) != 0 && tableEntry(vsm, {7, 7}) != 0);
+
+    vsm.invalidateAll();
+    CHECK(vsm.residentPages() == 0);
+    for (uint32_t entry : vsm.table()) {
+        CHECK(entry == 0);
+    }
+}